@@ -36,22 +36,19 @@ static uint32_t colorInterpolate(int gray4, uint32_t fg, uint32_t bg) {
 	return r;
 }
 
-static int coprocSticky;
-static uint64_t cop_prod, cop_shift;
-static uint32_t cop_quot, cop_rem, cop_over;
-static uint32_t cop_fgcolor, cop_bgcolor, cop_monobits, cop_color;
+// Coprocessor state is part of the machine state in chadContext.
 
 static uint32_t coprocRead(void) {
 	uint32_t r = 0;						// default return value
-	switch (coprocSticky & 0x0F) {		// get the result of the previous operation
-	case 1: r = cop_over | COP_OPTIONS;               break; // trigger:
-	case 2:	r = CELLMASK & (cop_prod >> CELLBITS);    break; // 9
-	case 3:	r = CELLMASK & cop_prod;				  break; // 9
-	case 4:	r = cop_quot;							  break; // 10
-	case 5:	r = cop_rem;							  break; // 10
-	case 6:	r = CELLMASK & (cop_shift >> CELLBITS);   break; // 11
-	case 7:	r = CELLMASK & cop_shift;				  break; // 11
-	case 8: r = cop_color;				              break; // 12
+	switch (CX->m.coprocSticky & 0x0F) {	// result of the previous operation
+	case 1: r = CX->m.cop_over | COP_OPTIONS;         break; // trigger:
+	case 2:	r = CELLMASK & (CX->m.cop_prod >> CELLBITS); break; // 9
+	case 3:	r = CELLMASK & CX->m.cop_prod;				  break; // 9
+	case 4:	r = CX->m.cop_quot;							  break; // 10
+	case 5:	r = CX->m.cop_rem;							  break; // 10
+	case 6:	r = CELLMASK & (CX->m.cop_shift >> CELLBITS); break; // 11
+	case 7:	r = CELLMASK & CX->m.cop_shift;				  break; // 11
+	case 8: r = CX->m.cop_color;				              break; // 12
 	}
 	return r;
 }
@@ -62,7 +59,7 @@ static void coprocGo(
 	uint32_t nos,						// next on stack register
 	uint32_t w) {						// w register
 
-	coprocSticky = sel;
+	CX->m.coprocSticky = sel;
 	int mulcount = ((sel >> 5) & 0x1F) + 1;
 	int mulsign = (sel >> 10) & 1;
 	uint64_t ud, temp, p;
@@ -90,7 +87,7 @@ static void coprocGo(
 				if (mulsign) p += temp;
 			}
 		}
-		cop_prod = p;
+		CX->m.cop_prod = p;
 		break;
 #endif
 #if (COP_OPTIONS & 2)
@@ -98,14 +95,14 @@ static void coprocGo(
 		ud = ((uint64_t)tos << CELLBITS) | nos;
 		temp = ud / w;
 		if (temp >> CELLBITS) {			// quotient doesn't fit in cell
-			cop_quot = CELLMASK;
-			cop_rem = CELLMASK;
-			cop_over = 0x100;
+			CX->m.cop_quot = CELLMASK;
+			CX->m.cop_rem = CELLMASK;
+			CX->m.cop_over = 0x100;
 		}
 		else {
-			cop_quot = temp & CELLMASK;
-			cop_rem = ud % w;
-			cop_over = 0;
+			CX->m.cop_quot = temp & CELLMASK;
+			CX->m.cop_rem = ud % w;
+			CX->m.cop_over = 0;
 		}
 		break;
 #endif
@@ -115,32 +112,34 @@ static void coprocGo(
 		if (sel & 0x80) {	// 32-bit rotate right
 			us = (uint32_t)ud;
 			temp = ((ud << 32) | us) >> (w & 0x1F);
-			cop_shift = (uint32_t)temp;
+			CX->m.cop_shift = (uint32_t)temp;
 		}
 		else if (sel & 0x20)
-			cop_shift = ud << w;
+			CX->m.cop_shift = ud << w;
 		else if (sel & 0x40)
-			cop_shift = (signed)ud >> w;
+			CX->m.cop_shift = (signed)ud >> w;
 		else
-			cop_shift = ud >> w;
+			CX->m.cop_shift = ud >> w;
 		break;
 #endif
 #if (COP_OPTIONS & 8)
 	case 12: // actions: cload, mload, gray, mono
 		switch ((sel >> 5) & 3) {
 		case 0: // cload
-			cop_fgcolor = tos;
-			cop_bgcolor = nos;
+			CX->m.cop_fgcolor = tos;
+			CX->m.cop_bgcolor = nos;
 			break;
 		case 1: // mload
-			cop_monobits = tos;
+			CX->m.cop_monobits = tos;
 			break;
 		case 2: // mono
-			cop_color = (cop_monobits & 1) ? cop_fgcolor : cop_bgcolor;
-			cop_monobits >>= 1;
+			CX->m.cop_color = (CX->m.cop_monobits & 1)
+				? CX->m.cop_fgcolor : CX->m.cop_bgcolor;
+			CX->m.cop_monobits >>= 1;
 			break;
 		case 3: // gray
-			cop_color = colorInterpolate(tos, cop_fgcolor, cop_bgcolor);
+			CX->m.cop_color = colorInterpolate(tos,
+				CX->m.cop_fgcolor, CX->m.cop_bgcolor);
 			break;
 		}
 		break;
@@ -0,0 +1,394 @@
+/*
+This file is meant to be included in chad.c using #include, once for each
+simulator engine. The engines share this source so they can't drift apart.
+Define these before including it:
+
+SIM_NAME         Name of the simulator function to generate.
+SIM_THREADED     1 = dispatch through a table of label addresses (GCC
+                 computed goto), 0 = dispatch with a switch statement.
+SIM_INSTRUMENTED 1 = trace, logging, register triggers, stack depth and
+                 latency tracking, shared memory reads in soc-run, the
+                 profilers. 0 = none of that, for speed.
+SIM_RING         1 = store each instruction in the post-mortem trace ring.
+                 Optional, defaults to SIM_INSTRUMENTED.
+
+Engines with neither SIM_INSTRUMENTED nor SIM_RING dispatch the fused op of
+each decode record, running a superinstruction from Fusions[] with one
+handler when FusionFits allows it.
+
+The function takes the same `single` parameter as CPUsim plus the return
+stack depth that ends the run. The lean, ring and instrumented versions
+hand off to each other by returning SIM_RESELECT when a user opcode changes
+which one is needed. CPUsim then calls the other one to finish the run.
+An event handler can end a run early, which returns SIM_PAUSED. Calling
+it again with the same mark resumes the run. Unless breakOff is set, the
+instrumented version returns SIM_BREAK before executing a breakpoint.
+
+Each instruction class has its own handler. The threaded engine jumps
+straight to the handler of the predecoded op, skipping the switch's range
+check and jump table bounds.
+*/
+
+#ifdef SIM_NAME
+
+#ifndef SIM_RING
+#define SIM_RING SIM_INSTRUMENTED
+#endif
+#define SIM_VERSION ((SIM_INSTRUMENTED) ? 2 : SIM_RING)    // see LoopVersion
+#define SIM_FUSED   (!SIM_RING)         // lean engines run superinstructions
+
+#if SIM_THREADED
+#define SIM_OP(op)  L_##op:
+#define SIM_NEXT    goto retire
+#else
+#define SIM_OP(op)  case op:
+#define SIM_NEXT    break
+#endif
+
+SI SIM_NAME(int single, uint8_t mark) {
+    struct chadContext* const cx = CX;
+    cell _t = cx->m.t;                  // types are unsigned
+    cell _pc, _lex, s, temp;
+    uint8_t interruptVector;
+    uint32_t exception;
+    struct Decoded* d;
+    struct Decoded once;                // instruction that's not in Code[]
+#if !SIM_THREADED
+    uint8_t op;
+#endif
+#if SIM_THREADED
+    static const void* const dispatch[] = {
+        &&retire, &&L_OP_ALU, &&L_OP_NOP, &&L_OP_LIT, &&L_OP_LITNEG,
+        &&L_OP_TRAP, &&L_OP_TRAPNEG, &&L_OP_ZJUMP, &&L_OP_LITX, &&L_OP_COP,
+        &&L_OP_USER, &&L_OP_JUMP, &&L_OP_CALL,
+#if SIM_FUSED
+        &&L_FUSE_LITCALL, &&L_FUSE_LITXLIT, &&L_FUSE_NEXT, &&L_FUSE_MEMREAD
+#endif
+    };
+#endif
+#if SIM_RING
+    struct TraceRec* restrict ring = cx->TraceRing; // doesn't alias the machine
+    uint32_t ringNext = cx->traceNext;
+#endif
+#if SIM_INSTRUMENTED
+    uint16_t insn;
+    uint16_t retMark = (uint16_t)cx->m.cycles;
+    cx->stackTracked = 1;
+#endif
+    if (single & 0x10000) {             // execute one instruction directly
+        d = &once;
+        Predecode(d, single & 0xFFFF);
+        goto execute;
+    }
+fetch:
+#if SIM_INSTRUMENTED
+    if (cx->Breakpoints[cx->m.pc & (CodeSize - 1)] && !cx->breakOff
+        && (single == 0)) {
+#if SIM_RING
+        cx->traceNext = ringNext;
+#endif
+        return SIM_BREAK;               // before it executes
+    }
+    if (cx->profiling) ProfileStep();
+    if (cx->covering)
+        cx->Covered[(cx->m.pc >> 3) & (CodeSize / 8 - 1)]
+            |= 1 << (cx->m.pc & 7);
+#endif
+    d = &cx->Decode[cx->m.pc & (CodeSize - 1)];
+    if (d->op == OP_UNDECODED) {
+        Predecode(d, cx->m.Code[cx->m.pc & (CodeSize - 1)]);
+        d->xop = FusedOp(cx->m.pc & (CodeSize - 1));
+    }
+execute:
+#if SIM_INSTRUMENTED
+    insn = d->insn;
+    if (cx->mixing) CountMix(d);
+    if (cx->verbose & VERBOSE_TRACE) {
+        TraceLine(cx->m.pc, insn);
+    }
+    if (cx->logging) {
+        TraceStep(insn);
+        if (--cx->logging == 0)
+            TraceClose();
+    }
+    if (cx->trigregs) {
+        ShowRegs(stdout, insn);
+        cx->trigregs = 0;
+    }
+#endif
+    _pc = cx->m.pc + 1;
+    interruptVector = 0;
+    exception = 0;
+    _lex = 0;
+    s = cx->m.Dstack[SP];
+#if SIM_RING
+    ring[ringNext++ & (TraceRingSize - 1)] = (struct TraceRec) {
+        (uint16_t)cx->m.pc, d->insn, cx->m.sp, cx->m.rp, cx->m.t, s,
+        cx->m.Rstack[RP] };
+#endif
+#if SIM_FUSED
+#define SIM_OPCODE  d->xop
+#else
+#define SIM_OPCODE  d->op
+#endif
+#if SIM_THREADED
+    goto *dispatch[SIM_OPCODE];
+#else
+    op = SIM_OPCODE;
+#if SIM_FUSED
+unfused:
+#endif
+    switch (op) {
+#endif
+    SIM_OP(OP_ALU)
+        if (d->isret) {                                         /*  r->pc */
+            interruptVector = Iack();
+            exception = cx->m.Rstack[RP] & (~0x1FFF);
+            if (exception)
+                _pc = ExceptionVector;
+            else if (interruptVector)
+                _pc = interruptVector;
+            else {
+                _pc = cx->m.Rstack[RP];
+                if (RDEPTH == mark) single = 2;
+            }
+#if SIM_INSTRUMENTED
+            uint16_t time = (uint16_t)cx->m.cycles - retMark;
+            retMark = (uint16_t)cx->m.cycles;
+            if (time > cx->latency)
+                cx->latency = time;
+#endif
+        }
+        cell _c = cx->m.t & 1;
+        sum_t sum;
+        switch (d->alu) {
+        case OPCODE(T):     _t = cx->m.t;                break; /*      T */
+        case OPCODE(cop):   _t = coprocRead();           break; /*    COP */
+        case OPCODE(less0): _t = (cx->m.t & MSB) ? -1 : 0; break; /*    T<0 */
+        case OPCODE(carry): _t = cx->m.cy;               break; /*      C */
+        case OPCODE(shr1): temp = (cx->m.t & MSB);
+            _t = (cx->m.t >> 1) | temp;                  break; /*    T2/ */
+        case OPCODE(shrx):
+            _t = (cx->m.t >> 1) | (cx->m.cy << (CELLBITS - 1));
+            break;                                              /*   cT2/ */
+        case OPCODE(shl1): _c = cx->m.t >> (CELLBITS - 1);
+            _t = cx->m.t << 1;                           break; /*    T2* */
+        case OPCODE(shlx): _c = cx->m.t >> (CELLBITS - 1);
+            _t = (cx->m.t << 1) | cx->m.cy;              break; /*   T2*c */
+        case OPCODE(swapb):
+            _t = ((cx->m.t >> 8) & 0xFF00FF) | ((cx->m.t & 0xFF00FF) << 8);
+            break;                                              /*     >< */
+        case OPCODE(swapw):
+            _t = ((cx->m.t >> 16) & 0xFFFF) | ((cx->m.t & 0xFFFF) << 16);
+            break;                                              /*   ><16 */
+        case OPCODE(NtoT): _t = s;                       break; /*      N */
+        case OPCODE(AtoT): _t = cx->m.areg;              break; /*      A */
+        case OPCODE(RtoT): _t = cx->m.Rstack[RP];        break; /*      R */
+        case OPCODE(RM1toT): _t = cx->m.Rstack[RP] - 1;  break; /*    R-1 */
+        case OPCODE(add): sum = (sum_t)s + (sum_t)cx->m.t;
+            _c = (sum >> CELLBITS) & 1;  _t = (cell)sum; break; /*    T+N */
+        case OPCODE(eor):  _t = s ^ cx->m.t;             break; /*    T^N */
+        case OPCODE(com):  _t = ~cx->m.t;                break; /*     ~T */
+        case OPCODE(Tand): _t = s & cx->m.t;             break; /*    T&N */
+        case OPCODE(input): _t = ReadIO(CELL_ADDR(cx->m.t)); break; /*    IO */
+        case OPCODE(read): _t = cx->m.Data[cx->m.Raddr];
+#if SIM_INSTRUMENTED
+            if (cx->verbose & VERBOSE_TRACE) {
+                printf("Reading %Xh from cell %Xh\n", _t, cx->m.Raddr);
+            }
+#endif
+            break;                                              /*      M */
+        case OPCODE(zeq): _t = (cx->m.t) ? 0 : -1;       break; /*    T0= */
+        case OPCODE(who): _t = (RDEPTH << 8) + SDEPTH;   break; /* status */
+        default:   _t = cx->m.t;  single = BAD_ALU_OP;
+        }
+
+        SP = SPMASK & (SP + d->ds);                           /* dstack+- */
+        if ((interruptVector == 0) && (exception == 0))
+            RP = RPMASK & (RP + d->rs);                       /* rstack+- */
+
+        switch (d->strobe)
+        {
+        case 0: break;
+        case STROBE(TtoN): cx->m.Dstack[SP] = cx->m.t;     break; /* T->N */
+        case STROBE(TtoR): cx->m.Rstack[RP] = cx->m.t;     break; /* T->R */
+        case STROBE(iow):                                   /* N->io[T] */
+            temp = writeIOmap(CELL_ADDR(cx->m.t), s);
+            if (temp) { single = temp; }   break;
+        case STROBE(memrd): cx->m.Raddr = CELL_ADDR(cx->m.t);  /* _MEMRD_ */
+            if (cx->m.Raddr & ~(DataSize - 1)) { single = BAD_DATA_READ; }
+#if SIM_INSTRUMENTED
+            else {
+                if (cx->dataWatch) WatchData(cx->m.Raddr, CHAD_WATCH_READ);
+                if (cx->socCore) SocAccess(cx->m.Raddr, 0, 0);
+            }
+#endif
+            break;
+        case STROBE(memwrs): Dwrite(s, cx->m.t, 1, 2);  break; /* N->[T]S */
+        case STROBE(memwrb): Dwrite(s, cx->m.t, 0, 3);  break; /* N->[T]B */
+        case STROBE(memwr):  Dwrite(s, cx->m.t, 0, 0);   break; /* N->[T] */
+        case STROBE(co): cx->m.cy = _c;                    break; /*   co */
+        case STROBE(TtoA): cx->m.areg = cx->m.t;           break; /* T->A */
+        case STROBE(ior): break;
+        default:
+            printf("Unknown strobe %X at %X\n", d->strobe, cx->m.pc);
+            single = BAD_ALU_OP;
+            break;
+        }
+        cx->m.t = _t & CELLMASK;
+        SIM_NEXT;
+    SIM_OP(OP_NOP)
+        SIM_NEXT;
+    SIM_OP(OP_LIT)
+        Dpush((cx->m.lex << 12) | d->imm);
+        SIM_NEXT;
+    SIM_OP(OP_LITNEG)
+        Dpush(d->imm);
+        SIM_NEXT;
+    SIM_OP(OP_TRAP)
+        Dpush((cx->m.lex << 12) | d->imm);
+        goto trapping;
+    SIM_OP(OP_TRAPNEG)
+        Dpush(d->imm);
+trapping:
+        Rpush(_pc);
+        _pc = TrapVector + (d->op - OP_TRAP);
+#if SIM_INSTRUMENTED
+        if (cx->verbose & VERBOSE_TRACE) {
+            printf("Trap to %Xh\n", _pc);
+        }
+#endif
+        SIM_NEXT;
+    SIM_OP(OP_ZJUMP)
+        if (!Dpop()) {
+            _pc = d->imm;
+        }
+        SIM_NEXT;
+    SIM_OP(OP_USER)
+        switch (d->imm) {
+        case trcreg: cx->trigregs = 1; break;
+        case trcon: cx->verbose |= 12; break;
+        case trcoff: cx->verbose &= ~12; break;
+        case trcclrd: ClearTraceData();  break;
+        case trcdata: ShowTraceData();  break;
+        case trcstax: ShowTraceStacks();  break;
+        }
+        if ((single == 0) && (LoopVersion() != SIM_VERSION))
+            single = SIM_RESELECT;      // switch to the other loop
+        SIM_NEXT;
+    SIM_OP(OP_COP)                                              /* coproc */
+        coprocGo(d->imm, cx->m.t& CELLMASK, s& CELLMASK, cx->m.areg& CELLMASK);
+        SIM_NEXT;
+    SIM_OP(OP_LITX)
+        _lex = (cx->m.lex << 12) | d->imm;                      /*   litx */
+        SIM_NEXT;
+    SIM_OP(OP_JUMP)
+        _pc = d->imm;
+        SIM_NEXT;
+    SIM_OP(OP_CALL)
+        Rpush(_pc);
+        _pc = d->imm;
+#if SIM_INSTRUMENTED
+        if (cx->verbose & VERBOSE_TRACE) {
+            printf("Call to %Xh\n", _pc);
+        }
+#endif
+        SIM_NEXT;
+#if SIM_FUSED
+// Superinstructions leave the same machine state, including stack memory,
+// as running the sequence one instruction at a time. One that doesn't fit
+// goes back to the handler of its first instruction.
+#define FITS(i)      ((single == 0) && FusionFits(i))
+#define FUSED(n, i)  cx->m.cycles += (n) - 1;  cx->fusionHits[i]++
+#if SIM_THREADED
+#define UNFUSE(i)    if (!FITS(i)) goto *dispatch[d->op]
+#else
+#define UNFUSE(i)    if (!FITS(i)) { op = d->op;  goto unfused; }
+#endif
+    SIM_OP(FUSE_LITCALL)                                        /* lit call */
+        UNFUSE(0);
+        Dpush((d->op == OP_LIT) ? ((cx->m.lex << 12) | d->imm) : d->imm);
+        Rpush(cx->m.pc + 2);
+        _pc = d[1].imm;
+        FUSED(2, 0);
+        SIM_NEXT;
+    SIM_OP(FUSE_LITXLIT)                                        /* litx lit */
+        UNFUSE(1);
+        _lex = (cx->m.lex << 12) | d->imm;
+        Dpush((d[1].op == OP_LIT) ? ((_lex << 12) | d[1].imm) : d[1].imm);
+        _lex = 0;
+        _pc = cx->m.pc + 2;
+        FUSED(2, 1);
+        SIM_NEXT;
+    SIM_OP(FUSE_NEXT)                               /* (R-1)@ T0=>R zjump */
+        UNFUSE(2);
+        temp = (cx->m.Rstack[RP] - 1) & CELLMASK;
+        cx->m.Dstack[SPMASK & (SP + 1)] = cx->m.t;  // popped by zjump
+        cx->m.Rstack[RP] = temp;
+        _pc = (temp) ? d[2].imm : cx->m.pc + 3;
+        FUSED(3, 2);
+        SIM_NEXT;
+    SIM_OP(FUSE_MEMREAD)                                        /* _@ _@_ */
+        UNFUSE(3);
+        cx->m.Raddr = CELL_ADDR(cx->m.t);
+        if (cx->m.Raddr & ~(DataSize - 1)) {
+            single = BAD_DATA_READ;     // faults on the first instruction
+            cx->m.t &= CELLMASK;        // as the unfused memrd leaves it
+            SIM_NEXT;
+        }
+        cx->m.t = cx->m.Data[cx->m.Raddr] & CELLMASK;
+        _pc = cx->m.pc + 2;
+        FUSED(2, 3);
+        SIM_NEXT;
+#undef FITS
+#undef FUSED
+#undef UNFUSE
+#endif
+#if !SIM_THREADED
+    }
+#else
+retire:
+#endif
+    cx->m.pc = _pc;  cx->m.lex = _lex;
+    cx->m.cycles++;
+    if (cx->m.cycles >= cx->m.nextEvent)
+        if (RunEvents() && (single == 0)) single = SIM_PAUSED;
+    if (cx->m.pc & ~(CodeSize-1)) single = BAD_PC;
+    if (cx->m.rp == RPMASK) single = BAD_RSTACKUNDER;
+    if (cx->m.sp == SPMASK) single = BAD_STACKUNDER;
+    if (cx->m.rp == RPMASK - 1) single = BAD_RSTACKOVER;
+    if (cx->m.sp == SPMASK - 1) single = BAD_STACKOVER;
+#if SIM_INSTRUMENTED
+    if (cx->m.sp > cx->spMax) {
+        cx->spMax = cx->m.sp;
+        NewMaxStack(cx->m.sp, cx->rpMax, cx->m.pc);
+    }
+    if (cx->m.rp > cx->rpMax) {
+        cx->rpMax = cx->m.rp;
+        NewMaxStack(cx->spMax, cx->m.rp, cx->m.pc);
+    }
+    if (cx->verbose & VERBOSE_TRACE) {
+        if (exception)
+            printf("Exception at %Xh, R=%Xh, page=%Xh\n",
+                cx->m.pc, cx->m.Rstack[RP], cx->m.Rstack[(RP - 1) & RPMASK]);
+        if (interruptVector)
+            printf("Interrupt Level %d\n", cx->m.pc);
+    }
+#endif
+    if (single == 0) goto fetch;
+#if SIM_RING
+    cx->traceNext = ringNext;
+#endif
+    return single;
+}
+
+#undef SIM_OP
+#undef SIM_OPCODE
+#undef SIM_NEXT
+#undef SIM_NAME
+#undef SIM_THREADED
+#undef SIM_INSTRUMENTED
+#undef SIM_RING
+#undef SIM_VERSION
+#undef SIM_FUSED
+#endif
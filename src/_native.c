@@ -0,0 +1,512 @@
+/*
+This file is meant to be included in chad.c using #include. It is engine 2,
+which translates Chad code into x86-64 machine code as it runs. Only the
+lean version is native. The ring and instrumented versions are the threaded
+engine's, so tracing, profiling, breakpoints and the rest work as before.
+
+A translation is a trace: straight-line code from one address, following
+calls, jumps and traps. A zjump leaves the trace if it's taken. A return
+continues the trace at the address its call pushed if the return stack
+still holds that address, else the trace ends there. T, the stack pointers
+and the run's return depth are in host registers. N, A, the carry and the
+stacks are in the Machine struct.
+
+Anything the trace doesn't handle, and any check that fails, ends the trace
+before that instruction. The dispatcher then runs it with one step of the
+threaded engine, which makes the same state changes and reports the same
+errors. That covers I/O, `cop` and `user` instructions, byte and halfword
+stores, returns that take an interrupt or an exception, the return that
+ends the run, and bad data addresses.
+
+Before running a trace, the dispatcher checks that no event comes due before
+its last instruction and that the stacks stay clear of the overflow and
+underflow marks, as FusionFits does for superinstructions. Otherwise it
+steps. Events and the PC check happen between traces, so cycle counts and
+interrupts stay the same as in the other engines.
+
+Writing to code memory bumps codeEpoch, which throws away every translation
+the next time the dispatcher looks.
+*/
+
+#ifdef HAS_NATIVE_SIM
+
+#define NativeSize  (4 << 20)           // bytes of executable memory
+#define NativeTrace 64                  // most instructions in a trace
+#define NativeInsn  128                 // most bytes one instruction needs
+#define NativeStub  64                  // bytes of an exit stub
+#define NativeRoom  (NativeTrace * (NativeInsn + 2 * NativeStub))
+#define NativeShift 1                   // CELL_ADDR is x >> 1, see chaddefs.h
+
+typedef int (*NativeCode)(struct Machine* m, uint32_t mark);
+
+struct NativeBlock {
+    uint8_t* code;                      // NULL if not translated yet
+    uint8_t len;                        // instructions it runs, 0 = step
+    int8_t spLo, spHi, rpLo, rpHi;      // stack pointers it can start at
+};
+
+#define NativeJumps 5                   // most checks in one instruction
+
+struct NativeExit {                     // an exit stub to emit
+    uint8_t* patch[NativeJumps];        // rel32 of each jump to it
+    int jumps;
+    cell pc, lex;                       // where the machine goes on
+    uint8_t ran;                        // instructions done
+    uint8_t step;                       // the next one is stepped
+};
+
+struct Native {
+    uint8_t* mem;                       // executable memory
+    uint32_t used;                      // bytes of it in use
+    uint32_t epoch;                     // codeEpoch of the translations
+    uint8_t* at;                        // where code is being emitted
+    struct NativeExit exits[NativeTrace * 2];   // one or two each
+    int nexits;
+    struct NativeBlock block[CodeSize];
+};
+
+// Host registers. The generated code is called as NativeCode with m in rdi
+// and mark in esi. It saves rbx, the only callee-saved register it uses.
+
+enum NativeRegs {
+    nT = 0, nSP = 1, nRP = 2, nTmp = 3, nMark = 6, nM = 7, // eax ... edi
+    nN = 8, nX = 9, nAddr = 10, nRet = 11                   // r8d ... r11d
+};
+
+#define NOFF(field) ((int32_t)offsetof(struct Machine, field))
+#define NONE (-1)                       // no index register
+
+//------------------------------------------------------------------------------
+// x86-64 encoding
+
+SV NB(struct Native* n, uint8_t b) {
+    *n->at++ = b;
+}
+
+SV N32(struct Native* n, uint32_t x) {
+    memcpy(n->at, &x, 4);  n->at += 4;
+}
+
+SV Nrex(struct Native* n, int w, int reg, int index, int rm) {
+    int rex = (w << 3) | ((reg >> 3) << 2) | ((index >> 3) << 1) | (rm >> 3);
+    if (rex) NB(n, 0x40 | rex);
+}
+
+SV Nop(struct Native* n, int op) {      // one or two opcode bytes
+    if (op > 0xFF) NB(n, op >> 8);
+    NB(n, op & 0xFF);
+}
+
+// op reg, [rdi + index*4 + disp]. Reg is an opcode extension for some ops.
+SV Nmem(struct Native* n, int w, int op, int reg, int index, int32_t disp) {
+    Nrex(n, w, reg, (index == NONE) ? 0 : index, nM);
+    Nop(n, op);
+    if (index == NONE) {
+        NB(n, 0x80 | ((reg & 7) << 3) | nM);
+    } else {
+        NB(n, 0x84 | ((reg & 7) << 3));
+        NB(n, 0x80 | ((index & 7) << 3) | nM);
+    }
+    N32(n, (uint32_t)disp);
+}
+
+SV Nreg(struct Native* n, int op, int reg, int rm) {   // op rm, reg
+    Nrex(n, 0, reg, 0, rm);
+    Nop(n, op);
+    NB(n, 0xC0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+SV Nimm(struct Native* n, int ext, int rm, uint32_t x) {   // op rm, imm32
+    Nreg(n, 0x81, ext, rm);  N32(n, x);
+}
+
+SV Nshift(struct Native* n, int ext, int rm, int count) {
+    Nreg(n, 0xC1, ext, rm);  NB(n, (uint8_t)count);
+}
+
+SV Nmovi(struct Native* n, int r, uint32_t x) {         // mov r, imm32
+    Nrex(n, 0, 0, 0, r);
+    NB(n, 0xB8 + (r & 7));  N32(n, x);
+}
+
+SV Nstorei(struct Native* n, int index, int32_t disp, uint32_t x) {
+    Nmem(n, 0, 0xC7, 0, index, disp);  N32(n, x);
+}
+
+enum NativeOps {                        // opcodes and /digit extensions
+    xADD = 0x01, xOR = 0x09, xAND = 0x21, xSUB = 0x29, xXOR = 0x31,
+    xCMP = 0x39, xSBB = 0x19, xTEST = 0x85, xSTORE = 0x89, xLOAD = 0x8B,
+    xORL = 0x0B, xSTORE8 = 0x88, xLOAD8 = 0x0FB6,
+    eADD = 0, eOR = 1, eAND = 4, eSUB = 5, eCMP = 7, eNOT = 2,
+    eROL = 0, eSHL = 4, eSHR = 5, eSAR = 7,
+    cB = 2, cAE = 3, cE = 4, cNE = 5
+};
+
+static uint8_t* Njcc(struct Native* n, int cc) {        // returns the rel32
+    NB(n, 0x0F);  NB(n, 0x80 | cc);
+    uint8_t* rel = n->at;
+    N32(n, 0);
+    return rel;
+}
+
+SV Npatch(uint8_t* rel, uint8_t* to) {
+    uint32_t x = (uint32_t)(to - (rel + 4));
+    memcpy(rel, &x, 4);
+}
+
+//------------------------------------------------------------------------------
+// Exits
+
+SV NativeStore(struct Native* n, cell lex, int ran, int step) {
+    Nmem(n, 0, xSTORE, nT, NONE, NOFF(t));
+    Nmem(n, 0, xSTORE8, nSP, NONE, NOFF(sp));
+    Nmem(n, 0, xSTORE8, nRP, NONE, NOFF(rp));
+    Nstorei(n, NONE, NOFF(lex), lex);
+    if (ran) {
+        Nmem(n, 1, 0x81, eADD, NONE, NOFF(cycles));  N32(n, ran);
+    }
+    Nmovi(n, nT, step);
+    NB(n, 0x5B);                        // pop rbx
+    NB(n, 0xC3);                        // ret
+}
+
+SV NativeExitTo(struct Native* n, cell pc, cell lex, int ran, int step) {
+    Nstorei(n, NONE, NOFF(pc), pc);
+    NativeStore(n, lex, ran, step);
+}
+
+// Jump to an exit stub if condition cc holds. The stub is emitted after
+// the trace. The checks of one instruction share a stub.
+
+SV NativeExitIf(struct Native* n, int cc, cell pc, cell lex, int ran,
+                int step) {
+    struct NativeExit* x = (n->nexits) ? &n->exits[n->nexits - 1] : NULL;
+    if ((x == NULL) || (x->pc != pc) || (x->ran != ran)
+        || (x->step != step)) {
+        x = &n->exits[n->nexits++];
+        x->jumps = 0;
+        x->pc = pc;  x->lex = lex;
+        x->ran = (uint8_t)ran;  x->step = (uint8_t)step;
+    }
+    x->patch[x->jumps++] = Njcc(n, cc);
+}
+
+//------------------------------------------------------------------------------
+// Translation
+
+SV NativeFlush(struct Native* n) {
+    memset(n->block, 0, sizeof(n->block));
+    n->used = 0;
+    n->epoch = CX->codeEpoch;
+}
+
+SI NativeALU(struct Decoded* d) {       // the trace can run it
+    switch (d->alu) {
+    case OPCODE(cop): case OPCODE(input): return 0;
+    case OPCODE(T): case OPCODE(less0): case OPCODE(carry):
+    case OPCODE(shr1): case OPCODE(shrx): case OPCODE(shl1):
+    case OPCODE(shlx): case OPCODE(swapb): case OPCODE(swapw):
+    case OPCODE(NtoT): case OPCODE(AtoT): case OPCODE(RtoT):
+    case OPCODE(RM1toT): case OPCODE(add): case OPCODE(eor):
+    case OPCODE(com): case OPCODE(Tand): case OPCODE(read):
+    case OPCODE(zeq): case OPCODE(who): break;
+    default: return 0;
+    }
+    switch (d->strobe) {
+    case 0: case STROBE(TtoN): case STROBE(TtoR): case STROBE(memrd):
+    case STROBE(memwr): case STROBE(co): case STROBE(TtoA):
+    case STROBE(ior): return 1;
+    }
+    return 0;
+}
+
+// Emit an ALU instruction. Its checks come first, so a failed one leaves
+// the machine as it was before the instruction. Back is where it returns to,
+// NONE if that isn't known.
+
+SV NativeEmitALU(struct Native* n, struct Decoded* d, cell pc, cell lex,
+                 int ran, int back) {
+    int alu = d->alu, strobe = d->strobe;
+    if (alu == OPCODE(read)) {
+        Nmem(n, 0, 0x81, eCMP, NONE, NOFF(Raddr));  N32(n, DataSize);
+        NativeExitIf(n, cAE, pc, lex, ran, 1);
+    }
+    if ((strobe == STROBE(memrd)) || (strobe == STROBE(memwr))) {
+        Nreg(n, xSTORE, nT, nAddr);
+        Nshift(n, eSHR, nAddr, NativeShift);
+        Nimm(n, eCMP, nAddr, DataSize);
+        NativeExitIf(n, cAE, pc, lex, ran, 1);
+    }
+    if (d->isret) {                     // no interrupt, exception or end
+        Nmem(n, 0, 0x81, eCMP, NONE, NOFF(irq));  N32(n, 0);
+        NativeExitIf(n, cNE, pc, lex, ran, 1);
+        Nreg(n, xCMP, nMark, nRP);
+        NativeExitIf(n, cE, pc, lex, ran, 1);
+        if (back == NONE) {
+            Nmem(n, 0, xLOAD, nRet, nRP, NOFF(Rstack));
+            Nreg(n, 0xF7, 0, nRet);  N32(n, ~0x1FFF);   // test
+        } else {
+            Nmem(n, 0, 0x81, eCMP, nRP, NOFF(Rstack));  N32(n, back);
+        }
+        NativeExitIf(n, cNE, pc, lex, ran, 1);
+    }
+    switch (alu) {                      // compute the new T in nX
+    case OPCODE(NtoT): case OPCODE(add): case OPCODE(eor): case OPCODE(Tand):
+        Nmem(n, 0, xLOAD, nN, nSP, NOFF(Dstack));  break;
+    default:
+        if (strobe == STROBE(memwr))
+            Nmem(n, 0, xLOAD, nN, nSP, NOFF(Dstack));
+    }
+    switch (alu) {
+    case OPCODE(T):     Nreg(n, xSTORE, nT, nX);  break;
+    case OPCODE(less0): Nreg(n, xSTORE, nT, nX);
+        Nshift(n, eSHL, nX, 32 - CELLBITS);
+        Nshift(n, eSAR, nX, 31);  break;
+    case OPCODE(carry): Nmem(n, 0, xLOAD, nX, NONE, NOFF(cy));  break;
+    case OPCODE(shr1):  Nreg(n, xSTORE, nT, nX);  Nshift(n, eSHR, nX, 1);
+        Nreg(n, xSTORE, nT, nTmp);  Nimm(n, eAND, nTmp, MSB);
+        Nreg(n, xOR, nTmp, nX);  break;
+    case OPCODE(shrx):  Nreg(n, xSTORE, nT, nX);  Nshift(n, eSHR, nX, 1);
+        Nmem(n, 0, xLOAD, nTmp, NONE, NOFF(cy));
+        Nshift(n, eSHL, nTmp, CELLBITS - 1);
+        Nreg(n, xOR, nTmp, nX);  break;
+    case OPCODE(shl1):  Nreg(n, xSTORE, nT, nX);  Nshift(n, eSHL, nX, 1);
+        break;
+    case OPCODE(shlx):  Nreg(n, xSTORE, nT, nX);  Nshift(n, eSHL, nX, 1);
+        Nmem(n, 0, xORL, nX, NONE, NOFF(cy));  break;
+    case OPCODE(swapb): Nreg(n, xSTORE, nT, nX);  Nshift(n, eSHR, nX, 8);
+        Nimm(n, eAND, nX, 0xFF00FF);
+        Nreg(n, xSTORE, nT, nTmp);  Nimm(n, eAND, nTmp, 0xFF00FF);
+        Nshift(n, eSHL, nTmp, 8);  Nreg(n, xOR, nTmp, nX);  break;
+    case OPCODE(swapw): Nreg(n, xSTORE, nT, nX);  Nshift(n, eROL, nX, 16);
+        break;
+    case OPCODE(NtoT):  Nreg(n, xSTORE, nN, nX);  break;
+    case OPCODE(AtoT):  Nmem(n, 0, xLOAD, nX, NONE, NOFF(areg));  break;
+    case OPCODE(RtoT):  Nmem(n, 0, xLOAD, nX, nRP, NOFF(Rstack));  break;
+    case OPCODE(RM1toT): Nmem(n, 0, xLOAD, nX, nRP, NOFF(Rstack));
+        Nimm(n, eSUB, nX, 1);  break;
+    case OPCODE(add):   Nreg(n, xSTORE, nN, nX);  Nreg(n, xADD, nT, nX);
+        break;
+    case OPCODE(eor):   Nreg(n, xSTORE, nN, nX);  Nreg(n, xXOR, nT, nX);
+        break;
+    case OPCODE(com):   Nreg(n, xSTORE, nT, nX);  Nreg(n, 0xF7, eNOT, nX);
+        break;
+    case OPCODE(Tand):  Nreg(n, xSTORE, nN, nX);  Nreg(n, xAND, nT, nX);
+        break;
+    case OPCODE(read):  Nmem(n, 0, xLOAD, nTmp, NONE, NOFF(Raddr));
+        Nmem(n, 0, xLOAD, nX, nTmp, NOFF(Data));  break;
+    case OPCODE(zeq):   Nimm(n, eCMP, nT, 1);  Nreg(n, xSBB, nX, nX);  break;
+    case OPCODE(who):   Nreg(n, xSTORE, nRP, nX);  Nshift(n, eSHL, nX, 8);
+        Nreg(n, xADD, nSP, nX);  break;
+    }
+    if (strobe == STROBE(co)) {         // the carry out in nTmp
+        switch (alu) {
+        case OPCODE(shl1): case OPCODE(shlx):
+            Nreg(n, xSTORE, nT, nTmp);  Nshift(n, eSHR, nTmp, CELLBITS - 1);
+            break;
+        case OPCODE(add):
+            Nreg(n, xSTORE, nX, nTmp);  Nshift(n, eSHR, nTmp, CELLBITS);
+            Nimm(n, eAND, nTmp, 1);  break;
+        default:
+            Nreg(n, xSTORE, nT, nTmp);  Nimm(n, eAND, nTmp, 1);
+        }
+    }
+    if (d->ds) Nimm(n, eADD, nSP, (uint32_t)(int32_t)d->ds);
+    if (d->rs) Nimm(n, eADD, nRP, (uint32_t)(int32_t)d->rs);
+    switch (strobe) {                   // these see the old T
+    case STROBE(TtoN):  Nmem(n, 0, xSTORE, nT, nSP, NOFF(Dstack));  break;
+    case STROBE(TtoR):  Nmem(n, 0, xSTORE, nT, nRP, NOFF(Rstack));  break;
+    case STROBE(memrd): Nmem(n, 0, xSTORE, nAddr, NONE, NOFF(Raddr));  break;
+    case STROBE(memwr): Nmem(n, 0, xSTORE, nN, nAddr, NOFF(Data));  break;
+    case STROBE(co):    Nmem(n, 0, xSTORE, nTmp, NONE, NOFF(cy));  break;
+    case STROBE(TtoA):  Nmem(n, 0, xSTORE, nT, NONE, NOFF(areg));  break;
+    }
+    Nreg(n, xSTORE, nX, nT);
+    Nimm(n, eAND, nT, CELLMASK);
+}
+
+SV NativePush(struct Native* n, cell x) {       // Dpush(x)
+    Nimm(n, eADD, nSP, 1);
+    Nmem(n, 0, xSTORE, nT, nSP, NOFF(Dstack));
+    Nmovi(n, nT, x);
+}
+
+SV NativeRpush(struct Native* n, cell x) {      // Rpush(x)
+    Nimm(n, eADD, nRP, 1);
+    Nstorei(n, nRP, NOFF(Rstack), x);
+}
+
+#define UNKNOWN_RET ((cell)-1)          // not a return address we pushed
+
+SV NativeTranslate(struct Native* n, cell start) {
+    if ((NativeSize - n->used) < NativeRoom) NativeFlush(n);
+    struct NativeBlock* b = &n->block[start];
+    uint8_t* code = n->mem + n->used;
+    cell rets[StackSize];               // return addresses the trace pushed
+    int nrets = 0;
+    int ds = 0, dlo = 0, dhi = 0, rs = 0, rlo = 0, rhi = 0;
+    cell pc = start, lex = 0;
+    int ran = 0, done = 0;
+    n->at = code;
+    n->nexits = 0;
+    NB(n, 0x53);                        // push rbx
+    Nmem(n, 0, xLOAD, nT, NONE, NOFF(t));
+    Nmem(n, 0, xLOAD8, nSP, NONE, NOFF(sp));
+    Nmem(n, 0, xLOAD8, nRP, NONE, NOFF(rp));
+    while (!done) {
+        if ((ran == NativeTrace) || (pc & ~(CodeSize - 1))) {
+            NativeExitTo(n, pc, lex, ran, 0);
+            break;
+        }
+        struct Decoded d;
+        Predecode(&d, CX->m.Code[pc]);
+        int dd = 0, dr = 0;             // stack pointer changes
+        cell next = pc + 1, lexNext = 0;
+        switch (d.op) {
+        case OP_ALU: {
+            if (!NativeALU(&d)) {
+                NativeExitTo(n, pc, lex, ran, 1);
+                done = 1;  continue;
+            }
+            int back = NONE;
+            if (d.isret && nrets && (rets[nrets - 1] != UNKNOWN_RET))
+                back = rets[nrets - 1];
+            NativeEmitALU(n, &d, pc, lex, ran, back);
+            dd = d.ds;  dr = d.rs;
+            if (d.isret) {
+                if (nrets) nrets--;
+                if (back == NONE) {     // exit to the address in nRet
+                    Nmem(n, 0, xSTORE, nRet, NONE, NOFF(pc));
+                    NativeStore(n, 0, ran + 1, 0);
+                    done = 1;
+                }
+                next = back;
+            } else if (dr > 0) {
+                if (nrets < StackSize) rets[nrets++] = UNKNOWN_RET;
+            } else if ((dr < 0) && nrets) nrets--;
+            if ((d.strobe == STROBE(TtoR)) && nrets)
+                rets[nrets - 1] = UNKNOWN_RET;
+            break;
+        }
+        case OP_NOP:  break;
+        case OP_LIT:
+            NativePush(n, (lex << 12) | d.imm);  dd = 1;  break;
+        case OP_LITNEG:
+            NativePush(n, d.imm);  dd = 1;  break;
+        case OP_TRAP:
+        case OP_TRAPNEG:
+            NativePush(n, (d.op == OP_TRAP) ? ((lex << 12) | d.imm) : d.imm);
+            NativeRpush(n, pc + 1);
+            if (nrets < StackSize) rets[nrets++] = pc + 1;
+            dd = 1;  dr = 1;
+            next = TrapVector + (d.op - OP_TRAP);
+            break;
+        case OP_ZJUMP:                  // leaves the trace if taken
+            Nreg(n, xSTORE, nT, nTmp);
+            Nmem(n, 0, xLOAD, nT, nSP, NOFF(Dstack));
+            Nimm(n, eSUB, nSP, 1);
+            Nreg(n, xTEST, nTmp, nTmp);
+            NativeExitIf(n, cE, d.imm, 0, ran + 1, 0);
+            dd = -1;  break;
+        case OP_LITX:
+            lexNext = (lex << 12) | d.imm;  break;
+        case OP_JUMP:
+            next = d.imm;  break;
+        case OP_CALL:
+            NativeRpush(n, pc + 1);
+            if (nrets < StackSize) rets[nrets++] = pc + 1;
+            dr = 1;  next = d.imm;  break;
+        default:                        // cop and user
+            NativeExitTo(n, pc, lex, ran, 1);
+            done = 1;  continue;
+        }
+        ran++;
+        ds += dd;  rs += dr;
+        if (ds < dlo) dlo = ds;
+        if (ds > dhi) dhi = ds;
+        if (rs < rlo) rlo = rs;
+        if (rs > rhi) rhi = rs;
+        pc = next;  lex = lexNext;
+        if ((n->at - code) + (n->nexits + 2) * NativeStub + NativeInsn
+            > NativeRoom) {             // keep room for the stubs
+            if (!done) NativeExitTo(n, pc, lex, ran, 0);
+            done = 1;
+        }
+    }
+    for (int i = 0; i < n->nexits; i++) {
+        struct NativeExit* x = &n->exits[i];
+        for (int j = 0; j < x->jumps; j++)
+            Npatch(x->patch[j], n->at);
+        NativeExitTo(n, x->pc, x->lex, x->ran, x->step);
+    }
+    b->code = code;
+    b->len = (uint8_t)ran;
+    b->spLo = (int8_t)-dlo;  b->spHi = (int8_t)(SPMASK - 2 - dhi);
+    b->rpLo = (int8_t)-rlo;  b->rpHi = (int8_t)(RPMASK - 2 - rhi);
+    n->used += (uint32_t)(n->at - code);
+}
+
+//------------------------------------------------------------------------------
+// Dispatcher
+
+static struct Native* NativeReady(void) {
+    struct Native* n = CX->native;
+    if (n == NULL) {
+        n = CX->native = calloc(1, sizeof(struct Native));
+        if (n == NULL) return NULL;
+        void* mem = mmap(NULL, NativeSize, PROT_READ | PROT_WRITE | PROT_EXEC,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        n->mem = (mem == MAP_FAILED) ? NULL : mem;
+        NativeFlush(n);
+    }
+    return (n->mem) ? n : NULL;         // no executable memory
+}
+
+SV NativeFree(struct Native* n) {
+    if (n == NULL) return;
+    if (n->mem) munmap(n->mem, NativeSize);
+    free(n);
+}
+
+SI NativeFits(struct NativeBlock* b) {
+    struct Machine* m = &CX->m;
+    return (m->lex == 0) && ((m->cycles + b->len) <= m->nextEvent)
+        && (m->sp >= b->spLo) && (m->sp <= b->spHi)
+        && (m->rp >= b->rpLo) && (m->rp <= b->rpHi);
+}
+
+// Like the other lean engines, except that single stepping and executing
+// one instruction go to the threaded engine.
+
+SI CPUnative(int single, uint8_t mark) {
+    struct chadContext* const cx = CX;
+    struct Native* n = NativeReady();
+    if (single || (n == NULL)) return CPUthreaded(single, mark);
+    while (1) {
+        if (n->epoch != cx->codeEpoch) NativeFlush(n);
+        cell pc = cx->m.pc;
+        if (!(pc & ~(CodeSize - 1))) {
+            struct NativeBlock* b = &n->block[pc];
+            if (b->code == NULL) NativeTranslate(n, pc);
+            if (b->len && NativeFits(b)) {
+                int r = ((NativeCode)b->code)(&cx->m, mark);
+                int s = 0;
+                if ((cx->m.cycles >= cx->m.nextEvent) && RunEvents())
+                    s = SIM_PAUSED;
+                if (cx->m.pc & ~(CodeSize - 1)) s = BAD_PC;
+                if (s) return s;
+                if (r == 0) continue;
+            }
+        }
+        int r = CPUthreaded(1, mark);   // one instruction the slow way
+        if (r != 1) return r;           // the run ended or failed
+        if (cx->pausing) return SIM_PAUSED;
+        if (LoopVersion() != 0) return SIM_RESELECT;
+    }
+}
+
+#undef NOFF
+#undef NONE
+#undef UNKNOWN_RET
+#undef NativeShift
+#endif
@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <stddef.h>
 
 #ifdef _MSC_VER
 #include <conio.h>
@@ -17,6 +18,7 @@ static uint64_t GetMicroseconds() {
 }
 #else
 #include <sys/time.h> // GCC library
+#include <pthread.h>
 static uint64_t GetMicroseconds() {
     struct timeval tv;
     gettimeofday(&tv, NULL);
@@ -31,9 +33,17 @@ static uint64_t GetMicroseconds() {
 #include "chaddefs.h"
 #include "iomap.h"
 #include "config.h"
+#include "chad.h"
 #include "flash.h"
 #include "gecko.h"
 
+// Engine 2 translates to x86-64. It needs executable memory from mmap.
+#if defined(__GNUC__) && defined(__x86_64__) && defined(__linux__) \
+    && (CELLBITS > 16) && (CELLBITS < 32)
+#include <sys/mman.h>
+#define HAS_NATIVE_SIM
+#endif
+
 static FILE* fopenx(char* filename, char* fmt) {
 #ifdef MORESAFE
     FILE* fp;
@@ -44,15 +54,312 @@ static FILE* fopenx(char* filename, char* fmt) {
 #endif
 }
 
-SI verbose = 0;
-static uint8_t sp, rp;                  // stack pointers
-CELL t, pc, cy, lex, areg;              // registers
-CELL Data[DataSize];                    // data memory
-CELL DataTrc[DataSize];                 // data memory for trace comparison
-CELL Dstack[StackSize];                 // data stack
-CELL Rstack[StackSize];                 // return stack
-CELL Raddr;                             // data memory read address
-SI error;                               // simulator and interpreter error code
+//##############################################################################
+// Context
+// Everything that makes up one Chad instance, the simulated CPU and the
+// compiler that feeds it, lives in a chadContext. The current context is
+// selected per thread, so several instances can run side by side. Code
+// reaches the selected context through CX, as in CX->m.t for the simulated
+// CPU's T register. Code that works on another context points CX at it for
+// a while.
+
+// Predecoded instruction cache: Each Code[] word has a shadow record holding
+// its decoded fields so CPUsim doesn't have to pick the instruction apart on
+// every cycle. A record is filled in the first time its address is fetched.
+// Writing to Code[] clears the record so it gets decoded again.
+
+enum DecodedOps {
+    OP_UNDECODED = 0, OP_ALU, OP_NOP, OP_LIT, OP_LITNEG, OP_TRAP, OP_TRAPNEG,
+    OP_ZJUMP, OP_LITX, OP_COP, OP_USER, OP_JUMP, OP_CALL,
+    FUSE_LITCALL, FUSE_LITXLIT, FUSE_NEXT, FUSE_MEMREAD     // see Fusions[]
+};
+
+#define FUSIONS (FUSE_MEMREAD + 1 - FUSE_LITCALL)
+#define MaxFusion 3                     // longest superinstruction
+
+struct Decoded {
+    uint8_t op;                         // instruction class (DecodedOps)
+    uint8_t alu;                        // ALU select: OPCODE(insn) & 0x1F
+    uint8_t strobe;                     // strobe select: STROBE(insn) & 0x0F
+    uint8_t isret;                      // R->PC
+    int8_t ds;                          // data stack displacement
+    int8_t rs;                          // return stack displacement
+    uint8_t xop;                        // op or fused op for the lean engines
+    uint16_t insn;                      // raw instruction
+    cell imm;                           // literal, jump target, or op field
+};
+
+// Per-word profile: self counts the cycles spent in the word's own code,
+// total also counts the words it calls. A recursive word's total is only
+// counted by its outermost call.
+
+struct ProfileEntry {
+    uint64_t self, total;               // exclusive and inclusive cycles
+    uint32_t calls;
+    uint16_t active;                    // calls in progress
+};
+
+#define ProfDepth 256                   // nesting that the profiler follows
+
+// Instruction mix: executed instructions by class, and for ALU instructions
+// by ALU select, strobe and stack field. A "kind" is the ALU select for ALU
+// instructions, else MixALU + the class. Pairs of consecutive kinds show
+// which sequences are worth fusing.
+
+#define MixALU   32                     // ALU selects
+#define MixKinds (MixALU + OP_CALL + 1)
+
+struct Mix {
+    uint64_t op[OP_CALL + 1];           // by DecodedOps class
+    uint64_t alu[MixALU];               // by OPCODE()
+    uint64_t strobe[16];                // by STROBE()
+    uint64_t stack[16];                 // by return and data stack fields
+    uint64_t pairs[MixKinds][MixKinds]; // [previous kind][kind]
+    int prev;                           // kind of the previous instruction
+};
+
+struct ProfileFrame {
+    uint16_t word;                      // Header index
+    uint8_t depth;                      // return stack depth on entry
+    uint64_t start;                     // cycle count on entry
+};
+
+// Post-mortem trace: while it's on, the simulator stores each instruction it
+// runs, with the registers it saw, in a ring buffer. Nothing is printed
+// unless the simulator stops on an error, so it can stay on.
+
+struct TraceRec {
+    uint16_t addr, insn;                // PC and instruction
+    uint8_t dsp, rsp;                   // stack pointers
+    cell tos, nos, tor;                 // T, N and R
+};
+
+// Interrupt statistics: the latency of a request is the cycles from raising
+// it to the return that services it. The histogram has a bucket per power
+// of 2: 0, 1, 2-3, 4-7 and so on. A request is deferred when a return can't
+// service it because IRQheadspace stack room is missing.
+
+#define IrqLevels  32                   // bits in irq
+#define IrqBuckets 24
+
+struct IrqStat {
+    uint64_t served, deferred;
+    uint64_t total, max;                // latency in cycles
+    uint64_t hist[IrqBuckets];
+};
+
+struct Event {
+    uint64_t when;                      // cycle count to trigger at
+    void (*handler)(void);              // NULL if not pending
+};
+
+// The machine state is what the target would see: registers, memories,
+// peripherals and pending events.
+
+struct Machine {
+    uint8_t sp, rp;                     // stack pointers
+    cell t, pc, cy, lex, areg;          // registers
+    cell Data[DataSize];                // data memory
+    cell Dstack[StackSize];             // data stack
+    cell Rstack[StackSize];             // return stack
+    cell Raddr;                         // data memory read address
+    uint16_t Code[CodeSize];            // code memory
+    uint64_t cycles;                    // cycle counter
+    uint32_t irq;                       // interrupt requests
+    struct Event Events[EVENTS];
+    uint64_t nextEvent;                 // earliest pending event
+    uint32_t irqLater;                  // interrupts injected by irq-at
+    uint64_t irqRaised[IrqLevels];      // when each pending request was raised
+    int coprocSticky;                   // coprocessor, see _coproc.c
+    uint64_t cop_prod, cop_shift;
+    uint32_t cop_quot, cop_rem, cop_over;
+    uint32_t cop_fgcolor, cop_bgcolor, cop_monobits, cop_color;
+};
+
+struct BreakState {                     // where `resume` continues
+    uint8_t regs[offsetof(struct Machine, Data)];   // sp through areg
+    cell dstk[StackSize];
+    cell rstk[StackSize];
+    uint8_t mark;                       // the run's return depth
+    uint8_t valid;
+};
+
+struct ReplayInput {                    // a logged keyboard read
+    uint64_t when;                      // Now() when it was read
+    uint32_t addr, value;
+};
+
+struct Keyframe {
+    uint64_t when;                      // Now() when it was taken
+    uint64_t before;                    // cycleBase when it was taken
+    struct chadSnapshot* shot;
+};
+
+struct Recorder {                       // see Record and replay
+    struct ReplayInput* log;
+    uint32_t count, size;               // log entries used and allocated
+    uint32_t next;                      // the next entry to replay
+    struct Keyframe frames[ReplayFrames];   // oldest first
+    int kept;                           // frames in use
+    uint64_t interval;                  // cycles between keyframes
+    uint8_t mark;                       // return depth of the recorded run
+    uint8_t replaying;                  // reads come from the log
+    uint8_t watchWas;                   // dataWatch before replaying
+};
+
+struct chadContext {
+    struct Machine m;
+    struct FlashContext flash;          // SPI flash, see flash.c
+    struct GeckoContext gecko;          // keystream generator, see gecko.c
+    struct IOContext io;                // I/O space, see iomap.c
+// simulator
+    int verbose;
+    int error;                          // simulator and interpreter error code
+    cell DataTrc[DataSize];             // data memory for trace comparison
+    uint8_t spMax, rpMax;               // stack depth tracking
+    uint32_t latency;                   // maximum cycles between return
+    struct IrqStat IrqStats[IrqLevels]; // since the last `stats`
+    uint32_t logging;                   // enable simulation logging
+    struct TraceLog* tracelog;          // logsteps trace, open while logging
+    uint8_t trigregs;                   // trigger register dump
+    uint8_t stackTracked;               // spMax, rpMax and latency are valid
+    struct Decoded Decode[CodeSize];    // shadow of Code[]
+    uint32_t codeEpoch;                 // bumped when Code[] changes
+    struct Native* native;              // engine 2's code, see _native.c
+    int engine;                         // simulator engine select
+    uint32_t fusionMask;                // enabled Fusions[]
+    uint64_t fusionHits[FUSIONS];       // times each fused op ran
+    uint8_t pausing;                    // chadStop reasons to end the run
+    uint32_t stopMask;                  // chadStop reasons chadRun accepts
+    uint8_t Breakpoints[CodeSize];      // chadRun stops here
+    int breakpoints;                    // number of breakpoints set
+    cell BreakIf[CodeSize];             // condition xt of each breakpoint
+    uint8_t breakOff;                   // breakpoints are not checked
+    cell lastBreak;                     // break-if sets its condition
+    struct BreakState resumable;        // the run a breakpoint stopped
+    struct Recorder* recorder;          // record is on
+    uint64_t cycleBase;                 // cycles before the last ResetCycles
+    uint8_t dataWatch;                  // heatmap or watchpoints are on
+    uint8_t heating;                    // Data[] accesses are counted
+    uint8_t Watch[DataSize];            // CHAD_WATCH_ bits of each cell
+    int watchpoints;                    // number of watched cells
+    cell watchAddr;                     // the last watchpoint hit
+    cell watchPC;
+    uint8_t watchKind;
+    uint32_t HeatReads[DataSize];       // accesses to each cell
+    uint32_t HeatWrites[DataSize];
+    struct Core* socCore;               // this core in soc-run, else NULL
+    cell socBase, socSize;              // shared window for the next soc-run
+    struct chadSnapshot* snap;          // snapshot and restore use this
+    uint8_t profiling;                  // per-word profile is being taken
+    struct ProfileEntry Profile[MaxKeywords];
+    uint8_t mixing;                     // the instruction mix is counted
+    struct Mix Mix;
+    uint8_t covering;                   // code coverage is being taken
+    uint8_t Covered[CodeSize / 8];      // bit per executed code address
+    uint16_t ProfOwner[CodeSize];       // Header index of each code address
+    int profHP;                         // ProfOwner is for these headers
+    cell profPage;                      // and this applet
+    struct ProfileFrame ProfStack[ProfDepth];
+    int profSP;
+    int profPrev;                       // owner of the previous instruction
+    uint64_t profCycles;                // when it started
+    struct Sample* Samples;             // sampling profiler ring buffer
+    uint64_t sampleCount;               // samples taken
+    uint32_t samplePeriod;              // cycles between samples
+    struct TraceRec TraceRing[TraceRingSize];
+    uint32_t traceNext;                 // next TraceRing[] record
+    int postmortem;                     // records to show after an error
+// compiler
+    cell latest;                        // latest writable code word
+    int noTail;                         // tail recursion inhibited for call
+    uint32_t optimizing;                // OPT_ passes that run at `;`
+    int inlineSize, inlineBudget;       // see `inlining`
+    uint32_t inlineCalls;
+    int inlineGrowth;                   // code added by inlining
+    int FPexpbits;
+    cell CtrlStack[256];                // control stack
+    uint8_t ConSP;
+    int loops;                          // open `begin`s and `for`s
+    int fileID;                         // cumulative file ID
+    struct FileRec FileStack[MaxFiles];
+    struct FilePath FilePaths[MaxFilePaths];
+    int filedepth;                      // file stack
+    uint32_t logcolor;
+    int leadingblanks;
+    int hp;                             // # of keywords in the Header list
+    struct Keyword Header[MaxKeywords];
+    cell me;                            // index of found keyword
+    char* foundWidName;                 // name of wid the word was found in
+    char ref[LineBufferSize];           // ReferenceString result buffer
+    char* ReferenceStackPic;            // string remaining after first blank
+    cell wordlist[MaxWordlists];        // head pointers to linked lists
+    char wordlistname[MaxWordlists][16];// optional name string
+    int wordlists;                      // number of defined wordlists
+    int root_wid;                       // the basic wordlists
+    int forth_wid;
+    int asm_wid;
+    int DefMark, DefMarkID;
+    char DAbuf[256];                    // disassembling to a buffer
+    cell DAlex;                         // lex of the previous instruction
+    uint64_t elapsed_us;
+    uint64_t elapsed_cycles;
+    int lineEngine;                     // engine running this line
+    int elapsed_engine;                 // and the last one, see Stats
+    char* buf;                          // line buffer
+    int maxlen;                         // maximum buffer length
+    char tok[LineBufferSize+1];         // blank-delimited token
+    int isAPI;                          // compiler is in API mode
+    int localWID;                       // compilation wordlist for locals
+    uint32_t signature, flashPtr;       // boot stream CRC and address
+    uint64_t ChadTextKey;
+    int appletCP, appletDP, appletPage;
+};
+
+static THREAD_LOCAL struct chadContext* CX;
+static void TraceStep(uint16_t insn);   // see Execution trace file
+static void TraceClose(void);
+static void RecorderFree(struct Recorder* r);
+#ifdef HAS_NATIVE_SIM
+static void NativeFree(struct Native* n);
+#endif
+
+struct chadContext* chad_new(void) {
+    struct chadContext* c = calloc(1, sizeof(struct chadContext));
+    if (c == NULL) return NULL;
+    c->m.nextEvent = UINT64_MAX;
+    c->lineEngine = -1;
+    c->fusionMask = (1 << FUSIONS) - 1;
+    c->FPexpbits = 8;
+    c->inlineSize = 3;
+    c->inlineBudget = 64;
+    FlashInit(&c->flash);
+    return c;
+}
+
+void chad_free(struct chadContext* c) {
+    if (c == NULL) return;
+    if (c->tracelog) {                  // finish the trace file
+        struct chadContext* self = CX;
+        CX = c;  TraceClose();  CX = self;
+    }
+    if (c == CX) chad_select(NULL);
+    chadSnapshotFree(c->snap);
+    RecorderFree(c->recorder);
+#ifdef HAS_NATIVE_SIM
+    NativeFree(c->native);
+#endif
+    free(c->Samples);
+    free(c);
+}
+
+void chad_select(struct chadContext* c) {
+    CX = c;
+    FlashSelect(c ? &c->flash : NULL);
+    GeckoSelect(c ? &c->gecko : NULL);
+    IOselect(c ? &c->io : NULL);
+}
+
 
 // Shared variables: The first three must be grouped together in this order.
 #define toin    0                       // pointer to next character
@@ -69,27 +376,28 @@ SI error;                               // simulator and interpreter error code
 #define api     (state + 1)             // current API page
 #define here    (api + 1)               // first free variable
 
-#define TOIN    Data[toin]
-#define TIBS    Data[tibs]
-#define ATIB    Data[atib]
-#define DP      Data[dp]
-#define CP      Data[cp]
-#define BASE    Data[base]
-#define ORDERS  Data[orders]
-#define ORDER(x) Data[order + (x)]
-#define CURRENT Data[current]
+#define TOIN    CX->m.Data[toin]
+#define TIBS    CX->m.Data[tibs]
+#define ATIB    CX->m.Data[atib]
+#define DP      CX->m.Data[dp]
+#define CP      CX->m.Data[cp]
+#define BASE    CX->m.Data[base]
+#define ORDERS  CX->m.Data[orders]
+#define ORDER(x) CX->m.Data[order + (x)]
+#define CURRENT CX->m.Data[current]
 #define CONTEXT ORDER(ORDERS - 1)
-#define STATE   Data[state]
-#define API     Data[api]
+#define STATE   CX->m.Data[state]
+#define API     CX->m.Data[api]
 
 SV Hex(void) { BASE = 16; }
 SV Decimal(void) { BASE = 10; }
 SV toImmediate(void) { STATE = 0; }
 SV toCompile(void) { STATE = 1; }
 CELL DisassembleInsn(uint16_t IR, uint16_t page);
+static char* TargetName(cell addr, int page);
 
 static char* itos(uint32_t x, uint8_t radix, int8_t digits, int isUnsigned) {
-    static char buf[32];                // itoa replacement
+    static THREAD_LOCAL char ibuf[32];  // itoa replacement
     uint32_t sign = (x & (1 << (CELLBITS - 1)));
     if (isUnsigned) {
         sign = 0;
@@ -98,16 +406,16 @@ static char* itos(uint32_t x, uint8_t radix, int8_t digits, int isUnsigned) {
         if (sign) x = (~x) + 1;
         x &= CELLMASK;
     }
-    int i = 32;  buf[--i] = 0;
+    int i = 32;  ibuf[--i] = 0;
     do {
         char c = x % radix;
         if (c > 9) c += 7;
-        buf[--i] = c + '0';
+        ibuf[--i] = c + '0';
         x /= radix;
         digits--;
     } while ((x && (i >= 0)) || (digits > 0));
-    if (sign) buf[--i] = '-';
-    return &buf[i];
+    if (sign) ibuf[--i] = '-';
+    return &ibuf[i];
 }
 
 SV Cdot(cell x) {
@@ -118,10 +426,10 @@ SV PrintDataStack(void) {
     int depth = SDEPTH;
     for (int i = 0; i < depth; i++) {
         if (i == (depth - 1)) {
-            Cdot(t);
+            Cdot(CX->m.t);
         }
         else {
-            Cdot(Dstack[(i + 2) & SPMASK]);
+            Cdot(CX->m.Dstack[(i + 2) & SPMASK]);
         }
     }
 }
@@ -130,7 +438,7 @@ SV PrintReturnStack(void) {
     int depth = RDEPTH;
     if (depth == (RPMASK - 1)) depth = 0;
     for (int i = 0; i < depth; i++) {
-        Cdot(Rstack[(i + 1) & RPMASK]);
+        Cdot(CX->m.Rstack[(i + 1) & RPMASK]);
     }
 }
 
@@ -141,43 +449,45 @@ SV TraceStacks(void) {
         printf(" (R: ");  PrintReturnStack();
         printf(")");
     }
-    printf(" \\ a=%Xh, cy=%X\n", areg & CELLMASK, cy);
+    printf(" \\ a=%Xh, cy=%X\n", CX->m.areg & CELLMASK, CX->m.cy);
 }
 
-SV TraceLine(cell pc, uint16_t insn) {
+SV TraceLine(cell addr, uint16_t insn) {
     DisassembleInsn(insn, 0);
-    printf("%03Xh: %04Xh ( ", pc, insn);
+    printf("%03Xh: %04Xh ( ", addr, insn);
     TraceStacks();
 }
 
-SV NewMaxStack(uint8_t s, uint8_t r, int pc) {
-    if (verbose & VERBOSE_STKMAX) {
-        printf("SP=%d, RP=%d, PC=%Xh, R: ", s, r, pc);
+SV NewMaxStack(uint8_t s, uint8_t r, int addr) {
+    if (CX->verbose & VERBOSE_STKMAX) {
+        printf("SP=%d, RP=%d, PC=%Xh, R: ", s, r, addr);
         PrintReturnStack();
         printf("\n");
     }
 }
 
 SV ShowTraceStacks(void) {
-    printf("%03Xh: ( ", pc);
+    printf("%03Xh: ( ", CX->m.pc);
     TraceStacks();
 }
 
 SV ClearTraceData(void) {
-    memcpy(DataTrc, Data, DataSize*sizeof(cell));
+    memcpy(CX->DataTrc, CX->m.Data, DataSize*sizeof(cell));
 }
 
-SV ShowRegs(FILE* fp, uint16_t insn) {
-    fprintf(fp, "PC=%04x,insn=%04x,T=%06x,N=%06x,R=%06x,sp=%02x,rp=%02x\n",
-        pc, insn, t, Dstack[SP], Rstack[RP], sp, rp);
+#define REGS_FORMAT "PC=%04x,insn=%04x,T=%06x,N=%06x,R=%06x,sp=%02x,rp=%02x\n"
+
+SV ShowRegs(FILE* fp, uint16_t insn) {  // same as chad.v's simlog.txt
+    fprintf(fp, REGS_FORMAT, CX->m.pc, insn, CX->m.t, CX->m.Dstack[SP],
+        CX->m.Rstack[RP], CX->m.sp, CX->m.rp);
 }
 
 SV ShowTraceData(void) {
     int printed = 0;
     int length = CELL_ADDR(DP);
     for (int i = 0; i < length; i++) {
-        cell a = Data[i];
-        cell b = DataTrc[i];
+        cell a = CX->m.Data[i];
+        cell b = CX->DataTrc[i];
         if (a != b) {
             printf("Data[%Xh]: %d -> %d\n", BYTE_ADDR(i), b, a);
             printed++;
@@ -188,31 +498,93 @@ SV ShowTraceData(void) {
     ClearTraceData();
 }
 
+// Show the last n instructions in the post-mortem trace, oldest first, with
+// the registers before each one ran.
+
+SV PostMortem(int n) {
+    uint32_t kept = CX->traceNext;
+    if (kept > TraceRingSize) kept = TraceRingSize;
+    if ((uint32_t)n > kept) n = kept;
+    printf("Last %d instructions:\n", n);
+    for (uint32_t i = CX->traceNext - n; i != CX->traceNext; i++) {
+        struct TraceRec* r = &CX->TraceRing[i & (TraceRingSize - 1)];
+        char* name = TargetName(r->addr, 0);
+        if (name != NULL) printf("%s\n", name);
+        printf("%03Xh: %04Xh ", r->addr, r->insn);
+        DisassembleInsn(r->insn, 0);
+        printf(" T=%X N=%X R=%X sp=%d rp=%d\n",
+            r->tos, r->nos, r->tor, r->dsp, r->rsp);
+    }
+}
+
 //##############################################################################
 // CPU simulator
 
-static uint16_t Code[CodeSize];         // code memory
-static uint8_t spMax, rpMax;            // stack depth tracking
-static uint64_t cycles = 0;             // cycle counter
-static uint32_t latency = 0;            // maximum cycles between return
-static uint32_t irq = 0;                // interrupt requests
-static uint32_t logging = 0;            // enable simulation logging
+SI sign2b[4] = { 0, 1, -1, -1 };        /* 2-bit sign extension */
+
+SV Predecode(struct Decoded* d, uint16_t insn) {
+    d->insn = insn;
+    d->alu = d->strobe = d->isret = 0;
+    d->ds = d->rs = 0;
+    d->imm = insn & 0xFFF;
+    switch (INST(insn)) {
+    case INST(alu0):
+        d->op = OP_ALU;
+        d->alu = OPCODE(insn) & 0x1F;
+        d->strobe = STROBE(insn) & 0x0F;
+        d->isret = ((insn & 12) == 8);
+        d->ds = sign2b[insn & 3];
+        d->rs = sign2b[(insn >> 2) & 3];
+        break;
+    case INST(alu1): d->op = OP_NOP;  break;  // not implemented, acts as nop
+    case INST(lit):
+    case INST(trap):
+        d->op = (INST(insn) == INST(lit)) ? OP_LIT : OP_TRAP;
+        if (insn & litSign) {
+            d->op++;                    // sign-extended literal
+            d->imm = (ALL_ONES & ~0xFFF) | (insn & 0xFFF);
+        }
+        break;
+    case INST(litx):
+        if (insn & 0x1000) {
+            d->op = (insn & 0x800) ? OP_USER : OP_COP;
+            d->imm = insn & 0x7FF;
+        }
+        else
+            d->op = OP_LITX;
+        break;
+    case INST(zjump): d->op = OP_ZJUMP;  d->imm = insn & 0x1fff;  break;
+    case INST(jump):  d->op = OP_JUMP;   d->imm = insn & 0x1fff;  break;
+    case INST(call):  d->op = OP_CALL;   d->imm = insn & 0x1fff;  break;
+    }
+    d->xop = d->op;
+}
+
+// Code[addr] changed. A superinstruction starting up to MaxFusion-1
+// instructions earlier may have changed too, so decode those again.
+
+SV Undecode(cell addr) {
+    CX->codeEpoch++;
+    for (int i = 0; i < MaxFusion; i++)
+        if (addr >= (cell)i) CX->Decode[addr - i].op = OP_UNDECODED;
+}
 
 // The C host uses this (externally) to write to code and data spaces.
 // Addr is a cell address in each case.
 
 void chadToCode (uint32_t addr, uint32_t x) {
     if (addr >= CodeSize) {
-        error = BAD_CODE_WRITE;  return;
+        CX->error = BAD_CODE_WRITE;  return;
     }
-    Code[addr & (CodeSize-1)] = (uint16_t)x;
+    CX->m.Code[addr & (CodeSize-1)] = (uint16_t)x;
+    Undecode(addr);
 }
 
 void chadToData(uint32_t addr, uint32_t x) {
     if (addr >= DataSize) {
-        error = BAD_DATA_WRITE;  return;
+        CX->error = BAD_DATA_WRITE;  return;
     }
-    Data[addr & (DataSize-1)] = (cell)x;
+    CX->m.Data[addr & (DataSize-1)] = (cell)x;
 }
 
 // Time-critical code starts here. Code is manually included to keep it
@@ -220,6 +592,64 @@ void chadToData(uint32_t addr, uint32_t x) {
 
 #include "_coproc.c"                    // include coprocessor code
 
+SV SocAccess(cell addr, uint32_t mask, cell data);
+
+// WatchData counts an access to Data[] for the heatmap and checks it against
+// the watchpoints. The simulator only calls it while dataWatch is set. A hit
+// ends the run after this instruction the way chadWaitIO does.
+
+SV WatchData(cell addr, int kind) {     // kind is CHAD_WATCH_READ or _WRITE
+    if (CX->heating) {
+        if (kind == CHAD_WATCH_READ) CX->HeatReads[addr]++;
+        else CX->HeatWrites[addr]++;
+    }
+    if (CX->Watch[addr] & kind) {
+        CX->watchAddr = addr;  CX->watchPC = CX->m.pc;
+        CX->watchKind = (uint8_t)kind;
+        CX->pausing |= CHAD_STOP_WATCH;
+        CX->m.nextEvent = CX->m.cycles;
+    }
+}
+
+// The keyboard is the only input the machine can't work out for itself.
+// While recording, ReadIO logs what the keyboard returns and when. A replay
+// reads the log instead and checks that it asks at the same times.
+
+static uint64_t Now(void) {             // cycles since chad started
+    return CX->cycleBase + CX->m.cycles;
+}
+
+static uint32_t RecordIO(uint32_t addr) {
+    struct Recorder* r = CX->recorder;
+    if (r->replaying) {
+        struct ReplayInput* in = &r->log[r->next];
+        if ((r->next < r->count) && (in->addr == addr) && (in->when == Now())) {
+            r->next++;
+            return in->value;
+        }
+        chadError(BAD_REPLAY);
+        return 0;
+    }
+    uint32_t x = readIOmap(addr);
+    if (r->count == r->size) {
+        uint32_t size = (r->size) ? r->size * 2 : 256;
+        struct ReplayInput* log = realloc(r->log, size * sizeof(*log));
+        if (log == NULL) {
+            chadError(BAD_ALLOCATE);
+            return x;
+        }
+        r->log = log;  r->size = size;
+    }
+    struct ReplayInput* in = &r->log[r->count++];
+    in->when = Now();  in->addr = addr;  in->value = x;
+    return x;
+}
+
+static uint32_t ReadIO(uint32_t addr) {
+    if (CX->recorder && (addr < 2)) return RecordIO(addr); // key and key?
+    return readIOmap(addr);
+}
+
 // Dwrite simulates a write with byte lane enables.
 // The data is expected to be aligned by software for nonzero m.
 // size is (bytes-1), used to test the size. 0 for no test.
@@ -234,25 +664,27 @@ SI Dwrite(cell data, cell c_addr, int size, int m) {
     uint32_t mask = ALL_ONES;
     mask = ((mask >> (m << 3)) << ((c_addr & m) << 3));
     //      {FF,FFFF,FFFFFFFF} << byte_count
-    cell temp = Data[a_addr] & ~mask;
-    if (verbose & VERBOSE_TRACE) {
+    cell temp = CX->m.Data[a_addr] & ~mask;
+    if (CX->verbose & VERBOSE_TRACE) {
         printf("Storing %Xh to cell %Xh using mask %08X\n", data, a_addr, mask);
     } 
-    Data[a_addr] = temp + (data & mask);
+    CX->m.Data[a_addr] = temp + (data & mask);
+    if (CX->dataWatch) WatchData(a_addr, CHAD_WATCH_WRITE);
+    if (CX->socCore) SocAccess(a_addr, mask, data);
     return 0;
 }
 
 SV Dpush(cell v)                        // push to on the data stack
 {
     SP = SPMASK & (SP + 1);
-    Dstack[SP] = t;
-    t = v;
+    CX->m.Dstack[SP] = CX->m.t;
+    CX->m.t = v;
 }
 
 CELL Dpop(void)                         // pop from the data stack
 {
-    cell v = t;
-    t = Dstack[SP];
+    cell v = CX->m.t;
+    CX->m.t = CX->m.Dstack[SP];
     SP = SPMASK & (SP - 1);
     return v;
 }
@@ -260,20 +692,254 @@ CELL Dpop(void)                         // pop from the data stack
 SV Rpush(cell v)                        // push to the return stack
 {
     RP = RPMASK & (RP + 1);
-    Rstack[RP] = v;
+    CX->m.Rstack[RP] = v;
 }
 
 // Interrupts are handled by modifying the return instruction
 
+SV RaiseIRQ(uint32_t x) {               // request interrupts, noting when
+    uint32_t rising = x & ~CX->m.irq;
+    for (int i = 0; rising; i++, rising >>= 1)
+        if (rising & 1) CX->m.irqRaised[i] = CX->m.cycles;
+    CX->m.irq |= x;
+}
+
+SV IrqServed(int n) {                   // add to the latency statistics
+    struct IrqStat* s = &CX->IrqStats[n];
+    uint64_t wait = CX->m.cycles - CX->m.irqRaised[n];
+    int b = 0;
+    while ((wait >> b) && (b < (IrqBuckets - 1))) b++;
+    s->served++;
+    s->total += wait;
+    if (wait > s->max) s->max = wait;
+    s->hist[b]++;
+}
+
 static uint8_t Iack(void) {             // priority encoder
     uint8_t r = 0;
-    uint32_t x = irq;
-    if ((sp <= (MAXSP - IRQheadspace))  // only acknowledge if sufficient stack
-        && (rp <= (MAXRP - IRQheadspace))) {
-        while (x >>= 1) ++r;            // position of highest bit
-        irq &= ~(1 << r);               // clear the request bit
+    uint32_t x = CX->m.irq;
+    if (x == 0) return 0;
+    while (x >>= 1) ++r;                // position of highest bit
+    if ((CX->m.sp <= (MAXSP - IRQheadspace)) // only if there's enough stack
+        && (CX->m.rp <= (MAXRP - IRQheadspace))) {
+        CX->m.irq &= ~(1 << r);         // clear the request bit
+        if (r) IrqServed(r);
+        return r;
     }
-    return r;
+    if (r) CX->IrqStats[r].deferred++;
+    return 0;
+}
+
+//##############################################################################
+// Event queue
+// Time-based events are kept in an array indexed by event ID. There are only
+// a few, so finding the earliest one is a quick scan that only happens when
+// events are scheduled or handled. The simulator compares cycles to
+// nextEvent after each instruction.
+
+SV NextEvent(void) {
+    CX->m.nextEvent = UINT64_MAX;
+    for (int i = 0; i < EVENTS; i++) {
+        struct Event* e = &CX->m.Events[i];
+        if ((e->handler) && (e->when < CX->m.nextEvent))
+            CX->m.nextEvent = e->when;
+    }
+}
+
+void chadSchedule(int id, uint64_t when, void (*handler)(void)) {
+    CX->m.Events[id].when = when;
+    CX->m.Events[id].handler = handler;
+    NextEvent();
+}
+
+void chadCancel(int id) {
+    CX->m.Events[id].handler = NULL;
+    NextEvent();
+}
+
+SI RunEvents(void) {                    // cycles has reached nextEvent
+    for (int i = 0; i < EVENTS; i++) {
+        void (*handler)(void) = CX->m.Events[i].handler;
+        if ((handler) && (CX->m.Events[i].when <= CX->m.cycles)) {
+            CX->m.Events[i].handler = NULL;
+            handler();                  // may schedule it again
+        }
+    }
+    NextEvent();
+    return CX->pausing;                 // a handler wants the run to end
+}
+
+void chadIdle(void) {                   // the current instruction retires
+    if ((CX->m.nextEvent != UINT64_MAX) && (CX->m.cycles + 1 < CX->m.nextEvent))
+        CX->m.cycles = CX->m.nextEvent - 1; // on the next event
+}
+
+void chadInterrupt(int n) {
+    RaiseIRQ(1 << n);
+}
+
+SV TimerEvent(void) {                   // raw counter overflow
+    RaiseIRQ(1 << 1);                   // lowest priority interrupt
+    chadSchedule(EVENT_TIMER, (CX->m.cycles | CELLMASK) + 1, TimerEvent);
+}
+
+SV IRQevent(void) {
+    RaiseIRQ(CX->m.irqLater);
+    CX->m.irqLater = 0;
+}
+
+SV PauseEvent(void) {                   // end of a cycle budget
+    CX->pausing |= CHAD_STOP_CYCLES;
+}
+
+void chadWaitIO(void) {                 // end the run after this instruction
+    if (CX->stopMask & CHAD_STOP_IOWAIT) {
+        CX->pausing |= CHAD_STOP_IOWAIT;
+        CX->m.nextEvent = CX->m.cycles;
+    }
+}
+
+SV ResetCycles(void) {                  // pending events keep their distance
+    for (int i = 0; i < EVENTS; i++) {
+        CX->m.Events[i].when = (CX->m.Events[i].when > CX->m.cycles)
+            ? CX->m.Events[i].when - CX->m.cycles : 0;
+    }
+    if (CX->profiling) {                // so do the profiler's marks
+        CX->profCycles -= CX->m.cycles;
+        for (int i = 0; i < CX->profSP; i++)
+            CX->ProfStack[i].start -= CX->m.cycles;
+    }
+    for (int i = 0; i < IrqLevels; i++)
+        CX->m.irqRaised[i] -= CX->m.cycles; // modulo 2^64, latency still works
+    CX->cycleBase += CX->m.cycles;      // the recorder's time goes on
+    CX->m.cycles = 0;
+    chadSchedule(EVENT_TIMER, (uint64_t)CELLMASK + 1, TimerEvent);
+}
+
+//##############################################################################
+// Profiler
+// The instrumented simulator calls ProfileStep before each instruction while
+// profiling. Each cycle is charged to the definition that owns the PC. A
+// word is entered when the PC lands on its first instruction, either by a
+// call or by a tail-call jump, and left when the return stack drops below
+// its depth on entry. Applet words share the cache region, so the owner map
+// follows the applet that `api` says is loaded.
+
+SV OwnerMap(uint16_t* map, cell page) { // code address -> Header index
+    memset(map, 0, CodeSize * sizeof(uint16_t));
+    for (int i = 1; i <= CX->hp; i++) {
+        struct Keyword* h = &CX->Header[i];
+        if ((h->length == 0) || (h->applet && (h->applet != page)))
+            continue;
+        cell end = h->target + h->length;
+        for (cell a = h->target; (a < end) && (a < CodeSize); a++)
+            map[a] = i;
+    }
+}
+
+SV ProfileMap(void) {
+    OwnerMap(CX->ProfOwner, CX->m.Data[api]);
+    CX->profHP = CX->hp;
+    CX->profPage = CX->m.Data[api];
+}
+
+SV ProfileExit(void) {
+    struct ProfileFrame* f = &CX->ProfStack[--CX->profSP];
+    struct ProfileEntry* e = &CX->Profile[f->word];
+    if (--e->active == 0)
+        e->total += CX->m.cycles - f->start;
+}
+
+SV ProfileStep(void) {
+    if ((CX->hp != CX->profHP) || (CX->m.Data[api] != CX->profPage))
+        ProfileMap();
+    if (CX->profPrev)
+        CX->Profile[CX->profPrev].self += CX->m.cycles - CX->profCycles;
+    CX->profCycles = CX->m.cycles;
+    while (CX->profSP && (CX->ProfStack[CX->profSP - 1].depth > RDEPTH))
+        ProfileExit();                  // returned
+    int w = CX->ProfOwner[CX->m.pc & (CodeSize - 1)];
+    if (w && (CX->m.pc == CX->Header[w].target)) {
+        struct ProfileFrame* f = &CX->ProfStack[CX->profSP];
+        if ((CX->profSP == 0) || (f[-1].word != w) || (f[-1].depth < RDEPTH)) {
+            CX->Profile[w].calls++;
+            if (CX->profSP < ProfDepth) {
+                f->word = w;
+                f->depth = RDEPTH;
+                f->start = CX->m.cycles;
+                CX->Profile[w].active++;
+                CX->profSP++;
+            }
+        }
+    }
+    CX->profPrev = w;
+}
+
+SV CountMix(struct Decoded* d) {
+    int kind = MixALU + d->op;
+    CX->Mix.op[d->op]++;
+    if (d->op == OP_ALU) {
+        kind = d->alu;
+        CX->Mix.alu[d->alu]++;
+        CX->Mix.strobe[d->strobe]++;
+        CX->Mix.stack[d->insn & 15]++;
+    }
+    if (CX->Mix.prev < MixKinds)
+        CX->Mix.pairs[CX->Mix.prev][kind]++;
+    CX->Mix.prev = kind;
+}
+
+SV ProfileFlush(void) {                 // charge what has finished so far
+    if (CX->profPrev)
+        CX->Profile[CX->profPrev].self += CX->m.cycles - CX->profCycles;
+    CX->profCycles = CX->m.cycles;
+    while (CX->profSP && (CX->ProfStack[CX->profSP - 1].depth > RDEPTH))
+        ProfileExit();
+}
+
+// The sampling profiler is for runs too long to profile every instruction.
+// An event every samplePeriod cycles copies the PC and the return stack to a
+// ring buffer, so the simulator loop does nothing extra. The names are
+// looked up when the samples are saved as folded stacks, one line per
+// distinct call stack followed by its count, which flame graph tools read.
+
+struct Sample {
+    uint16_t addr;                      // PC
+    uint8_t depth;                      // return stack depth
+    cell page;                          // applet in the cache region
+    cell r[StackSize];                  // return stack, innermost first
+};
+
+SV SampleEvent(void) {
+    if (CX->Samples == NULL) {          // a copy of the machine in soc-run
+        chadCancel(EVENT_SAMPLE);  return;
+    }
+    struct Sample* s = &CX->Samples[CX->sampleCount++ % SampleSize];
+    s->addr = (uint16_t)CX->m.pc;
+    s->page = CX->m.Data[api];
+    s->depth = RDEPTH;
+    for (int i = 0; i < s->depth; i++)
+        s->r[i] = CX->m.Rstack[(RP - i) & RPMASK];
+    chadSchedule(EVENT_SAMPLE, CX->m.cycles + CX->samplePeriod, SampleEvent);
+}
+
+SI CodeOwner(uint16_t* map, cell addr, cell page) {
+    addr &= CodeSize - 1;
+    if ((page == 0) || (addr < (CodeSize - CodeCache)))
+        return map[addr];
+    for (int i = CX->hp; i > 0; i--) {  // applet word
+        struct Keyword* h = &CX->Header[i];
+        if ((h->applet == page) && (addr >= h->target)
+            && (addr < (h->target + h->length)))
+            return i;
+    }
+    return 0;
+}
+
+#define FoldWidth (StackSize + 2)       // [0] is the frame count
+
+static int CompareFolded(const void* a, const void* b) {
+    return memcmp(a, b, FoldWidth * sizeof(uint16_t));
 }
 
 #if (CELLBITS > 31)
@@ -287,251 +953,928 @@ static uint8_t Iack(void) {             // priority encoder
 // single = -1: Run until error, returns error code.
 // single = 1: Execute one instruction (single step) from Code[PC].
 // single = 10000h + instruction: Execute instruction. Returns the instruction.
-// MoreInstrumentation (config.h) slows down the code by 40%.
 
-SI sign2b[4] = { 0, 1, -1, -1 };        /* 2-bit sign extension */
+// The simulator loop is in _cpusim.c, which is compiled once per engine.
+// Engine 0 dispatches with a switch statement. Engine 1 uses direct-threaded
+// dispatch through GCC's computed goto. Compilers without it get engine 0.
+// Engine 2 runs x86-64 translations of the code, see _native.c.
+// Each engine comes in a lean version, a ring version that also keeps the
+// post-mortem trace, about 25% slower, and an instrumented version, about
+// 40% slower. Tracing, logging, register dumps, stack depth tracking, the
+// profiler, code coverage, data watching and recording select the
+// instrumented version at run time. Its engines all go one instruction at a
+// time, so a recording replays the same on any of them.
+
+#define SIM_RESELECT 3                  // run needs the other loop version
+#define SIM_PAUSED   4                  // an event ended the run early
+#define SIM_BREAK    5                  // stopped at a breakpoint
+
+SI LoopVersion(void) {                  // Engines[engine][version]
+    if ((CX->verbose & (VERBOSE_TRACE | VERBOSE_STKMAX)) || CX->logging
+        || CX->trigregs || CX->socCore || CX->profiling || CX->mixing
+        || CX->covering || CX->dataWatch
+        || CX->recorder || (CX->breakpoints && !CX->breakOff))
+        return 2;                       // instrumented
+    return (CX->postmortem) ? 1 : 0;    // ring or lean
+}
+
+// Superinstructions: The lean engines run these instruction sequences with
+// one handler. Each instruction still takes a cycle. A sequence is matched
+// by masking each instruction and comparing. The hit counts are a profile
+// for deciding which ones are worth enabling. The compiler already merges
+// a return into the preceding ALU instruction, so that needs no pattern.
+// Dmax and rmax are how far the stacks rise inside the sequence.
+
+struct Fusion {
+    char* name;
+    uint8_t xop;                        // fused op
+    uint8_t len;                        // instructions in the sequence
+    uint8_t dmax, rmax;
+    uint16_t mask[MaxFusion];
+    uint16_t match[MaxFusion];
+};
+
+static struct Fusion Fusions[] = {
+    { "lit call",      FUSE_LITCALL, 2, 1, 1,
+      { 0xE000, 0xE000 },           { lit, call } },
+    { "litx lit",      FUSE_LITXLIT, 2, 1, 0,
+      { 0xF000, 0xE000 },           { litx, lit } },
+    { "(R-1)@ T0=>R zjump", FUSE_NEXT, 3, 1, 0,
+      { 0xFFFF, 0xFFFF, 0xE000 },
+      { alu0 | RM1toT | TtoN | sup, alu0 | zeq | TtoR, zjump } },
+    { "_@ _@_",        FUSE_MEMREAD, 2, 0, 0,
+      { 0xFFFF, 0xFFFF },           { alu0 | memrd, alu0 | read } },
+};
+
+// Find the enabled superinstruction at addr, which has been predecoded.
+// Returns the op to dispatch in the lean engines. The rest of the sequence
+// gets decoded too, since its handler takes operands from those records.
+
+SI FusedOp(cell addr) {
+    for (int i = 0; i < (int)FUSIONS; i++) {
+        struct Fusion* f = &Fusions[i];
+        if (!(CX->fusionMask & (1 << i))
+            || ((addr + f->len) > CodeSize)) continue;
+        int k = 0;
+        while ((k < f->len)
+            && ((CX->m.Code[addr + k] & f->mask[k]) == f->match[k])) k++;
+        if (k == f->len) {
+            for (k = 1; k < f->len; k++) {
+                struct Decoded* d = &CX->Decode[addr + k];
+                if (d->op == OP_UNDECODED) {
+                    Predecode(d, CX->m.Code[addr + k]);
+                    d->xop = FusedOp(addr + k);
+                }
+            }
+            return f->xop;
+        }
+    }
+    return CX->Decode[addr].op;
+}
+
+// A superinstruction skips the checks between its instructions, so it runs
+// only if none of them could trip: no event comes due before its last
+// instruction and the stacks stay clear of the overflow and underflow marks.
+// Otherwise the engine runs the sequence one instruction at a time.
+
+SI FusionFits(int i) {
+    struct Fusion* f = &Fusions[i];
+    return ((CX->m.cycles + f->len) <= CX->m.nextEvent)
+        && (((int)SP + f->dmax) <= SPMASK - 2)
+        && (((int)RP + f->rmax) <= RPMASK - 2);
+}
+
+#define SIM_NAME         CPUswitch
+#define SIM_THREADED     0
+#define SIM_INSTRUMENTED 0
+#include "_cpusim.c"
+#define SIM_NAME         CPUswitchR
+#define SIM_THREADED     0
+#define SIM_INSTRUMENTED 0
+#define SIM_RING         1
+#include "_cpusim.c"
+#define SIM_NAME         CPUswitchX
+#define SIM_THREADED     0
+#define SIM_INSTRUMENTED 1
+#include "_cpusim.c"
+
+#ifdef __GNUC__
+#define HAS_THREADED_SIM
+#define SIM_NAME         CPUthreaded
+#define SIM_THREADED     1
+#define SIM_INSTRUMENTED 0
+#include "_cpusim.c"
+#define SIM_NAME         CPUthreadedR
+#define SIM_THREADED     1
+#define SIM_INSTRUMENTED 0
+#define SIM_RING         1
+#include "_cpusim.c"
+#define SIM_NAME         CPUthreadedX
+#define SIM_THREADED     1
+#define SIM_INSTRUMENTED 1
+#include "_cpusim.c"
+#endif
 
-SI CPUsim(int single) {
-    cell _t = t;                        // types are unsigned
-    cell _pc;
-    uint16_t insn;
-#ifdef MoreInstrumentation
-    FILE* fp = NULL;
-    if (logging) {
-        fp = fopenx(SIM_FILENAME, "w");
-    }
-    uint16_t retMark = (uint16_t)cycles;
-    uint8_t trigregs = 0;               // trigger register dump
+#include "_native.c"                    // engine 2, if HAS_NATIVE_SIM
+
+typedef int (*SimFn)(int single, uint8_t mark);
+
+static SimFn Engines[][3] = {           // [engine][LoopVersion()]
+    { CPUswitch, CPUswitchR, CPUswitchX },
+#ifdef HAS_THREADED_SIM
+    { CPUthreaded, CPUthreadedR, CPUthreadedX },
+#else
+    { NULL, NULL, NULL },               // not supported by the compiler
+#endif
+#ifdef HAS_NATIVE_SIM
+    { CPUnative, CPUthreadedR, CPUthreadedX },
+#else
+    { NULL, NULL, NULL },               // not supported by the host
 #endif
+};
+static char* EngineNames[] = { "switch", "threaded", "native" };
+
+SI BreakTaken(void);
+SV BreakStop(char* what, uint8_t mark);
+
+SI StepOver(uint8_t mark) {             // run the instruction at a breakpoint
+    int r = Engines[CX->engine][LoopVersion()](1, mark);
+    if (r != 1) return r;               // returned or failed
+    return (CX->pausing) ? SIM_PAUSED : SIM_RESELECT;
+}
+
+// A breakpoint whose condition is false is stepped over. One that stops a
+// run outside of chadRun is an error, after saving the run for `resume`.
+
+SI CPUrun(int single, uint8_t mark) {
+    int r;
+    if (CX->lineEngine == -1) CX->lineEngine = CX->engine;
+    else if (CX->lineEngine != CX->engine) CX->lineEngine = -2;
+    do {
+        r = Engines[CX->engine][LoopVersion()](single, mark);
+        if ((r == SIM_BREAK) && !BreakTaken())
+            r = StepOver(mark);         // SIM_RESELECT goes on
+    } while (r == SIM_RESELECT);
+    if ((r == SIM_BREAK) && !(CX->stopMask & CHAD_STOP_BREAK)) {
+        BreakStop("Break", mark);
+        r = BAD_BREAKPOINT;
+    }
+    if ((CX->pausing & CHAD_STOP_WATCH) && !(CX->stopMask & CHAD_STOP_WATCH)) {
+        CX->pausing &= ~CHAD_STOP_WATCH; // an error unless chadRun wants it
+        printf("%s [%Xh] at PC=%Xh\n", (CX->watchKind == CHAD_WATCH_READ)
+            ? "Read" : "Write", BYTE_ADDR(CX->watchAddr), CX->watchPC);
+        r = BAD_WATCHPOINT;
+    }
+    if ((r < 0) && CX->postmortem)
+        PostMortem(CX->postmortem);
+    return r;
+}
+
+SI CPUsim(int single) {
     uint8_t mark = RDEPTH;
     if (single == -1) {                 // run until error
         single = 0;
         mark = 0xFF;
     }
-    if (single & 0x10000) {             // execute one instruction directly
-        insn = single & 0xFFFF;
-        goto once;
-    }
-    do {
-        insn = Code[pc & (CodeSize - 1)];
-    once:
-#ifdef MoreInstrumentation
-        if (verbose & VERBOSE_TRACE) {
-            TraceLine(pc, insn);
-        }
-        if (logging) {
-            ShowRegs(fp, insn);
-            logging--;
-            if (logging == 0)
-                fclose(fp);
-        }
-        if (trigregs) {
-            ShowRegs(stdout, insn);
-            trigregs = 0;
+    return CPUrun(single, mark);
+}
+
+SV RecordRun(uint8_t mark);             // see Record and replay
+
+SV Simulate(cell xt) {
+    CX->latency = 0;                    // reset latency measurement
+    Rpush(0);  CX->m.pc = xt;
+    RecordRun(RDEPTH);
+    int result = CPUsim(0);             // run until last RET or error
+    if (CX->profiling) ProfileFlush();  // before the next Rpush(0)
+    if (result < 0) CX->error = result;
+}
+
+//##############################################################################
+// Breakpoints
+// Breakpoints[] marks the code addresses to stop at. The instrumented loop
+// checks it before each instruction, so no breakpoints costs nothing. The
+// condition of a breakpoint is a target word that runs on a copy of the
+// registers and stacks, so it sees T, N, A and the stacks as they are at
+// the breakpoint. It leaves a flag: zero to keep going. Memory it writes
+// stays written, so conditions should only read.
+
+SI BreakTaken(void) {                   // the condition here is true
+    cell xt = CX->BreakIf[CX->m.pc & (CodeSize - 1)];
+    if (xt == 0) return 1;
+    uint8_t regs[sizeof(CX->resumable.regs)];
+    cell dstk[StackSize], rstk[StackSize];
+    struct Event ev[EVENTS];
+    memcpy(regs, &CX->m, sizeof(regs));
+    memcpy(dstk, CX->m.Dstack, sizeof(dstk));
+    memcpy(rstk, CX->m.Rstack, sizeof(rstk));
+    memcpy(ev, CX->m.Events, sizeof(ev));
+    uint64_t c0 = CX->m.cycles, next = CX->m.nextEvent;
+    cell ra = CX->m.Raddr;
+    uint32_t irqs = CX->m.irq, later = CX->m.irqLater;
+    uint8_t off = CX->breakOff, paused = CX->pausing;
+    CX->breakOff = 1;
+    Rpush(0);  CX->m.pc = xt;
+    int r = CPUrun(0, RDEPTH);
+    int taken = (r != 2) || (CX->m.t != 0); // a failed condition stops too
+    memcpy(&CX->m, regs, sizeof(regs));
+    memcpy(CX->m.Dstack, dstk, sizeof(dstk));
+    memcpy(CX->m.Rstack, rstk, sizeof(rstk));
+    memcpy(CX->m.Events, ev, sizeof(ev));
+    CX->m.cycles = c0;  CX->m.nextEvent = next;  CX->m.Raddr = ra;
+    CX->m.irq = irqs;  CX->m.irqLater = later;
+    CX->breakOff = off;  CX->pausing = paused;
+    return taken;
+}
+
+SV BreakStop(char* what, uint8_t mark) {    // show where, save for `resume`
+    char* name = NULL;
+    cell offset = 0;
+    for (int i = CX->hp; i > 0; i--) {  // definition holding the PC
+        struct Keyword* h = &CX->Header[i];
+        if ((h->applet == 0) && (CX->m.pc >= h->target)
+            && (CX->m.pc < (h->target + h->length))) {
+            name = h->name;  offset = CX->m.pc - h->target; break;
         }
-#endif
-        _pc = pc + 1;
-        uint8_t interruptVector = 0;
-        uint32_t exception = 0;
-        cell _lex = 0;
-        cell s = Dstack[SP];
-        cell temp;
-        switch (INST(insn)) {
-        case INST(alu0):
-            if ((insn & 12) == 8) {                                 /*  r->pc */
-                interruptVector = Iack();
-                exception = Rstack[RP] & (~0x1FFF);
-                if (exception)
-                    _pc = ExceptionVector;
-                else if (interruptVector)
-                    _pc = interruptVector;
-                else {
-                    _pc = Rstack[RP];
-                    if (RDEPTH == mark) single = 2;
-                }
-#ifdef MoreInstrumentation
-                uint16_t time = (uint16_t)cycles - retMark;
-                retMark = (uint16_t)cycles;
-                if (time > latency)
-                    latency = time;
-#endif
-            }
-            cell _c = t & 1;
-            sum_t sum;
-            switch (OPCODE(insn) & 0x1F) {
-            case OPCODE(T):     _t = t;                      break; /*      T */
-            case OPCODE(cop):   _t = coprocRead();           break; /*    COP */
-            case OPCODE(less0): _t = (t & MSB) ? -1 : 0;     break; /*    T<0 */
-            case OPCODE(carry): _t = cy;                     break; /*      C */
-            case OPCODE(shr1): temp = (t & MSB);
-                _t = (t >> 1) | temp;                        break; /*    T2/ */
-            case OPCODE(shrx):
-                _t = (t >> 1) | (cy << (CELLBITS - 1));      break; /*   cT2/ */
-            case OPCODE(shl1): _c = t >> (CELLBITS - 1);
-                _t = t << 1;                                 break; /*    T2* */
-            case OPCODE(shlx): _c = t >> (CELLBITS - 1);
-                _t = (t << 1) | cy;                          break; /*   T2*c */
-            case OPCODE(swapb): _t = ((t >> 8) & 0xFF00FF) | ((t & 0xFF00FF) << 8);
-                break;                                              /*     >< */
-            case OPCODE(swapw): _t = ((t >> 16) & 0xFFFF) | ((t & 0xFFFF) << 16);
-                break;                                              /*   ><16 */
-            case OPCODE(NtoT): _t = s;                       break; /*      N */
-            case OPCODE(AtoT): _t = areg;                    break; /*      A */
-            case OPCODE(RtoT): _t = Rstack[RP];              break; /*      R */
-            case OPCODE(RM1toT): _t = Rstack[RP] - 1;        break; /*    R-1 */
-            case OPCODE(add): sum = (sum_t)s + (sum_t)t;
-                _c = (sum >> CELLBITS) & 1;  _t = (cell)sum; break; /*    T+N */
-            case OPCODE(eor):  _t = s ^ t;                   break; /*    T^N */
-            case OPCODE(com):  _t = ~t;                      break; /*     ~T */
-            case OPCODE(Tand): _t = s & t;                   break; /*    T&N */
-            case OPCODE(input): _t = readIOmap(CELL_ADDR(t)); break; /*    IO */
-            case OPCODE(read): _t = Data[Raddr];
-                if (verbose & VERBOSE_TRACE) {
-                    printf("Reading %Xh from cell %Xh\n", _t, Raddr);
-                } break;                                            /*      M */
-            case OPCODE(zeq): _t = (t) ? 0 : -1;             break; /*    T0= */
-            case OPCODE(who): _t = (RDEPTH << 8) + SDEPTH;   break; /* status */
-            default:   _t = t;  single = BAD_ALU_OP;
-            }
+    }
+    printf("%s at %Xh", what, CX->m.pc);
+    if (name) printf(" %s+%d", name, offset);
+    printf("\n");
+    ShowTraceStacks();
+    memcpy(CX->resumable.regs, &CX->m, sizeof(CX->resumable.regs));
+    memcpy(CX->resumable.dstk, CX->m.Dstack, sizeof(CX->resumable.dstk));
+    memcpy(CX->resumable.rstk, CX->m.Rstack, sizeof(CX->resumable.rstk));
+    CX->resumable.mark = mark;
+    CX->resumable.valid = 1;
+}
+
+SV ColdRun(void) {                      // run from pc until it stops
+    struct chadStatus s = chadRun(0, CHAD_STOP_BREAK);
+    if (s.reason == CHAD_STOP_BREAK) {
+        BreakStop("Break", 0xFF);
+        CX->error = BAD_BREAKPOINT;
+    }
+}
 
-            SP = SPMASK & (SP + sign2b[insn & 3]);                /* dstack+- */
-            if ((interruptVector == 0) && (exception == 0))
-                RP = RPMASK & (RP + sign2b[(insn >> 2) & 3]);     /* rstack+- */
-
-            switch (STROBE(insn) & 0x0F)
-            {
-            case 0: break;
-            case STROBE(TtoN): Dstack[SP] = t;             break;     /* T->N */
-            case STROBE(TtoR): Rstack[RP] = t;             break;     /* T->R */
-            case STROBE(iow): temp = writeIOmap(CELL_ADDR(t), s); /* N->io[T] */
-                if (temp) { single = temp; }   break;
-            case STROBE(memrd): Raddr = CELL_ADDR(t);              /* _MEMRD_ */
-                if (Raddr & ~(DataSize - 1)) { single = BAD_DATA_READ; }  break;
-            case STROBE(memwrs): Dwrite(s, t, 1, 2);       break;  /* N->[T]S */
-            case STROBE(memwrb): Dwrite(s, t, 0, 3);       break;  /* N->[T]B */
-            case STROBE(memwr):  Dwrite(s, t, 0, 0);       break;   /* N->[T] */
-            case STROBE(co): cy = _c;                      break;     /*   co */
-            case STROBE(TtoA): areg = t;                   break;     /* T->A */
-            case STROBE(ior): break;
-            default:
-                printf("Unknown strobe %X at %X\n", STROBE(insn) & 0x0F, pc);
-                single = BAD_ALU_OP;
-                break;
-            }
-            t = _t & CELLMASK;
-            break;
-        case INST(lit):
-            if (insn & litSign)
-                Dpush((ALL_ONES & ~0xFFF) | (insn & 0xFFF));
-            else
-                Dpush((lex << 12) | (insn & 0xFFF));
-            break;
-        case INST(trap):
-            if (insn & litSign)
-                Dpush((ALL_ONES & ~0xFFF) | (insn & 0xFFF));
-            else
-                Dpush((lex << 12) | (insn & 0xFFF));
-            Rpush(_pc);
-            _pc = TrapVector + ((insn >> 12) & 1);
-#ifdef MoreInstrumentation
-            if (verbose & VERBOSE_TRACE) {
-                printf("Trap to %Xh\n", _pc);
-            }
+// run-until runs a word the way a host program does with chadRun. The return
+// stack is put back afterwards, the data stack is left as the run left it.
+// The cell address of a watchpoint hit is reported as a byte address.
+
+SV RunUntil(void) {                     // ( xt u mask -- where code reason )
+    uint32_t mask = Dpop();
+    uint64_t budget = Dpop();
+    cell xt = Dpop();
+    uint8_t rp = RP;
+    Rpush(0);  CX->m.pc = xt;
+    struct chadStatus s = chadRun(budget, mask);
+    RP = rp;
+    cell code = (s.reason == CHAD_STOP_WATCH) ? BYTE_ADDR(s.code) : s.code;
+    Dpush(s.where);  Dpush(code & CELLMASK);  Dpush(s.reason);
+}
+
+SV Resume(void) {                       // continue after a breakpoint
+    if (!CX->resumable.valid) {
+        CX->error = BAD_NORESUME;  return;
+    }
+    CX->resumable.valid = 0;
+    memcpy(&CX->m, CX->resumable.regs, sizeof(CX->resumable.regs));
+    memcpy(CX->m.Dstack, CX->resumable.dstk, sizeof(CX->resumable.dstk));
+    memcpy(CX->m.Rstack, CX->resumable.rstk, sizeof(CX->resumable.rstk));
+    if (CX->resumable.mark == 0xFF) {   // `cold` steps off by itself
+        ColdRun();  return;
+    }
+    uint8_t mark = CX->resumable.mark;
+    int r = StepOver(mark);
+    if (r == SIM_RESELECT) r = CPUrun(0, mark);
+    if (CX->profiling) ProfileFlush();
+    if (r < 0) CX->error = r;
+}
+
+//##############################################################################
+// Multicore
+// soc-run runs a word on several cores at once, each on its own host thread.
+// Each core starts with a copy of this context's machine, flash and
+// breakpoints. A breakpoint that stops a core ends its run. A window of data
+// memory is shared by all cores and each core has an inbox in I/O space.
+// The cores run in quanta of cycles and wait for each other at a barrier.
+// The last core to get there delivers the shared memory writes and the mail
+// of the quantum to the other cores. Within a quantum, a core sees its own
+// writes to the window but not the other cores'.
+// The shared window has one port. Accesses to it by different cores in the
+// same cycle are served round robin, the cores that lose stall a cycle.
+// Stalls are worked out and charged at the barrier.
+
+#ifdef _MSC_VER
+#define SOCTHREAD               DWORD WINAPI
+#define LOCK(m)                 AcquireSRWLockExclusive(&m)
+#define UNLOCK(m)               ReleaseSRWLockExclusive(&m)
+#define WAIT(c, m)              SleepConditionVariableSRW(&c, &m, INFINITE, 0)
+#define WAKEALL(c)              WakeAllConditionVariable(&c)
+typedef SRWLOCK socLock;
+typedef CONDITION_VARIABLE socCond;
+typedef HANDLE socThread;
+#else
+#define SOCTHREAD               void*
+#define LOCK(m)                 pthread_mutex_lock(&m)
+#define UNLOCK(m)               pthread_mutex_unlock(&m)
+#define WAIT(c, m)              pthread_cond_wait(&c, &m)
+#define WAKEALL(c)              pthread_cond_broadcast(&c)
+typedef pthread_mutex_t socLock;
+typedef pthread_cond_t socCond;
+typedef pthread_t socThread;
 #endif
-            break;
-        case INST(zjump):
-            if (!Dpop()) { 
-                _pc = insn & 0x1fff; 
+
+struct Access {                         // shared window access
+    uint64_t when;                      // cycle count
+    cell addr;
+    uint32_t mask;                      // byte lanes written, 0 = read
+    cell data;
+};
+
+struct Mail {
+    uint8_t to;
+    cell x;
+};
+
+struct Core {
+    struct SoC* soc;
+    struct chadContext* cx;
+    int id;
+    uint8_t mark;                       // return stack depth that ends the run
+    int result;                         // 0 while running, else CPUsim result
+    struct Access* log;                 // shared window accesses this quantum
+    int logged;
+    struct Mail outbox[MailboxSize];    // mail sent this quantum
+    int sent;
+    cell inbox[MailboxSize];            // ring buffer of received mail
+    int head, waiting;
+    int dest;                           // destination core for mail
+    uint64_t accesses;                  // shared window accesses
+    uint64_t stalls;                    // cycles lost to contention
+    uint64_t lost;                      // mail dropped, inbox was full
+};
+
+struct SoC {
+    int cores;
+    int running;                        // threads that meet at the barrier
+    uint32_t quantum;                   // cycles between barriers
+    uint64_t until;                     // end of the current quantum
+    cell winBase, winSize;              // shared window in cells
+    int finished;                       // every core has returned
+    int arrived;                        // cores waiting at the barrier
+    uint32_t generation;                // bumped when the barrier opens
+    socLock lock;
+    socCond open;
+    struct Core core[MaxCores];
+};
+
+SV SocAccess(cell addr, uint32_t mask, cell data) {
+    struct Core* k = CX->socCore;
+    if ((cell)(addr - k->soc->winBase) >= k->soc->winSize) return;
+    if (k->logged == (int)k->soc->quantum) return;  // can't happen
+    struct Access* a = &k->log[k->logged++];
+    a->when = CX->m.cycles;  a->addr = addr;  a->mask = mask;  a->data = data;
+}
+
+// Merge the access logs in cycle order. The cores that tie for a cycle
+// take turns starting from a core that rotates with the cycle count.
+
+SV SocShare(struct SoC* soc) {
+    struct chadContext* self = CX;
+    int next[MaxCores] = { 0 };
+    while (1) {
+        uint64_t when = UINT64_MAX;
+        for (int i = 0; i < soc->cores; i++) {
+            struct Core* k = &soc->core[i];
+            if ((next[i] < k->logged) && (k->log[next[i]].when < when))
+                when = k->log[next[i]].when;
+        }
+        if (when == UINT64_MAX) break;
+        int first = (int)(when % soc->cores);
+        int served = 0;
+        for (int j = 0; j < soc->cores; j++) {
+            int i = (first + j) % soc->cores;
+            struct Core* k = &soc->core[i];
+            if ((next[i] == k->logged) || (k->log[next[i]].when != when))
+                continue;
+            struct Access* a = &k->log[next[i]++];
+            k->accesses++;
+            k->stalls += served;        // waits for the ones before it
+            CX = k->cx;
+            CX->m.cycles += served++;
+            if (a->mask == 0) continue;
+            for (int n = 0; n < soc->cores; n++) {
+                CX = soc->core[n].cx;
+                cell* p = &CX->m.Data[a->addr];
+                *p = (*p & ~a->mask) | (a->data & a->mask);
             }
-            break;
-        case INST(litx):
-            if (insn & 0x1000) {
-                if (insn & 0x800)
-                    switch (insn & 0x7FF) {
-                    case trcreg: trigregs = 1;  break;
-                    case trcon: verbose |= 12;  break;
-                    case trcoff: verbose &= ~12;  break;
-                    case trcclrd: ClearTraceData();  break;
-                    case trcdata: ShowTraceData();  break;
-                    case trcstax: ShowTraceStacks();  break;
-                    }
-                else                                            /* coproc */
-                    coprocGo(insn & 0x7FF,
-                        t& CELLMASK, s& CELLMASK, areg& CELLMASK);
+        }
+    }
+    CX = self;
+}
+
+SV SocMail(struct SoC* soc) {
+    for (int i = 0; i < soc->cores; i++) {
+        struct Core* k = &soc->core[i];
+        for (int j = 0; j < k->sent; j++) {
+            struct Core* to = &soc->core[k->outbox[j].to];
+            if (to->waiting == MailboxSize) {
+                k->lost++;
+                continue;
             }
-            else {
-                _lex = (lex << 12) | (insn & 0xFFF);            /*   litx */
+            to->inbox[(to->head + to->waiting++) % MailboxSize] = k->outbox[j].x;
+        }
+        k->sent = 0;
+    }
+}
+
+SI SocBarrier(struct SoC* soc) {        // the last core in syncs the rest
+    LOCK(soc->lock);
+    uint32_t generation = soc->generation;
+    if (++soc->arrived == soc->running) {
+        SocShare(soc);
+        SocMail(soc);
+        soc->finished = 1;
+        for (int i = 0; i < soc->cores; i++) {
+            struct Core* k = &soc->core[i];
+            k->logged = 0;
+            if (k->result == 0) soc->finished = 0;
+        }
+        if (soc->running < soc->cores) soc->finished = 1;
+        soc->until += soc->quantum;
+        soc->arrived = 0;
+        soc->generation++;
+        WAKEALL(soc->open);
+    }
+    else {
+        while (generation == soc->generation)
+            WAIT(soc->open, soc->lock);
+    }
+    int finished = soc->finished;       // stays put until this core is back
+    UNLOCK(soc->lock);
+    return finished;
+}
+
+static SOCTHREAD SocThread(void* arg) {
+    struct Core* k = arg;
+    struct SoC* soc = k->soc;
+    chad_select(k->cx);
+    do {
+        if (k->result == 0) {
+            chadSchedule(EVENT_PAUSE, soc->until, PauseEvent);
+            int r = CPUrun(0, k->mark);
+            CX->pausing = 0;
+            if (r != SIM_PAUSED) {      // returned or failed
+                k->result = r;
+                chadCancel(EVENT_PAUSE);
             }
-            break;
-        case INST(jump):
-            _pc = insn & 0x1fff;  
-            break;
-        case INST(call):
-            Rpush(_pc);
-            _pc = insn & 0x1fff;
-#ifdef MoreInstrumentation
-                if (verbose & VERBOSE_TRACE) {
-                    printf("Call to %Xh\n", _pc);
-                }
-#endif
-            break;
         }
-        pc = _pc;  lex = _lex;
-        cycles++;
-        if ((cycles & CELLMASK) == 0) { // raw counter overflow
-            irq |= (1 << 1);            // lowest priority interrupt
-        }
-        if (pc & ~(CodeSize-1)) single = BAD_PC;
-        if (rp == RPMASK) single = BAD_RSTACKUNDER;
-        if (sp == SPMASK) single = BAD_STACKUNDER;
-        if (rp == RPMASK - 1) single = BAD_RSTACKOVER;
-        if (sp == SPMASK - 1) single = BAD_STACKOVER;
-#ifdef MoreInstrumentation
-        if (sp > spMax) {
-            spMax = sp;
-            NewMaxStack(sp, rpMax, pc);
-        }
-        if (rp > rpMax) {
-            rpMax = rp;
-            NewMaxStack(spMax, rp, pc);
-        }
-        if (verbose & VERBOSE_TRACE) {
-            if (exception)
-                printf("Exception at %Xh, R=%Xh, page=%Xh\n",
-                    pc, Rstack[RP], Rstack[(RP - 1) & RPMASK]);
-            if (interruptVector)
-                printf("Interrupt Level %d\n", pc);
+    } while (!SocBarrier(soc));
+    return 0;
+}
+
+SV SocWindow(void) {                    // ( a-addr u -- )
+    cell u = CELL_ADDR(Dpop());
+    cell a = CELL_ADDR(Dpop());
+    if ((a + u) > DataSize)
+        CX->error = BAD_DATA_WRITE;
+    else {
+        CX->socBase = a;  CX->socSize = u;
+    }
+}
+
+SV SocRun(void) {                       // ( xt n quantum -- )
+    uint32_t quantum = Dpop();
+    int n = Dpop();
+    cell xt = Dpop();
+    if ((n < 1) || (n > MaxCores) || (quantum == 0)) {
+        CX->error = BAD_UNSUPPORTED;  return;
+    }
+    struct SoC* soc = calloc(1, sizeof(struct SoC));
+    if (soc == NULL) {
+        CX->error = BAD_UNSUPPORTED;  return;
+    }
+    struct chadContext* parent = CX;
+    int eng = CX->engine;
+    uint32_t fusions = CX->fusionMask;
+    soc->cores = soc->running = n;
+    soc->quantum = quantum;
+    soc->until = quantum;
+    soc->winBase = CX->socBase;
+    soc->winSize = CX->socSize;
+    for (int i = 0; i < n; i++) {
+        struct Core* k = &soc->core[i];
+        k->soc = soc;
+        k->id = i;
+        k->cx = chad_new();
+        k->log = malloc(quantum * sizeof(struct Access));
+        if ((k->cx == NULL) || (k->log == NULL)) {
+            CX->error = BAD_UNSUPPORTED;  goto cleanup;
         }
+        k->cx->m = parent->m;           // a copy of this machine
+        k->cx->io = parent->io;
+        k->cx->gecko = parent->gecko;
+        k->cx->flash = parent->flash;
+        memcpy(k->cx->Breakpoints, parent->Breakpoints, CodeSize);
+        memcpy(k->cx->BreakIf, parent->BreakIf, sizeof(parent->BreakIf));
+        k->cx->breakpoints = parent->breakpoints;
+        chad_select(k->cx);             // ( core -- ) xt
+        CX->engine = eng;
+        CX->fusionMask = fusions;
+        CX->socCore = k;
+        CX->m.sp = CX->m.rp = 0;
+        ResetCycles();
+        Dpush(i);  Rpush(0);  CX->m.pc = xt;
+        k->mark = RDEPTH;
+    }
+    chad_select(parent);
+#ifdef _MSC_VER
+    InitializeSRWLock(&soc->lock);
+    InitializeConditionVariable(&soc->open);
+#else
+    pthread_mutex_init(&soc->lock, NULL);
+    pthread_cond_init(&soc->open, NULL);
+#endif
+    socThread threads[MaxCores];
+    uint64_t time0 = GetMicroseconds();
+    int started = 0;
+    LOCK(soc->lock);                    // hold the barrier until all start
+    for (; started < n; started++) {
+#ifdef _MSC_VER
+        threads[started] = CreateThread(NULL, 0, SocThread,
+            &soc->core[started], 0, NULL);
+        if (threads[started] == NULL) break;
+#else
+        if (pthread_create(&threads[started], NULL, SocThread,
+            &soc->core[started])) break;
+#endif
+    }
+    soc->running = started;             // the ones that started finish
+    UNLOCK(soc->lock);
+    for (int i = 0; i < started; i++) {
+#ifdef _MSC_VER
+        WaitForSingleObject(threads[i], INFINITE);
+        CloseHandle(threads[i]);
+#else
+        pthread_join(threads[i], NULL);
+#endif
+    }
+    uint64_t us = GetMicroseconds() - time0;
+#ifndef _MSC_VER
+    pthread_mutex_destroy(&soc->lock);
+    pthread_cond_destroy(&soc->open);
 #endif
-    } while (single == 0);
-    return single;
+    if (started < n) {
+        CX->error = BAD_THREAD;  goto cleanup;
+    }
+    uint64_t total = 0, longest = 0;
+    for (int i = 0; i < n; i++) {
+        struct Core* k = &soc->core[i];
+        CX = k->cx;
+        uint64_t c = CX->m.cycles;
+        CX = parent;
+        printf("core %d: %" PRId64 " cycles, %" PRId64 " shared, %" PRId64
+            " stalls", i, c, k->accesses, k->stalls);
+        if (k->lost) printf(", %" PRId64 " mail lost", k->lost);
+        if (k->result != 2) printf(", error %d", k->result);
+        printf("\n");
+        total += c;
+        if (c > longest) longest = c;
+    }
+    printf("%d cores, %" PRId64 " cycles, %" PRId64 " longest", n, total,
+        longest);
+    if (us > 99) printf(", %" PRId64 " MIPS", total / us);
+    printf("\n");
+    CX = soc->core[0].cx;               // keep the shared window
+    cell* shared = &CX->m.Data[soc->winBase];
+    CX = parent;
+    memcpy(&CX->m.Data[soc->winBase], shared, soc->winSize * sizeof(cell));
+cleanup:
+    chad_select(parent);
+    for (int i = 0; i < n; i++) {
+        chad_free(soc->core[i].cx);
+        free(soc->core[i].log);
+    }
+    free(soc);
 }
 
-SV Simulate(cell xt) {
-    latency = 0;                        // reset latency measurement
-    Rpush(0);  pc = xt;
-    int result = CPUsim(0);             // run until last RET or error
-    if (result < 0) error = result;
+// I/O space access to the mailboxes, see iomap.c
+
+int chadCoreID(void) {
+    return (CX->socCore) ? CX->socCore->id : 0;
+}
+
+int chadCores(void) {
+    return (CX->socCore) ? CX->socCore->soc->cores : 1;
+}
+
+void chadMailTo(int core) {
+    if (CX->socCore == NULL) return;
+    if ((unsigned)core < (unsigned)CX->socCore->soc->cores)
+        CX->socCore->dest = core;
+}
+
+void chadMailSend(uint32_t x) {
+    struct Core* k = CX->socCore;
+    if (k == NULL) return;
+    if (k->sent == MailboxSize) {
+        k->lost++;  return;
+    }
+    k->outbox[k->sent].to = k->dest;
+    k->outbox[k->sent++].x = (cell)x;
+}
+
+int chadMailWaiting(void) {
+    return (CX->socCore) ? CX->socCore->waiting : 0;
+}
+
+uint32_t chadMailReceive(void) {
+    struct Core* k = CX->socCore;
+    if ((k == NULL) || (k->waiting == 0)) return 0;
+    cell x = k->inbox[k->head];
+    k->head = (k->head + 1) % MailboxSize;
+    k->waiting--;
+    return x;
 }
 
 //##############################################################################
-// Compiler
+// Execution trace file
+// logsteps records each step in SIM_FILENAME for comparing with the HDL
+// simulation. The file is compact: a step is a flags byte followed by only
+// what changed. The PC is sent as a distance from the next address when it
+// isn't that, the instruction is sent when it differs from the last one
+// seen at that address, and T, N and R are sent as zigzag varint
+// differences. trace-dump turns it back into the text that `chad.v` logs.
+// Steps are packed into one buffer while the other is being written. With
+// TRACE_THREAD, a helper thread does the writing.
+
+#define TraceBufSize 0x10000            // bytes per buffer
+#define TraceMaxStep 32                 // longest step record
+
+#define TR_JUMP   1                     // PC delta follows
+#define TR_INSN   2                     // instruction follows
+#define TR_T      4                     // T delta follows
+#define TR_N      8
+#define TR_R     16
+#define TR_SP    32                     // new SP follows
+#define TR_RP    64
+
+static const char TraceMagic[8] = "CHADTRC";
+
+struct TraceState {                     // what the next step is relative to
+    uint32_t addr;
+    cell tos, nos, tor;
+    uint8_t dsp, rsp;
+    uint16_t Insn[CodeSize];            // last instruction at each address
+};
+
+struct TraceLog {
+    FILE* fp;
+    uint8_t bytes[2][TraceBufSize];     // filled alternately
+    int cur;                            // the one being filled
+    int fill;                           // bytes in it
+    struct TraceState s;
+#ifdef TRACE_THREAD
+    socThread writer;
+    socLock lock;
+    socCond ready;                      // `pending` changed
+    int pending;                        // bytes of the other buffer to write,
+                                        // -1 = done
+#endif
+};
+
+static uint8_t* PutVarint(uint8_t* p, uint32_t x) {
+    while (x > 0x7F) {
+        *p++ = (uint8_t)(x | 0x80);
+        x >>= 7;
+    }
+    *p++ = (uint8_t)x;
+    return p;
+}
+
+static uint32_t Zigzag(cell x, cell y) { // x - y as a signed cell
+    int32_t d = (int32_t)((x - y) << (32 - CELLBITS)) >> (32 - CELLBITS);
+    return ((uint32_t)d << 1) ^ (uint32_t)(d >> 31);
+}
+
+static cell Unzigzag(cell y, uint32_t z) {
+    int32_t d = (int32_t)(z >> 1) ^ -(int32_t)(z & 1);
+    return (y + d) & CELLMASK;
+}
+
+#ifdef TRACE_THREAD
+static SOCTHREAD TraceWriter(void* arg) {
+    struct TraceLog* L = arg;
+    LOCK(L->lock);
+    while (1) {
+        while (L->pending == 0)
+            WAIT(L->ready, L->lock);
+        if (L->pending < 0) break;
+        UNLOCK(L->lock);
+        fwrite(L->bytes[L->cur ^ 1], 1, L->pending, L->fp);
+        LOCK(L->lock);
+        L->pending = 0;
+        WAKEALL(L->ready);
+    }
+    UNLOCK(L->lock);
+    return 0;
+}
+#endif
+
+SV TraceFlush(struct TraceLog* L) {
+    if (L->fill == 0) return;
+#ifdef TRACE_THREAD
+    LOCK(L->lock);
+    while (L->pending)                  // the other buffer is still busy
+        WAIT(L->ready, L->lock);
+    L->pending = L->fill;
+    L->cur ^= 1;
+    WAKEALL(L->ready);
+    UNLOCK(L->lock);
+#else
+    fwrite(L->bytes[L->cur], 1, L->fill, L->fp);
+#endif
+    L->fill = 0;
+}
+
+SV TraceOpen(void) {
+    struct TraceLog* L = calloc(1, sizeof(struct TraceLog));
+    if (L != NULL)
+        L->fp = fopenx(SIM_FILENAME, "wb");
+    if ((L == NULL) || (L->fp == NULL)) {
+        free(L);
+        CX->logging = 0;
+        CX->error = BAD_CREATEFILE;
+        return;
+    }
+    fwrite(TraceMagic, 1, sizeof(TraceMagic), L->fp);
+    fputc(CELLBITS, L->fp);
+    L->s.addr = (uint32_t)-1;           // so PC 0 follows it
+#ifdef TRACE_THREAD
+#ifdef _MSC_VER
+    InitializeSRWLock(&L->lock);
+    InitializeConditionVariable(&L->ready);
+    L->writer = CreateThread(NULL, 0, TraceWriter, L, 0, NULL);
+#else
+    pthread_mutex_init(&L->lock, NULL);
+    pthread_cond_init(&L->ready, NULL);
+    pthread_create(&L->writer, NULL, TraceWriter, L);
+#endif
+#endif
+    CX->tracelog = L;
+}
+
+SV TraceClose(void) {
+    struct TraceLog* L = CX->tracelog;
+    if (L == NULL) return;
+    TraceFlush(L);
+#ifdef TRACE_THREAD
+    LOCK(L->lock);
+    while (L->pending)
+        WAIT(L->ready, L->lock);
+    L->pending = -1;
+    WAKEALL(L->ready);
+    UNLOCK(L->lock);
+#ifdef _MSC_VER
+    WaitForSingleObject(L->writer, INFINITE);
+    CloseHandle(L->writer);
+#else
+    pthread_join(L->writer, NULL);
+    pthread_mutex_destroy(&L->lock);
+    pthread_cond_destroy(&L->ready);
+#endif
+#endif
+    fclose(L->fp);
+    free(L);
+    CX->tracelog = NULL;
+}
+
+SV TraceStep(uint16_t insn) {           // log the step about to run
+    struct TraceLog* L = CX->tracelog;
+    if (L == NULL) {
+        TraceOpen();
+        if ((L = CX->tracelog) == NULL) return;
+    }
+    if (L->fill > (TraceBufSize - TraceMaxStep))
+        TraceFlush(L);
+    struct TraceState* s = &L->s;
+    uint8_t* start = &L->bytes[L->cur][L->fill];
+    uint8_t* p = start + 1;
+    uint8_t flags = 0;
+    if (CX->m.pc != (s->addr + 1)) {
+        flags |= TR_JUMP;
+        p = PutVarint(p, Zigzag(CX->m.pc, s->addr + 1));
+    }
+    s->addr = CX->m.pc;
+    if (insn != s->Insn[CX->m.pc & (CodeSize - 1)]) {
+        flags |= TR_INSN;
+        *p++ = (uint8_t)insn;
+        *p++ = (uint8_t)(insn >> 8);
+        s->Insn[CX->m.pc & (CodeSize - 1)] = insn;
+    }
+    if (CX->m.t != s->tos) {
+        flags |= TR_T;
+        p = PutVarint(p, Zigzag(CX->m.t, s->tos));
+        s->tos = CX->m.t;
+    }
+    if (CX->m.Dstack[SP] != s->nos) {
+        flags |= TR_N;
+        p = PutVarint(p, Zigzag(CX->m.Dstack[SP], s->nos));
+        s->nos = CX->m.Dstack[SP];
+    }
+    if (CX->m.Rstack[RP] != s->tor) {
+        flags |= TR_R;
+        p = PutVarint(p, Zigzag(CX->m.Rstack[RP], s->tor));
+        s->tor = CX->m.Rstack[RP];
+    }
+    if (CX->m.sp != s->dsp) {
+        flags |= TR_SP;
+        *p++ = s->dsp = CX->m.sp;
+    }
+    if (CX->m.rp != s->rsp) {
+        flags |= TR_RP;
+        *p++ = s->rsp = CX->m.rp;
+    }
+    *start = flags;
+    L->fill = (int)(p - L->bytes[L->cur]);
+}
 
-CELL latest = 0;                        // latest writable code word
-SI notail = 0;                          // tail recursion inhibited for call
+static uint32_t GetVarint(FILE* fp) {
+    uint32_t x = 0;
+    int shift = 0, c;
+    do {
+        c = fgetc(fp);
+        if (c == EOF) return 0;
+        x |= (uint32_t)(c & 0x7F) << shift;
+        shift += 7;
+    } while ((c & 0x80) && (shift < 35));
+    return x;
+}
+
+// Decode a trace file to the text format of ShowRegs. Returns the number of
+// steps or an error code.
+
+static int64_t TraceDecode(char* infile, char* outfile) {
+    FILE* fp = fopenx(infile, "rb");
+    if (fp == NULL) return BAD_OPENFILE;
+    char magic[sizeof(TraceMagic)];
+    if ((fread(magic, 1, sizeof(magic), fp) != sizeof(magic))
+        || memcmp(magic, TraceMagic, sizeof(magic))
+        || (fgetc(fp) != CELLBITS)) {
+        fclose(fp);
+        return BAD_TRACEFILE;
+    }
+    FILE* ofp = fopenx(outfile, "w");
+    if (ofp == NULL) {
+        fclose(fp);
+        return BAD_CREATEFILE;
+    }
+    struct TraceState* s = calloc(1, sizeof(struct TraceState));
+    if (s == NULL) {
+        fclose(ofp);  fclose(fp);
+        return BAD_ALLOCATE;
+    }
+    int64_t steps = 0;
+    int flags;
+    s->addr = (uint32_t)-1;
+    while ((flags = fgetc(fp)) != EOF) {
+        uint32_t next = s->addr + 1;
+        s->addr = (flags & TR_JUMP) ? Unzigzag(next, GetVarint(fp)) : next;
+        uint16_t* insn = &s->Insn[s->addr & (CodeSize - 1)];
+        if (flags & TR_INSN) {
+            *insn = (uint16_t)fgetc(fp);
+            *insn |= (uint16_t)(fgetc(fp) << 8);
+        }
+        if (flags & TR_T) s->tos = Unzigzag(s->tos, GetVarint(fp));
+        if (flags & TR_N) s->nos = Unzigzag(s->nos, GetVarint(fp));
+        if (flags & TR_R) s->tor = Unzigzag(s->tor, GetVarint(fp));
+        if (flags & TR_SP) s->dsp = (uint8_t)fgetc(fp);
+        if (flags & TR_RP) s->rsp = (uint8_t)fgetc(fp);
+        fprintf(ofp, REGS_FORMAT, s->addr, *insn, s->tos, s->nos, s->tor,
+            s->dsp, s->rsp);
+        steps++;
+    }
+    free(s);
+    fclose(ofp);
+    fclose(fp);
+    return steps;
+}
+
+//##############################################################################
+// Compiler
 
 SV toCode (cell x) {                    // compile to code space
     chadToCode(CP++, x);
 }
 SV CompExit (void) {                    // compile an exit
-    if (latest == CP)                   // code run is empty
+    if (CX->latest == CP)               // code run is empty
         goto plain;                     // nothing to optimize
     int a = (CP-1) & (CodeSize-1);
-    int old = Code[a];                  // previous instruction
+    int old = CX->m.Code[a];            // previous instruction
     if (((old & 0xC000) == 0) && (!(old & rdn))) { // ALU doesn't change rp?
-        Code[a] = old | ret;            // make the ALU instruction return
-    } else if ((!notail) && ((old & 0xE000) == call)) {
-        Code[a] = (old & 0x1FFF) | jump; // tail recursion (call -> jump)
+        chadToCode(a, old | ret);       // make the ALU instruction return
+    } else if ((!CX->noTail) && ((old & 0xE000) == call)) {
+        chadToCode(a, (old & 0x1FFF) | jump); // tail recursion (call -> jump)
     } else {
 plain:  toCode(alu0 | ret );              // compile a stand-alone return
     }
@@ -548,28 +1891,35 @@ SV Calign(void) {
 SV extended_lit (int k) {
     toCode(litx | (k & 0xFFF));
 }
-SV Literal (cell x) {
+SI LitCode (cell x, uint16_t* insn) {   // code that pushes x, returns length
     cell n = (x & MSB) ? ((1 + ~x) & CELLMASK) : x;  // n = |x|
     cell sign = (x & MSB) ? litSign : 0;
+    int len = 0;
     if (n & ~0xFFF) {                   // large unsigned literal
 #if (CELLBITS > 24)
         if (x & 0xFF000000) {
-            extended_lit(x >> 24);
-            extended_lit(x >> 12);
+            insn[len++] = litx | ((x >> 24) & 0xFFF);
+            insn[len++] = litx | ((x >> 12) & 0xFFF);
         }
         else {
             if (x & 0x0FFF000)
-                extended_lit(x >> 12);
+                insn[len++] = litx | ((x >> 12) & 0xFFF);
         }
 #else
         if (x & 0x0FFF000)
-            extended_lit(x >> 12);
+            insn[len++] = litx | ((x >> 12) & 0xFFF);
 #endif
-        toCode(lit | (x & 0xFFF));
+        insn[len++] = lit | (x & 0xFFF);
     }
     else {                              // small signed literal
-        toCode(lit | sign | (x & 0xFFF));
+        insn[len++] = lit | sign | (x & 0xFFF);
     }
+    return len;
+}
+SV Literal (cell x) {
+    uint16_t insn[3];
+    int len = LitCode(x, insn);
+    for (int i = 0; i < len; i++) toCode(insn[i]);
 }
 
 #ifdef HASFLOATS
@@ -578,17 +1928,15 @@ SV Literal (cell x) {
 // to 64 bits. Usually it's somewhere in between. The MSB is the sign, the
 // exponent has a programmable number of bits, and the mantissa is the rest.
 
-static int FPexpbits = 8;
-
 SV fdot(void) {                         // ( d -- )
     uint64_t d = (uint64_t)Dpop() << CELLBITS;   d += Dpop();
-    int manbits = 2 * CELLBITS - 1 - FPexpbits;
+    int manbits = 2 * CELLBITS - 1 - CX->FPexpbits;
     if (d & ((uint64_t)1 << (2 * CELLBITS - 1)))  printf("-");
     d &= ~((uint64_t)-1 << (2 * CELLBITS - 1));  // strip off sign
     if (d == 0) {                       // either +0 or -0
         printf("0. ");  return;
     }
-    int64_t exp = (d >> manbits) - ((uint64_t)1 << (FPexpbits - 1));
+    int64_t exp = (d >> manbits) - ((uint64_t)1 << (CX->FPexpbits - 1));
     d &= ~((uint64_t)-1 << manbits);
     d += (uint64_t)1 << manbits;
     int digits = (int)(2.0 * logf((float)manbits) / logf(2.0));
@@ -606,8 +1954,8 @@ static uint64_t FPtoDouble(double x) {
     if (x == 0) return r;
     if (x < 0) r += ((uint64_t)1 << (2 * CELLBITS - 1));
     uint64_t i = pack754_64(fabs(x));
-    int manbits = 2 * CELLBITS - 1 - FPexpbits;
-    uint64_t exp = (i >> 52) + ((uint64_t)1 << (FPexpbits - 1)) - 1023;
+    int manbits = 2 * CELLBITS - 1 - CX->FPexpbits;
+    uint64_t exp = (i >> 52) + ((uint64_t)1 << (CX->FPexpbits - 1)) - 1023;
     r += exp << manbits;
     return r + ((i & 0xFFFFFFFFFFFFF) >> (52 - manbits));
 }
@@ -645,25 +1993,28 @@ SI aligned(int n) {
 
 // Compile Control Structures
 
-CELL CtrlStack[256];                    // control stack
-static uint8_t ConSP = 0;
-
 SV ControlSwap(void) {
-    cell x = CtrlStack[ConSP];
-    CtrlStack[ConSP] = CtrlStack[ConSP - 1];
-    CtrlStack[ConSP - 1] = x;
+    cell x = CX->CtrlStack[CX->ConSP];
+    CX->CtrlStack[CX->ConSP] = CX->CtrlStack[CX->ConSP - 1];
+    CX->CtrlStack[CX->ConSP - 1] = x;
 }
 SV sane(void) {
-    if (ConSP)  error = BAD_CONTROL;
-    ConSP = 0;
+    if (CX->ConSP)  CX->error = BAD_CONTROL;
+    CX->ConSP = 0;  CX->loops = 0;
 }
 
 // Addressing beyond 1FFFh is not supported yet.
 
-SV ResolveFwd(void) { Code[CtrlStack[ConSP--]] |= CP;  latest = CP; }
-SV ResolveRev(int inst) { toCode(CtrlStack[ConSP--] | inst);  latest = CP; }
-SV MarkFwd(void) { Calign();  CtrlStack[++ConSP] = CP; }
-SV doBegin(void) { MarkFwd(); }
+SV ResolveFwd(void) {
+    cell a = CX->CtrlStack[CX->ConSP--];
+    chadToCode(a, CX->m.Code[a & (CodeSize - 1)] | CP);  CX->latest = CP;
+}
+SV ResolveRev(int inst) {
+    toCode(CX->CtrlStack[CX->ConSP--] | inst);  CX->latest = CP;
+    if (CX->loops) CX->loops--;
+}
+SV MarkFwd(void) { Calign();  CX->CtrlStack[++CX->ConSP] = CP; }
+SV doBegin(void) { MarkFwd();  CX->loops++; }
 SV doAgain(void) { ResolveRev(jump); }
 SV doUntil(void) { ResolveRev(zjump); }
 SV doIf(void) { MarkFwd();  toCode(zjump); }
@@ -671,47 +2022,42 @@ SV doThen(void) { ResolveFwd(); }
 SV doElse(void) { MarkFwd();  toCode(jump);  ControlSwap();  ResolveFwd(); }
 SV doWhile(void) { doIf();  ControlSwap(); }
 SV doRepeat(void) { doAgain();  doThen(); }
-SV doFor(void) { toCode(alu0 | NtoT | TtoR | sdn | rup);  MarkFwd(); }
-SV noCompile(void) { error = BAD_NOCOMPILE; }
-SV noExecute(void) { error = BAD_NOEXECUTE; }
+SV doFor(void) {
+    toCode(alu0 | NtoT | TtoR | sdn | rup);  MarkFwd();  CX->loops++;
+}
+SV noCompile(void) { CX->error = BAD_NOCOMPILE; }
+SV noExecute(void) { CX->error = BAD_NOEXECUTE; }
 
 SV doNext(void) {
     toCode(alu0 | RM1toT | TtoN | sup);  /* (R-1)@ */
     toCode(alu0 | zeq | TtoR);  ResolveRev(zjump);
-    toCode(alu0 | rdn);  latest = CP;    /* rdrop */
+    toCode(alu0 | rdn);  CX->latest = CP; /* rdrop */
 }
 
 SV CoprocInst(void) {
     int sel = Dpop();
-    if (sel > 0x3FF) error = BAD_COPROCESSOR;
+    if (sel > 0x3FF) CX->error = BAD_COPROCESSOR;
     toCode(copop | sel);
 }
 
 // HTML output is a kind of log file of token handling. It's a browsable
 // version of the source text with links to reference documents.
 
-SI fileID = 0;                          // cumulative file ID
-struct FileRec FileStack[MaxFiles];
-struct FilePath FilePaths[MaxFilePaths];
-SI filedepth = 0;                       // file stack
-static uint32_t logcolor = 0;
-static int leadingblanks = 0;
-
 SV LogR(char* s) {                      // raw text to HTML file
     FILE* fp = File.hfp;
-    if (fp) fprintf(fp, "%s", s);
+    if ((fp) && (s)) fprintf(fp, "%s", s);
 }
 
 SV FlushBlanks(void) {
-    switch (leadingblanks) {
+    switch (CX->leadingblanks) {
     case 0: break;
     case 1: LogR(" "); break;
     default:
-        while (--leadingblanks)
+        while (--CX->leadingblanks)
             LogR(" ");
         LogR("&nbsp;");
     }
-    leadingblanks = 0;
+    CX->leadingblanks = 0;
 }
 
 SV LogChar(char c) {
@@ -724,62 +2070,519 @@ SV LogChar(char c) {
         case '<':  fprintf(fp, "&lt;");    break;
         case '>':  fprintf(fp, "&gt;");    break;
         case '&':  fprintf(fp, "&amp;");   break;
-        case ' ':  leadingblanks++;        break;
+        case ' ':  CX->leadingblanks++;    break;
         default:   fprintf(fp, "%c", c);
         }
     }
 }
 
-SV Log(char* s) {
-    char c;
-    while ((c = *s++)) LogChar(c);
-}
+SV Log(char* s) {
+    char c;
+    while ((c = *s++)) LogChar(c);
+}
+
+SV LogBegin(char* title) {
+    LogR("<!DOCTYPE html>\n<html lang=\"en\">\n<head>\n");
+    LogR("<meta charset=\"utf-8\">\n<title>");
+    LogR(title);
+    LogR("</title>\n<link rel=\"stylesheet\" href=\"doc.css\">\n");
+    LogR("</head>\n<body>\n<h1>");
+    LogR(title);
+    LogR("</h1>\n<pre class=\"forth\">\n<font color=black>\n");
+    LogR("<hr>\n");
+}
+
+SV LogEnd(void) {
+    LogR("\n</pre>\n</body>\n</html>\n");
+}
+
+// A strncpy that complies with C safety checks.
+
+void strmove(char* dest, char* src, int size) {
+    for (int i = 0; i < size; i++) {
+        char c = *src++;  *dest++ = c;
+        if (c == 0) return;             // up to and including the terminator
+    }
+    *--dest = 0;                        // max reached, add terminator
+}
+
+//##############################################################################
+// Optimizer
+// `optimize` selects passes that rewrite a definition at `;`, before its exit
+// is compiled. A pass only looks at the new definition. The jumps into it
+// come from its own control structures, so they are the addresses to fix up
+// when instructions are removed. Explicit nops stay, they are usually there
+// for I/O timing.
+
+// Instructions run on a symbolic stack, where each item is an expression of
+// the inputs and the literals. The carry, A, the return stack and memory
+// aren't modeled, so only the ALU selects in SymOps with no strobe other
+// than T->N take part. Stack memory above the top is a new SYM_JUNK each time
+// it's read, equal only to itself, so a rewrite of code that reads it never
+// matches.
+
+#define SYM_IN    0x40                  // an input, k is its depth
+#define SYM_CONST 0x41                  // a literal, k is its value
+#define SYM_JUNK  0x42                  // stack memory above the top
+#define SymMax    256
+
+struct Sym {
+    int op;                             // ALU select or SYM_
+    int a, b;                           // operands
+    cell k;
+};
+
+struct SymState {                       // expressions of a rewrite and its
+    struct Sym sym[SymMax];             // candidates, each one only once
+    int syms;
+};
+
+static const uint8_t SymOps[] = {
+    OPCODE(T), OPCODE(NtoT), OPCODE(add), OPCODE(eor), OPCODE(Tand),
+    OPCODE(com), OPCODE(zeq), OPCODE(less0), OPCODE(swapb), OPCODE(swapw),
+    OPCODE(shl1), OPCODE(shr1)
+};
+
+SI SymBinary(int op) {
+    return (op == OPCODE(add)) || (op == OPCODE(eor)) || (op == OPCODE(Tand));
+}
+
+// Constants are folded by the simulator, one instruction with T and N set.
+// Events are held off and the machine is put back.
+
+CELL SymEval(int op, cell a, cell b) {
+    uint8_t regs[sizeof(CX->resumable.regs)];
+    cell dstk[StackSize];
+    memcpy(regs, &CX->m, sizeof(regs));
+    memcpy(dstk, CX->m.Dstack, sizeof(dstk));
+    uint64_t c0 = CX->m.cycles, next = CX->m.nextEvent;
+    CX->m.nextEvent = UINT64_MAX;
+    Dpush(b);  Dpush(a);
+    CPUsim(0x10000 + (op << 8));
+    cell x = CX->m.t;
+    memcpy(&CX->m, regs, sizeof(regs));
+    memcpy(CX->m.Dstack, dstk, sizeof(dstk));
+    CX->m.cycles = c0;  CX->m.nextEvent = next;
+    return x;
+}
+
+static int SymAdd(struct SymState* x, int op, int a, int b, cell k) {
+    if (x->syms == SymMax) return -1;
+    struct Sym* s = &x->sym[x->syms];
+    s->op = op;  s->a = a;  s->b = b;  s->k = k;
+    return x->syms++;
+}
+
+static int SymConst(struct SymState* x, int i, cell k) {
+    return (i >= 0) && (x->sym[i].op == SYM_CONST) && (x->sym[i].k == k);
+}
+
+static int SymNode(struct SymState* x, int op, int a, int b, cell k) {
+    if ((a < 0) || (b < 0)) return -1;
+    if ((op < SYM_IN) && (x->sym[a].op == SYM_CONST)
+        && (!SymBinary(op) || (x->sym[b].op == SYM_CONST)))
+        return SymNode(x, SYM_CONST, 0, 0,
+            SymEval(op, x->sym[a].k, x->sym[b].k));
+    switch (op) {                       // simplify
+    case OPCODE(add):
+    case OPCODE(eor):
+    case OPCODE(Tand):
+        if (a > b) { int c = a;  a = b;  b = c; }
+        if (op == OPCODE(Tand)) {
+            if (a == b) return a;
+            if (SymConst(x, a, CELLMASK)) return b;
+            if (SymConst(x, b, CELLMASK)) return a;
+        } else {
+            if (SymConst(x, a, 0)) return b;
+            if (SymConst(x, b, 0)) return a;
+            if ((op == OPCODE(eor)) && (a == b))
+                return SymNode(x, SYM_CONST, 0, 0, 0);
+        }
+        break;
+    case OPCODE(com):
+        if (x->sym[a].op == OPCODE(com)) return x->sym[a].a;
+        break;
+    default: break;
+    }
+    for (int i = 0; i < x->syms; i++) {
+        struct Sym* s = &x->sym[i];
+        if ((s->op == op) && (s->a == a) && (s->b == b) && (s->k == k))
+            return i;
+    }
+    return SymAdd(x, op, a, b, k);
+}
+
+SI SymSimple(uint16_t insn) {           // ALU instruction for SymStep
+    if ((insn & 0xE000) || (insn == 0)) return 0;   // ALU, not a nop
+    if ((STROBE(insn) & 0x0F) > STROBE(TtoN)) return 0;
+    if ((insn & rdn) || ((insn & 3) == 2)) return 0;
+    return memchr(SymOps, OPCODE(insn) & 0x1F, sizeof(SymOps)) != NULL;
+}
+
+// The stack is st[], T is st[n-1]. Inputs go deep enough for two steps.
+
+static int SymStep(struct SymState* x, int* st, int* n, uint16_t insn) {
+    int op = OPCODE(insn) & 0x1F;
+    int tv = st[*n - 1], nv = st[*n - 2], r;
+    switch (op) {
+    case OPCODE(T):    r = tv;  break;
+    case OPCODE(NtoT): r = nv;  break;
+    default:
+        r = SymNode(x, op, tv, (SymBinary(op)) ? nv : 0, 0);
+    }
+    int ds = sign2b[insn & 3];
+    if (ds > 0) {
+        st[*n - 1] = SymAdd(x, SYM_JUNK, 0, 0, 0);
+        (*n)++;
+    }
+    if (ds < 0) (*n)--;
+    if ((STROBE(insn) & 0x0F) == STROBE(TtoN)) st[*n - 2] = tv;
+    st[*n - 1] = r;
+    return (r >= 0) && (st[*n - 2] >= 0);
+}
+
+SV SymPush(struct SymState* x, int* st, int* n, cell k) {
+    st[(*n)++] = SymNode(x, SYM_CONST, 0, 0, k);
+}
+
+SV SymBegin(struct SymState* x, int* in, int* st) {
+    x->syms = 0;
+    for (int i = 0; i < 4; i++)
+        in[i] = st[i] = SymNode(x, SYM_IN, 0, 0, 3 - i);
+}
+
+static int SymSame(int* want, int n, int* got, int m) {
+    if (n != m) return 0;
+    for (int i = 0; i < n; i++)
+        if (want[i] != got[i]) return 0;
+    return 1;
+}
+
+// Rewrites are made at the end of out[] as instructions are added to it, so
+// a replacement can combine with what's before it. A replacement stays where
+// the first instruction it replaced was, so only that one may be a jump
+// target. If it's empty, the jumps land on the next instruction.
+
+struct Rewriter {
+    uint16_t out[CodeSize];
+    uint8_t is[CodeSize];               // out[] is a jump target
+    int n;
+    uint8_t landing;                    // a removed target lands here
+};
+
+static THREAD_LOCAL struct Rewriter RW;
+
+SI RewriteFree(int from) {              // no targets after out[from]
+    for (int i = from + 1; i < RW.n; i++)
+        if (RW.is[i]) return 0;
+    return 1;
+}
+
+SV Rewrite(int from, uint16_t* insn, int len) {
+    uint8_t is = RW.is[from];
+    RW.n = from;
+    for (int i = 0; i < len; i++) {
+        RW.is[RW.n] = (i) ? 0 : is;
+        RW.out[RW.n++] = insn[i];
+    }
+    if (len == 0) RW.landing |= is;
+}
+
+// The peephole pass looks for one ALU instruction, or none, that leaves the
+// stack the same as the last two instructions. The first may be a literal.
+// A return on the second is kept.
+
+SI PeepPair(uint16_t a, uint16_t b, uint16_t* out) {
+    static THREAD_LOCAL struct SymState x;
+    int in[4], st[8], c[8], n = 4, m;
+    SymBegin(&x, in, st);
+    uint16_t ret0 = b & rdn;
+    if ((a & 0xE000) == lit) {
+        cell k = a & 0xFFF;
+        if (a & litSign) k = (k | ~0xFFF) & CELLMASK;
+        SymPush(&x, st, &n, k);
+    }
+    else if (!SymStep(&x, st, &n, a)) return -1;
+    if (!SymStep(&x, st, &n, b & ~rdn)) return -1;
+    if (SymSame(st, n, in, 4)) {
+        *out = alu0 | ret0;             // does nothing
+        return (ret0) ? 1 : 0;
+    }
+    static const uint16_t strobes[] = { 0, TtoN };
+    static const uint16_t stack[] = { 0, sup, sdn };
+    for (int i = 0; i < (int)sizeof(SymOps); i++)
+        for (int j = 0; j < 2; j++)
+            for (int k = 0; k < 3; k++) {
+                uint16_t insn = (SymOps[i] << 8) | strobes[j] | stack[k];
+                if (insn == 0) continue;
+                memcpy(c, in, sizeof(in));  m = 4;
+                if (SymStep(&x, c, &m, insn) && SymSame(st, n, c, m)) {
+                    *out = insn | ret0;
+                    return 1;
+                }
+            }
+    return -1;
+}
+
+SI PeepTail(void) {
+    int n = RW.n;
+    if ((n < 2) || RW.is[n - 1]) return 0;
+    uint16_t a = RW.out[n - 2], b = RW.out[n - 1], insn;
+    if ((a & 0xE000) == lit) {          // a literal, but not a long one
+        if ((n > 2) && ((RW.out[n - 3] & 0xF000) == litx)) return 0;
+    }
+    else if (!SymSimple(a)) return 0;
+    if (((b & rdn) != 0) && ((b & rdn) != ret)) return 0;
+    if (!SymSimple(b & ~rdn)) return 0;
+    int len = PeepPair(a, b, &insn);
+    if (len < 0) return 0;
+    Rewrite(n - 2, &insn, len);
+    return 1;
+}
+
+// The folding pass evaluates ALU instructions whose inputs are literals and
+// compiles the results as literals. Folded code can't set the carry, so
+// instructions that write it, such as `2*`, `2/` and `+c`, aren't folded.
+
+SI LitBefore(int end, cell* k) {        // start of the literal before end
+    int i = end - 1;
+    if ((i < 0) || ((RW.out[i] & 0xE000) != lit)) return -1;
+    uint16_t insn = RW.out[i];
+    if (insn & litSign) {               // LITX has no effect on it
+        *k = ((insn & 0xFFF) | ~0xFFF) & CELLMASK;
+        while ((i > 0) && ((RW.out[i - 1] & 0xF000) == litx)) i--;
+        return i;
+    }
+    cell hi = 0;                        // what LITX put in LEX
+    int shift = 0;
+    while ((i > 0) && ((RW.out[i - 1] & 0xF000) == litx)) {
+        i--;
+        hi |= (cell)(RW.out[i] & 0xFFF) << shift;
+        shift += 12;
+    }
+    *k = ((hi << 12) | (insn & 0xFFF)) & CELLMASK;
+    return i;
+}
+
+SI FoldTail(void) {
+    int n = RW.n;
+    uint16_t op = RW.out[n - 1];
+    uint16_t ret0 = op & rdn;
+    if ((ret0 != 0) && (ret0 != ret)) return 0;
+    op &= ~rdn;
+    if ((STROBE(op) & 0x0F) == STROBE(co)) return 0;
+    if (!SymSimple(op)) return 0;
+    static THREAD_LOCAL struct SymState x;
+    cell k[2];
+    int from[2];
+    from[0] = LitBefore(n - 1, &k[0]);
+    from[1] = (from[0] < 0) ? -1 : LitBefore(from[0], &k[1]);
+    for (int lits = 2; lits > 0; lits--) {
+        int first = from[lits - 1];
+        if ((first < 0) || !RewriteFree(first)) continue;
+        int in[4], st[8], sn = 4;
+        SymBegin(&x, in, st);
+        for (int i = lits - 1; i >= 0; i--) SymPush(&x, st, &sn, k[i]);
+        if (!SymStep(&x, st, &sn, op) || (sn < 4)) continue;
+        if (memcmp(st, in, sizeof(in))) continue;   // only pushes literals
+        uint16_t insn[12];
+        int len = 0, folded = 1;
+        for (int i = 4; (i < sn) && folded; i++) {
+            folded = (x.sym[st[i]].op == SYM_CONST);
+            if (folded) len += LitCode(x.sym[st[i]].k, &insn[len]);
+        }
+        if (!folded) continue;
+        if (ret0) insn[len++] = alu0 | ret0;
+        if (len >= n - first) continue;
+        Rewrite(first, insn, len);
+        return 1;
+    }
+    return 0;
+}
+
+// The threading pass sends a jump along a chain of jumps to where it ends.
+// A jump to a return becomes a copy of the return, which a bare return
+// then merges into the ALU instruction before it.
+
+static cell ThreadDest(cell start, cell dest) { // end of a jump chain
+    cell to = dest;
+    for (int i = CP - start; i > 0; i--) {
+        if ((to <= start) || (to >= CP)) return to;
+        uint16_t insn = CX->m.Code[to];
+        if ((INST(insn) != INST(jump))
+            || ((CX->m.Code[to - 1] & 0xF000) == litx))
+            return to;
+        to = insn & 0x1FFF;
+    }
+    return dest;                        // jumps that loop forever
+}
+
+SI ThreadTail(cell start) {
+    int n = RW.n;
+    uint16_t insn = RW.out[n - 1];
+    if ((n > 1) && ((RW.out[n - 2] & 0xF000) == litx)) return 0;
+    if ((INST(insn) == INST(jump)) || (INST(insn) == INST(zjump))) {
+        cell dest = insn & 0x1FFF;
+        if ((dest < start) || (dest > CP)) return 0;
+        cell to = ThreadDest(start, dest);
+        uint16_t r = 0;                 // what is at the destination
+        if ((to >= start) && (to < CP)) r = CX->m.Code[to];
+        else if ((to == CP) && (CX->latest == CP)) r = alu0 | ret;
+        if ((INST(insn) == INST(jump)) && (INST(r) == INST(alu0))
+            && ((r & rdn) == ret)) {
+            RW.out[n - 1] = r;          // a return instead of a jump
+            return 1;
+        }
+        if (to == dest) return 0;
+        RW.out[n - 1] = (insn & 0xE000) | to;
+        return 1;
+    }
+    if ((n < 2) || (insn != (alu0 | ret)) || RW.is[n - 1]) return 0;
+    uint16_t a = RW.out[n - 2];
+    if ((INST(a) != INST(alu0)) || (a == 0) || (a & rdn)
+        || ((STROBE(a) & 0x0F) == STROBE(TtoR)))
+        return 0;
+    a |= ret;
+    Rewrite(n - 2, &a, 1);
+    return 1;
+}
+
+// The inlining pass compiles a copy of a short definition instead of a
+// call to it. The copy must be straight-line code that ends in a return,
+// doesn't touch the return stack and doesn't call itself. Its size and the
+// calls it got in the last `profile` run are limited by `inlining`. A copy
+// no bigger than the call is always a win. A bigger one saves a call and a
+// return per loop pass, so it's only made inside a loop, while the code it
+// adds so far stays within the budget.
 
-SV LogBegin(char* title) {
-    LogR("<!DOCTYPE html>\n<html lang=\"en\">\n<head>\n");
-    LogR("<meta charset=\"utf-8\">\n<title>");
-    LogR(title);
-    LogR("</title>\n<link rel=\"stylesheet\" href=\"doc.css\">\n");
-    LogR("</head>\n<body>\n<h1>");
-    LogR(title);
-    LogR("</h1>\n<pre class=\"forth\">\n<font color=black>\n");
-    LogR("<hr>\n");
+SI Inlinable(int w) {                   // Header[w] can be copied in
+    struct Keyword* h = &CX->Header[w];
+    cell addr = h->target, len = h->length;
+    if ((len == 0) || ((int)len > CX->inlineSize) || h->notail || h->applet
+        || (w == CX->DefMarkID) || (addr + len > CodeSize))
+        return 0;
+    if (CX->inlineCalls && (CX->Profile[w].calls < CX->inlineCalls)) return 0;
+    for (cell i = 0; i < len; i++) {
+        uint16_t insn = CX->m.Code[addr + i];
+        int last = (i == len - 1);
+        int op = OPCODE(insn) & 0x1F;
+        switch (INST(insn)) {
+        case INST(alu0):
+            if ((insn & rdn) != ((last) ? ret : 0)) return 0;
+            if (((STROBE(insn) & 0x0F) == STROBE(TtoR)) || (op == OPCODE(RtoT))
+                || (op == OPCODE(RM1toT)) || (op == OPCODE(who)))
+                return 0;               // sees the return stack
+            break;
+        case INST(call):
+            if ((insn & 0x1FFF) == addr) return 0;
+            // fall through
+        case INST(lit):
+        case INST(litx):
+            if (last) return 0;
+            break;
+        default: return 0;              // jumps and traps
+        }
+    }
+    return 1;
 }
 
-SV LogEnd(void) {
-    LogR("\n</pre>\n</body>\n</html>\n");
+SI CompInline(int w) {                  // returns 0 if it didn't pay
+    cell addr = CX->Header[w].target;
+    int len = CX->Header[w].length;
+    int size = len - (CX->m.Code[addr + len - 1] == (alu0 | ret));
+    int growth = size - (((addr & 0xFFE000) ? 2 : 1));
+    if ((growth > 0) && ((CX->loops == 0)
+        || (CX->inlineGrowth + growth > CX->inlineBudget)
+        || (CP + size > CodeSize - CodeCache)))
+        return 0;
+    for (int i = 0; i < size; i++) {
+        uint16_t insn = CX->m.Code[addr + i];
+        toCode((i == len - 1) ? insn & ~rdn : insn);
+    }
+    CX->inlineGrowth += growth;
+    return 1;
 }
 
-// A strncpy that complies with C safety checks.
+// A literal may hold an address in the definition, such as `[ there ]
+// literal`. It can't be told from a number and wouldn't be moved with the
+// code, so a definition with a literal in its own range isn't optimized.
 
-void strmove(char* dest, char* src, int maxlen) {
-    for (int i = 0; i < maxlen; i++) {
-        char c = *src++;  *dest++ = c;
-        if (c == 0) return;             // up to and including the terminator
+SI AddressTaken(cell start) {           // a literal points into start..CP
+    cell hi = 0;
+    for (cell i = start; i < CP; i++) {
+        uint16_t insn = CX->m.Code[i];
+        if ((insn & 0xF000) == litx) {
+            hi = (hi << 12) | (insn & 0xFFF);
+            continue;
+        }
+        if ((insn & 0xE000) == lit) {
+            cell k = insn & 0xFFF;
+            if (insn & litSign) k = (k | ~0xFFF) & CELLMASK;
+            else k = ((hi << 12) | k) & CELLMASK;
+            if ((k >= start) && (k <= CP)) return 1;
+        }
+        hi = 0;
     }
-    *--dest = 0;                        // max reached, add terminator
+    return 0;
+}
+
+// map[] takes old offsets to new ones.
+
+SV Optimize(cell start) {               // the definition from start to CP
+    static THREAD_LOCAL uint8_t target[CodeSize + 1];
+    static THREAD_LOCAL int map[CodeSize + 1];
+    int len = CP - start;
+    if ((len < 2) || (start + len > CodeSize) || AddressTaken(start)) return;
+    memset(target, 0, len + 1);
+    for (int i = 0; i < len; i++) {
+        uint16_t insn = CX->m.Code[start + i];
+        cell dest = insn & 0x1FFF;
+        if (((INST(insn) == INST(jump)) || (INST(insn) == INST(zjump))
+          || (INST(insn) == INST(call))) && (dest >= start) && (dest <= CP))
+            target[dest - start] = 1;
+    }
+    if ((CX->latest >= start) && (CX->latest <= CP))
+        target[CX->latest - start] = 1;
+    RW.n = 0;
+    RW.landing = 0;
+    for (int i = 0; i < len; i++) {
+        map[i] = RW.n;
+        RW.is[RW.n] = target[i] | RW.landing;
+        RW.out[RW.n++] = CX->m.Code[start + i];
+        RW.landing = 0;
+        while (((CX->optimizing & OPT_THREAD) && ThreadTail(start))
+            || ((CX->optimizing & OPT_FOLD) && FoldTail())
+            || ((CX->optimizing & OPT_PEEPHOLE) && PeepTail())) ;
+    }
+    map[len] = RW.n;
+    for (int i = 0; i < RW.n; i++) {    // retarget jumps into the definition
+        uint16_t insn = RW.out[i];
+        cell dest = insn & 0x1FFF;
+        if (((INST(insn) == INST(jump)) || (INST(insn) == INST(zjump))
+          || (INST(insn) == INST(call))) && (dest >= start) && (dest <= CP))
+            insn = (insn & 0xE000) | (start + map[dest - start]);
+        if (CX->m.Code[start + i] != insn) chadToCode(start + i, insn);
+    }
+    for (int i = RW.n; i < len; i++) chadToCode(start + i, 0);
+    if ((CX->latest >= start) && (CX->latest <= CP))
+        CX->latest = start + map[CX->latest - start];
+    CP = start + RW.n;
+    if (RW.landing) CX->latest = CP;
 }
 
 //##############################################################################
 // Dictionary
-// The dictionary uses a static array of data structures loaded at startup.
+// The dictionary uses an array of data structures loaded at startup.
 // Links are int indices into this array of Headers.
 
-SI hp;                                  // # of keywords in the Header list
-static struct Keyword Header[MaxKeywords];
-CELL me;                                // index of found keyword
-static char* foundWidName;              // name of wid the word was found in
-static char ref[LineBufferSize];        // ReferenceString result buffer
-static char* ReferenceStackPic;         // string remaining after first blank
-
 static char* ReferenceString(int i) {   // extract reference string
-    char* hs = Header[i].help;
-    ReferenceStackPic = NULL;
+    char* hs = CX->Header[i].help;
+    CX->ReferenceStackPic = NULL;
     if (hs[0]) {
-        strmove(ref, hs, LineBufferSize);
-        if ((ReferenceStackPic = strchr(ref, ' ')) != NULL)
-            *ReferenceStackPic++ = '\0';
-        return ref;
+        strmove(CX->ref, hs, LineBufferSize);
+        if ((CX->ReferenceStackPic = strchr(CX->ref, ' ')) != NULL)
+            *CX->ReferenceStackPic++ = '\0';
+        return CX->ref;
     }
     return NULL;
 }
@@ -787,15 +2590,15 @@ static char* ReferenceString(int i) {   // extract reference string
 // HTML output of the token being evaluated, with hyperlink to reference.
 SV LogColor(uint32_t color, int ID, char* s) {
     FlushBlanks();
-    if (logcolor != color) {
-        logcolor = color;
+    if (CX->logcolor != color) {
+        CX->logcolor = color;
         LogR("</font><font color=#");
         Log(itos(color, 16, 6, 1));
         LogR(">");
     }
     if (ID) {
         LogR("<a href = \"");
-        LogR(foundWidName);
+        LogR(CX->foundWidName);
         LogR(".html#");
         LogR(ReferenceString(ID));
         LogR("\" style=\"text-decoration: none; color: #");
@@ -815,19 +2618,13 @@ SV LogColor(uint32_t color, int ID, char* s) {
 // A wid points to a linked list of headers.
 // The head pointer of the list is created by WORDLIST.
 
-static cell wordlist[MaxWordlists];     // head pointers to linked lists
-static char wordlistname[MaxWordlists][16];// optional name string
-SI wordlists;                           // number of defined wordlists
-SI root_wid;                            // the basic wordlists
-SI forth_wid;
-SI asm_wid;
 SI context(void) {
     if (ORDERS == 0) return 0;
     return CONTEXT;
 }
 
 SV printWID(int wid) {
-    char* s = &wordlistname[wid][0];
+    char* s = &CX->wordlistname[wid][0];
     if (*s)
         printf("%s ", s);
     else
@@ -841,16 +2638,16 @@ SV Order(void) {
 }
 
 SI findinWL(char* key, int wid) {       // find in wordlist
-    uint16_t i = wordlist[wid];
+    uint16_t i = CX->wordlist[wid];
     if (strlen(key) < MaxNameSize) {
         while (i) {
-            if (strcmp(key, Header[i].name) == 0) {
-                if (Header[i].smudge == 0) {
-                    me = i;
+            if (strcmp(key, CX->Header[i].name) == 0) {
+                if (CX->Header[i].smudge == 0) {
+                    CX->me = i;
                     return i;
                 }
             }
-            i = Header[i].link;
+            i = CX->Header[i].link;
         }
     }
     return -1;                          // return index of word, -1 if not found
@@ -861,8 +2658,8 @@ SI FindWord(char* key) {                // find in context
         int wid = ORDER(i - 1);
         int id = findinWL(key, wid);
         if (id >= 0) {
-            Header[me].references += 1; // bump reference counter
-            foundWidName = &wordlistname[i][0];
+            CX->Header[CX->me].references += 1; // bump reference counter
+            CX->foundWidName = &CX->wordlistname[i][0];
             return id;
         }
     }
@@ -871,11 +2668,11 @@ SI FindWord(char* key) {                // find in context
 
 SI Ctick(char* name) {
     if (FindWord(name) < 0) {
-        error = UNRECOGNIZED;
+        CX->error = UNRECOGNIZED;
         // printf("<%s> ", name);
         return 0;
     }
-    return Header[me].target;           // W field of found word
+    return CX->Header[CX->me].target;   // W field of found word
 }
 
 /* Wordlists are on the host. A copy of header space is made by MakeHeaders for
@@ -885,26 +2682,28 @@ wordlists but "wordlists--;" can be used by C to delete the last wordlist.
 */
 
 SI AddWordlist(char *name) {
-    wordlist[++wordlists] = 0;          // start with empty wordlist
-    strmove(&wordlistname[wordlists][0], name, 16);
-    if (wordlists == (MaxWordlists - 1)) error = BAD_WID_OVER;
-    return wordlists;
+    CX->wordlist[++CX->wordlists] = 0;  // start with empty wordlist
+    strmove(&CX->wordlistname[CX->wordlists][0], name, 16);
+    if (CX->wordlists == (MaxWordlists - 1)) CX->error = BAD_WID_OVER;
+    return CX->wordlists;
 }
 
 SV OrderPush(uint8_t n) {
     ORDER(15 & ORDERS++) = n;
-    if (ORDERS == 9) error = BAD_ORDER_OVER;
+    if (ORDERS == 9) CX->error = BAD_ORDER_OVER;
 }
 
 SI OrderPop(void) {
     uint8_t r = (ORDER(15 & --ORDERS));
-    if (ORDERS & 0x10) error = BAD_ORDER_UNDER;
+    if (ORDERS & 0x10) CX->error = BAD_ORDER_UNDER;
     return r;
 }
 
-SV Only       (void) { ORDERS = 0; OrderPush(root_wid); OrderPush(forth_wid); }
-SV ForthLex   (void) { CONTEXT = forth_wid; }
-SV AsmLex     (void) { CONTEXT = asm_wid; }
+SV Only       (void) {
+    ORDERS = 0;  OrderPush(CX->root_wid);  OrderPush(CX->forth_wid);
+}
+SV ForthLex   (void) { CONTEXT = CX->forth_wid; }
+SV AsmLex     (void) { CONTEXT = CX->asm_wid; }
 SV Definitions(void) { CURRENT = context(); }
 SV PlusOrder  (void) { OrderPush(Dpop()); }
 SV Previous   (void) { OrderPop(); }
@@ -933,15 +2732,15 @@ SI EvalToken (char *key) {              // do a command, return 0 if found
     int i = FindWord(key);
     if (i < 0)
         return -1;                      // not found
-    LogColor(Header[i].color, i, key);
+    LogColor(CX->Header[i].color, i, key);
     if (STATE)
-        Header[i].CompFn();
+        CX->Header[i].CompFn();
     else
-        Header[i].ExecFn();
+        CX->Header[i].ExecFn();
     return 0;
 }
 
-static uint32_t my (void) {return Header[me].w;}
+static uint32_t my (void) {return CX->Header[CX->me].w;}
 SV doLITERAL  (void) { Literal(Dpop()); }
 SV Equ_Comp   (void) { Literal(my()); }
 SV Equ_Exec   (void) { Dpush(my()); }
@@ -953,12 +2752,15 @@ SV doLitOp    (void) { toCode(Dpop() | my());  Dpush(0); }
 // Referencing a word outside of an API
 
 SV Def_Comp   (void) {
-    notail = Header[me].notail;
+    if ((CX->optimizing & OPT_INLINE) && Inlinable(CX->me)
+        && CompInline(CX->me))
+        return;
+    CX->noTail = CX->Header[CX->me].notail;
     CompCall(my()); 
 }
 
 SV Def_Exec   (void) {
-    if (verbose & VERBOSE_TOKEN) {
+    if (CX->verbose & VERBOSE_TOKEN) {
         printf(" <exec:%Xh>", my());
     }
     Simulate(my());
@@ -968,21 +2770,21 @@ SV Def_Exec   (void) {
 
 SV LitnExec(char* name, cell value) {
     Dpush(value);
-    int x = me;
+    int x = CX->me;
     Simulate(Ctick(name));
-    me = x;
+    CX->me = x;
 }
 
 SV LitnComp(char* name, cell value) {
-    int x = me;
+    int x = CX->me;
     int xt = Ctick(name);
-    notail = Header[me].notail;
+    CX->noTail = CX->Header[CX->me].notail;
     Literal(value);
     CompCall(xt);
-    me = x;
+    CX->me = x;
 }
 SI AppletSync(void) {
-    int page = Header[me].applet;
+    int page = CX->Header[CX->me].applet;
     if (page)
         LitnExec("spifload", page);
     return page;
@@ -990,58 +2792,57 @@ SI AppletSync(void) {
 
 SI AddHead (char* name, char* anchor) { // add a header to the list
     int r = 1;
-    hp++;
-    if (hp < MaxKeywords) {
-        strmove(Header[hp].name, name, MaxNameSize);
-        strmove(Header[hp].help, anchor, MaxAnchorSize);
-        Header[hp].length = 0;          // set defaults to 0
-        Header[hp].notail = 0;
-        Header[hp].target = 0;
-        Header[hp].notail = 0;
-        Header[hp].smudge = 0;
-        Header[hp].isALU = 0;
-        Header[hp].srcFile = File.FID;
-        Header[hp].srcLine = File.LineNumber;
-        Header[hp].link = wordlist[CURRENT];
-        Header[hp].references = 0;
-        Header[hp].w2 = 0;
-        Header[hp].applet = 0;
-        wordlist[CURRENT] = hp;
+    CX->hp++;
+    if (CX->hp < MaxKeywords) {
+        strmove(CX->Header[CX->hp].name, name, MaxNameSize);
+        strmove(CX->Header[CX->hp].help, anchor, MaxAnchorSize);
+        CX->Header[CX->hp].length = 0;  // set defaults to 0
+        CX->Header[CX->hp].notail = 0;
+        CX->Header[CX->hp].target = 0;
+        CX->Header[CX->hp].notail = 0;
+        CX->Header[CX->hp].smudge = 0;
+        CX->Header[CX->hp].isALU = 0;
+        CX->Header[CX->hp].srcFile = File.FID;
+        CX->Header[CX->hp].srcLine = File.LineNumber;
+        CX->Header[CX->hp].link = CX->wordlist[CURRENT];
+        CX->Header[CX->hp].references = 0;
+        CX->Header[CX->hp].w2 = 0;
+        CX->Header[CX->hp].applet = 0;
+        CX->Header[CX->hp].keep = 0;
+        CX->wordlist[CURRENT] = CX->hp;
     } else {
         printf("Please increase MaxKeywords and rebuild.\n");
-        r = 0;  error = BYE;
+        r = 0;  CX->error = BYE;
     }
     return r;
 }
 
 SV SetFns (cell value, void (*exec)(), void (*comp)()) {
-    Header[hp].w = value;
-    Header[hp].ExecFn = exec;
-    Header[hp].CompFn = comp;
+    CX->Header[CX->hp].w = value;
+    CX->Header[CX->hp].ExecFn = exec;
+    CX->Header[CX->hp].CompFn = comp;
 }
 
 SV AddKeyword (char* name, char* help, void (*xte)(), void (*xtc)()) {
     if (AddHead(name, help)) {
         SetFns(NOTANEQU, xte, xtc);
-        Header[hp].color = COLOR_ROOT;
+        CX->Header[CX->hp].color = COLOR_ROOT;
     }
 }
 
 SV AddALUinst(char* name, char* help, cell value) {
     if (AddHead(name, help)) {
         SetFns(value, Prim_Exec, Prim_Comp);
-        Header[hp].isALU = 1;
-        Header[hp].color = COLOR_ALU;
+        CX->Header[CX->hp].isALU = 1;
+        CX->Header[CX->hp].color = COLOR_ALU;
     }
 }
 
-int DefMark, DefMarkID;
-
 SV AddEquate(char* name, char* help, cell value) {
     if (AddHead(name, help)) {
         SetFns(value, Equ_Exec, Equ_Comp);
-        Header[hp].color = COLOR_EQU;
-        DefMarkID = hp; // was for DOES> but can't do it here
+        CX->Header[CX->hp].color = COLOR_EQU;
+        CX->DefMarkID = CX->hp; // was for DOES> but can't do it here
     }
 }
 
@@ -1049,7 +2850,7 @@ SV AddEquate(char* name, char* help, cell value) {
 SV AddModifier (char *name, char* help, cell value) {
     if (AddHead(name, help)) {
         SetFns(value, doInstMod, noCompile);
-        Header[hp].color = COLOR_ASM;
+        CX->Header[CX->hp].color = COLOR_ASM;
     }
 }
 
@@ -1057,8 +2858,8 @@ SV AddModifier (char *name, char* help, cell value) {
 SV AddLitOp (char *name, char* help, cell value) {
     if (AddHead(name, help)) {
         SetFns(value, doLitOp, noCompile);
-        Header[hp].w2 = MAGIC_OPCODE;
-        Header[hp].color = COLOR_ASM;
+        CX->Header[CX->hp].w2 = MAGIC_OPCODE;
+        CX->Header[CX->hp].color = COLOR_ASM;
     }
 }
 
@@ -1069,24 +2870,22 @@ SV AddLitOp (char *name, char* help, cell value) {
 
 static char* TargetName (cell addr, int page) {
     if (!addr) return NULL;
-    int i = hp + 1;
+    int i = CX->hp + 1;
     while (--i) {
-        if ((Header[i].target == addr) &&
-            (Header[i].applet == page))
-            return Header[i].name;
+        if ((CX->Header[i].target == addr) &&
+            (CX->Header[i].applet == page))
+            return CX->Header[i].name;
     }
     return NULL;
 }
 
-char DAbuf[256];                        // disassembling to a buffer
-
 SV appendDA(char* s) {                  // append string to DA buffer
-    size_t i = strlen(DAbuf);
+    size_t i = strlen(CX->DAbuf);
     size_t len = strlen(s);
-    strmove(&DAbuf[i], s, len + 1);
+    strmove(&CX->DAbuf[i], s, len + 1);
     i += len;
-    DAbuf[i++] = ' ';                   // trailing space
-    DAbuf[i++] = '\0';
+    CX->DAbuf[i++] = ' ';               // trailing space
+    CX->DAbuf[i++] = '\0';
 }
 
 SV HexToDA(cell x) {                    // append hex number to DA buffer
@@ -1101,11 +2900,11 @@ SV diss (int id, char *str) {
 SI ALUlabel(uint16_t inst) {            // try to match to a predefined ALUinst
     int hasret = ISRET;
     if (hasret) { inst &= ~rdn; }       // strip RET
-    for (int i = 1; i < hp; i++) {
-        if ((Header[i].isALU) && (Header[i].w == inst)) {
-            appendDA(Header[i].name);
+    for (int i = 1; i < CX->hp; i++) {
+        if ((CX->Header[i].isALU) && (CX->Header[i].w == inst)) {
+            appendDA(CX->Header[i].name);
             if (hasret) appendDA("exit");
-            if (verbose == VERBOSE_DASM) {
+            if (CX->verbose == VERBOSE_DASM) {
                 appendDA("\\");
                 return 1;
             }
@@ -1116,10 +2915,9 @@ SI ALUlabel(uint16_t inst) {            // try to match to a predefined ALUinst
 }
 
 CELL DisassembleInsn(uint16_t IR, uint16_t page) {
-    static cell lex;
     cell _lex = 0;
     char* name;
-    DAbuf[0] = '\0';
+    CX->DAbuf[0] = '\0';
     int target;
     switch ((IR>>13) & 7) {
     case 0:
@@ -1146,12 +2944,12 @@ CELL DisassembleInsn(uint16_t IR, uint16_t page) {
         if (IR & litSign)
             target = (ALL_ONES & ~0xFFF) | (IR & 0xFFF);
         else
-            target = (lex << 12) | (IR & 0xFFF);
+            target = (CX->DAlex << 12) | (IR & 0xFFF);
         appendDA(itos(target, BASE, 0, 0));
         appendDA("imm");
         break;
     case 3:
-        target = (lex << 12) | (IR & 0xFFF);
+        target = (CX->DAlex << 12) | (IR & 0xFFF);
         int trapnum = (IR & trapID1) ? 1 : 0;
         if (trapnum) {
             name = TargetName((target & 0x1FFF), target >> 13);
@@ -1180,7 +2978,7 @@ CELL DisassembleInsn(uint16_t IR, uint16_t page) {
         else {
             target = IR & 0xFFF;
             HexToDA(target);
-            _lex = (lex << 12) + target;
+            _lex = (CX->DAlex << 12) + target;
             appendDA("litx");
         }
         break;
@@ -1195,8 +2993,8 @@ CELL DisassembleInsn(uint16_t IR, uint16_t page) {
         diss((IR>>13)&3,"zjump\0?\0jump\0call");
         if (name != NULL) appendDA(name);
     }
-    lex = _lex;
-    printf("%16s", DAbuf);
+    CX->DAlex = _lex;
+    printf("%16s", CX->DAbuf);
     return 0;
 }
 
@@ -1206,7 +3004,7 @@ SV DasmPaged (int page) { // ( addr len -- )
     char* name;
     for (int i=0; i<length; i++) {
         int a = addr++ & (CodeSize-1);
-        int x = Code[a];
+        int x = CX->m.Code[a];
         name = TargetName(a, page);
         if (name != NULL) printf("%s\n", name);
         printf("%03x %04x  ", a, x);
@@ -1217,13 +3015,13 @@ SV DasmPaged (int page) { // ( addr len -- )
 
 SV Steps(void) {                      // ( addr steps -- )
     uint16_t cnt = (uint16_t)Dpop();    // single step debugger gives a listing
-    pc = Dpop();
-    verbose |= VERBOSE_TRACE;
+    CX->m.pc = Dpop();
+    CX->verbose |= VERBOSE_TRACE;
     for (uint16_t i = 0; i < cnt; i++) {
         CPUsim(1);
-        if (rp == (StackSize - 1)) break;
+        if (CX->m.rp == (StackSize - 1)) break;
     }
-    verbose &= ~VERBOSE_TRACE;
+    CX->verbose &= ~VERBOSE_TRACE;
 }
 
 SV Assert(void) {                     // for test code
@@ -1233,21 +3031,49 @@ SV Assert(void) {                     // for test code
         printf("Expected = "); Cdot(expected);
         printf("actual = "); Cdot(actual);
         printf("\n");
-        error = BAD_ASSERT;
+        CX->error = BAD_ASSERT;
     }
 }
 
-uint64_t elapsed_us;
-uint64_t elapsed_cycles;
+SV ShowIrqStats(void) {                 // and start over
+    for (int i = 1; i < IrqLevels; i++) {
+        struct IrqStat* s = &CX->IrqStats[i];
+        if ((s->served | s->deferred) == 0) continue;
+        printf("IRQ %d: %" PRIu64 " served, %" PRIu64 " deferred", i,
+            s->served, s->deferred);
+        if (s->served) {
+            printf(", latency mean %.1f, max %" PRIu64 "\n ",
+                (double)s->total / s->served, s->max);
+            for (int b = 0; b < IrqBuckets; b++) {
+                if (s->hist[b] == 0) continue;
+                uint64_t top = ((uint64_t)1 << b) - 1;
+                if (b == (IrqBuckets - 1))
+                    printf(" >%" PRIu64, top >> 1);
+                else
+                    printf(" <=%" PRIu64, top);
+                printf(":%" PRIu64, s->hist[b]);
+            }
+        }
+        printf("\n");
+    }
+    memset(CX->IrqStats, 0, sizeof(CX->IrqStats));
+}
 
 SV Stats(void) {
-    printf("%" PRId64 " cycles, MaxSP=%d, MaxRP=%d, latency=%d",
-        elapsed_cycles, spMax, rpMax, latency);
-    if (elapsed_us > 99) {
-        printf(", %" PRId64 " MIPS", elapsed_cycles / elapsed_us);
+    printf("%" PRId64 " cycles", CX->elapsed_cycles);
+    if (CX->stackTracked) {             // only the instrumented sim tracks
+        printf(", MaxSP=%d, MaxRP=%d, latency=%d",
+            CX->spMax, CX->rpMax, CX->latency);
+    }
+    int e = CX->elapsed_engine;         // -1 if none ran, -2 if several
+    if ((CX->elapsed_us > 99) && (e != -1)) {
+        printf(", %" PRId64 " MIPS (%s)", CX->elapsed_cycles / CX->elapsed_us,
+            (e < 0) ? "mixed" : EngineNames[e]);
     }
     printf("\n");
-    spMax = sp;  rpMax = rp;
+    CX->spMax = CX->m.sp;  CX->rpMax = CX->m.rp;
+    CX->stackTracked = 0;
+    ShowIrqStats();
 }
 
 SV dotESS (void) {                      // ( ... -- ... )
@@ -1265,8 +3091,6 @@ SV dot(void) {                          // ( n -- )
 // A new file is pushed onto the file stack.
 // Every time a file is opened, the fileID is bumped.
 
-static char* buf;                       // line buffer
-SI maxlen;                              // maximum buffer length
 static char BOMmarker[4] = {0xEF, 0xBB, 0xBF, 0x00};
 
 static char* Title(char* filename) {    // strip down filename
@@ -1284,12 +3108,12 @@ static char* Title(char* filename) {    // strip down filename
 }
 
 static char* RefPath(char* filename) {  // convert filename format
-    static char buf[LineBufferSize];
-    strmove(buf, "./html/", LineBufferSize);
-    strmove(&buf[strlen(buf)], Title(filename), LineBufferSize);
-    strmove(&buf[strlen(buf)], ".html", LineBufferSize);
-    buf[strlen(buf)] = '\0';
-    return buf;
+    static THREAD_LOCAL char path[LineBufferSize];
+    strmove(path, "./html/", LineBufferSize);
+    strmove(&path[strlen(path)], Title(filename), LineBufferSize);
+    strmove(&path[strlen(path)], ".html", LineBufferSize);
+    path[strlen(path)] = '\0';
+    return path;
 }
 
 // Industry consensus is that utf-8 files should not need a BOM, which is a
@@ -1306,20 +3130,20 @@ SV SwallowBOM(FILE *fp) {               // swallow leading UTF8 BOM marker
 }
 
 SI OpenNewFile(char *name) {            // Push a new file onto the file stack
-    filedepth++;  fileID++;
+    CX->filedepth++;  CX->fileID++;
     File.fp = fopenx(name, "r");
     File.LineNumber = 0;
     File.Line[0] = 0;
-    File.FID = fileID;
+    File.FID = CX->fileID;
     if (File.fp == NULL) {
-        filedepth--;
+        CX->filedepth--;
         return BAD_OPENFILE;
     } else {
-        if ((filedepth >= MaxFiles) || (fileID >= MaxFilePaths))
+        if ((CX->filedepth >= MaxFiles) || (CX->fileID >= MaxFilePaths))
             return BAD_INCLUDING;
         else {
             SwallowBOM(File.fp);
-            strmove(FilePaths[fileID].filepath, name, LineBufferSize);
+            strmove(CX->FilePaths[CX->fileID].filepath, name, LineBufferSize);
             File.hfp = fopenx(RefPath(name), "w");
             LogBegin(Title(name));
         }
@@ -1327,47 +3151,45 @@ SI OpenNewFile(char *name) {            // Push a new file onto the file stack
     return 0;
 }
 
-static char tok[LineBufferSize+1];      // blank-delimited token
-
 // the quick brown fox jumped
 // >in before -----^   ^--- after, tok = fox\0
 
 SI parseword(char delimiter) {
-    while (buf[TOIN] == delimiter) {    // skip leading delimiters
+    while (CX->buf[TOIN] == delimiter) { // skip leading delimiters
         LogChar(delimiter);
         TOIN++;
     }
     int length = 0;
     while (1) {
-        char c = buf[TOIN];
+        char c = CX->buf[TOIN];
         if (c == 0) break;              // hit EOL
         TOIN++;
         if (c == delimiter)  break;
-        tok[length++] = c;
+        CX->tok[length++] = c;
     }
-    tok[length] = 0;                    // tok is zero-delimited
+    CX->tok[length] = 0;                // tok is zero-delimited
     return length;
 }
 
 SV ParseFilename(void) {
-    while (buf[TOIN] == ' ') TOIN++;
-    if (buf[TOIN] == '"') {
+    while (CX->buf[TOIN] == ' ') TOIN++;
+    if (CX->buf[TOIN] == '"') {
         parseword('"');                 // allow filename in quotes
     }
     else {
         parseword(' ');                 // or a filename with no spaces
     }
-    LogColor(COLOR_NONE, 0, tok);
+    LogColor(COLOR_NONE, 0, CX->tok);
 }
 
 SV Include(void) {                      // Nest into a source file
     ParseFilename();
-    error = OpenNewFile(tok);
+    CX->error = OpenNewFile(CX->tok);
 }
 
 SV LoadFlash(void) {                    // ( dest -- )
     ParseFilename();
-    error = LoadFlashMem(tok, Dpop());
+    CX->error = LoadFlashMem(CX->tok, Dpop());
 }
 
 // d_pid is a double cell PID16:KEYID8
@@ -1378,22 +3200,20 @@ SV SaveFlash(void) {                    // ( format d_pid baseblock -- )
     uint64_t d = (uint64_t)Dpop() << CELLBITS;   d += Dpop();
     int format = Dpop();                //  v--- 1st byte of 32-bit pid
     d = (d << 8) + baseblock;           // {BASEBLOCK, PIDlo, PIDhi, KeyID}
-    error = SaveFlashMem(tok, (uint32_t)d, format);
+    CX->error = SaveFlashMem(CX->tok, (uint32_t)d, format);
 }
 
 // API calls are compiled as a literal xxt and a call to xexec
 
-SI isAPI;                               // compiler is in API mode
-
 SI xxt(void) {                          // convert xt to xxt
-    return (Header[me].applet << 13) + my();
+    return (CX->Header[CX->me].applet << 13) + my();
 }
 SV DefA_Exec(void) {
     LitnExec("xexec", xxt());
 }
 SV DefA_Comp(void) {
-    int id = Header[me].applet;
-    if ((id) && (isAPI != id)) {        // not in this API
+    int id = CX->Header[CX->me].applet;
+    if ((id) && (CX->isAPI != id)) {    // not in this API
         int ext = xxt();
         extended_lit(ext >> 12);
         toCode(trap | trapID1 | (ext & 0xFFF));
@@ -1409,70 +3229,70 @@ SV DefA_Comp(void) {
 
 SV Colon(void) {
     parseword(' ');
-    if (AddHead(tok, "")) {             // start a definition
+    if (AddHead(CX->tok, "")) {         // start a definition
         Calign();
-        LogColor(COLOR_DEF, 0, tok);
-        if (isAPI) {
-            Header[hp].applet = isAPI;
+        LogColor(COLOR_DEF, 0, CX->tok);
+        if (CX->isAPI) {
+            CX->Header[CX->hp].applet = CX->isAPI;
             SetFns(CP, DefA_Exec, DefA_Comp);
         }
         else {
             SetFns(CP, Def_Exec, Def_Comp);
         } 
-        Header[hp].target = CP;
-        Header[hp].color = COLOR_WORD;
-        Header[hp].smudge = 1;
-        DefMarkID = hp;                 // save for later reference
-        DefMark = CP;
-        latest = CP;                    // code starts here
-        ConSP = 0;
+        CX->Header[CX->hp].target = CP;
+        CX->Header[CX->hp].color = COLOR_WORD;
+        CX->Header[CX->hp].smudge = 1;
+        CX->DefMarkID = CX->hp;         // save for later reference
+        CX->DefMark = CP;
+        CX->latest = CP;                // code starts here
+        CX->ConSP = 0;  CX->loops = 0;
         toCompile();
     }
 }
 
 SV NoName(void) {
-    Dpush(CP);  DefMarkID = 0;          // no length
+    Dpush(CP);  CX->DefMarkID = 0;      // no length
     toCompile();
-    latest = CP;
-    ConSP = 0;
+    CX->latest = CP;
+    CX->ConSP = 0;  CX->loops = 0;
 }
 
 SV Constant(void) {
     parseword(' ');
-    AddEquate(tok, "", Dpop());
-    LogColor(COLOR_EQU, 0, tok);
+    AddEquate(CX->tok, "", Dpop());
+    LogColor(COLOR_EQU, 0, CX->tok);
 }
 
 SV Lexicon(void) {                      // named wordlist
     parseword(' ');
-    AddEquate(tok, "", AddWordlist(tok));
-    LogColor(COLOR_DEF, 0, tok);
+    AddEquate(CX->tok, "", AddWordlist(CX->tok));
+    LogColor(COLOR_DEF, 0, CX->tok);
 }
 
 SV BrackDefined(void) {
     parseword(' ');
-    int r = (FindWord(tok) < 0) ? 0 : 1;
+    int r = (FindWord(CX->tok) < 0) ? 0 : 1;
     if (r) {
-        if (Header[me].target == 0) r = 0;
-        LogColor(COLOR_NONE, me, tok);
+        if (CX->Header[CX->me].target == 0) r = 0;
+        LogColor(COLOR_NONE, CX->me, CX->tok);
     }
     else
-        LogColor(COLOR_WORD, me, tok);
+        LogColor(COLOR_WORD, CX->me, CX->tok);
     Dpush(r);
 }
 
 SV EndDefinition(void) {                   // resolve length of definition
-    if (DefMarkID) {
-        Header[DefMarkID].length = CP - DefMark;
-        Header[DefMarkID].smudge = 0;
+    if (CX->DefMarkID) {
+        CX->Header[CX->DefMarkID].length = CP - CX->DefMark;
+        CX->Header[CX->DefMarkID].smudge = 0;
     }
 }
 
 SV CompMacro(void) {
-    int len = Header[me].length;
+    int len = CX->Header[CX->me].length;
     int addr = my();
     for (int i=0; i<len; i++) {
-        int inst = Code[addr++];
+        int inst = CX->m.Code[addr++];
         if ((i == (len - 1)) && ISRET) { // last inst has a return?
             inst &= ~rdn;               // strip trailing return
         }
@@ -1481,55 +3301,55 @@ SV CompMacro(void) {
 }
 
 SV Macro(void) {
-    Header[DefMarkID].CompFn = CompMacro;
+    CX->Header[CX->DefMarkID].CompFn = CompMacro;
 }
 
 SV Immediate(void) {
-    Header[DefMarkID].CompFn = Header[DefMarkID].ExecFn;
+    CX->Header[CX->DefMarkID].CompFn = CX->Header[CX->DefMarkID].ExecFn;
 }
 
 SV NoTailRecursion (void) {
-    Header[DefMarkID].notail = 1;
+    CX->Header[CX->DefMarkID].notail = 1;
 }
 
 SV SaveMarker(cell* dest) {
-    dest[0] = hp;    dest[1] = CP;  dest[4] = fileID;
-    dest[2] = wordlists;  dest[3] = DP;
-    memcpy(&dest[5], wordlist, sizeof(cell) * MaxWordlists);
+    dest[0] = CX->hp;    dest[1] = CP;  dest[4] = CX->fileID;
+    dest[2] = CX->wordlists;  dest[3] = DP;
+    memcpy(&dest[5], CX->wordlist, sizeof(cell) * MaxWordlists);
 }
 
 SV LoadMarker(cell* src) {
-    hp = src[0];     CP = src[1];   fileID = src[4];
-    wordlists = src[2];  DP = src[3];
-    memcpy(wordlist, &src[5], sizeof(cell) * MaxWordlists);
+    CX->hp = src[0];     CP = src[1];   CX->fileID = src[4];
+    CX->wordlists = src[2];  DP = src[3];
+    memcpy(CX->wordlist, &src[5], sizeof(cell) * MaxWordlists);
 }
 
 SV Marker_Exec(void) {                  // execution semantics of a marker
-    cell* pad = Header[me].aux;
+    cell* pad = CX->Header[CX->me].aux;
     LoadMarker(pad);
     free(pad);
 }
 
 SV Marker (void) {
     parseword(' ');
-    if (AddHead(tok, "")) {
+    if (AddHead(CX->tok, "")) {
         SetFns(CP, Marker_Exec, noCompile);
-        Header[hp].color = COLOR_ROOT;
+        CX->Header[CX->hp].color = COLOR_ROOT;
         cell* pad = malloc(sizeof(cell) * (MaxWordlists + 8));
-        Header[hp].aux = pad;
+        CX->Header[CX->hp].aux = pad;
         SaveMarker(pad);
-        LogColor(COLOR_DEF, 0, tok);
+        LogColor(COLOR_DEF, 0, CX->tok);
     }
 }
 
 SV ListWords(int wid) {                 // in a given wordlist
-    uint16_t i = wordlist[wid];
+    uint16_t i = CX->wordlist[wid];
     while (i) {
-        size_t len = strlen(tok);       // filter by substring
-        char* s = strstr(Header[i].name, tok);
+        size_t len = strlen(CX->tok);   // filter by substring
+        char* s = strstr(CX->Header[i].name, CX->tok);
         if ((s != NULL) || (len == 0))
-            printf("%s ", Header[i].name);
-        i = Header[i].link;             // traverse from oldest
+            printf("%s ", CX->Header[i].name);
+        i = CX->Header[i].link;         // traverse from oldest
     }
 }
 SV Words(void) {
@@ -1540,13 +3360,13 @@ SV Words(void) {
 
 SI tick (void) {                        // get the w field of the word
     parseword(' ');
-    int xt = Ctick(tok);
-    LogColor(COLOR_WORD, me, tok);
+    int xt = Ctick(CX->tok);
+    LogColor(COLOR_WORD, CX->me, CX->tok);
     return xt;
 }
 
 SI isImmediate(void) {                  // ticked word is immediate?
-    return (Header[me].CompFn == Header[me].ExecFn);
+    return (CX->Header[CX->me].CompFn == CX->Header[CX->me].ExecFn);
 }
 
 SV Dasm(void) {
@@ -1560,23 +3380,22 @@ SV See (void) {                         // ( <name> -- )
         if (page)
             printf("flash[%X00h]: ", page);
         if (isImmediate()) printf("immediate ");
-        Dpush(addr);  Dpush(Header[me].length);  DasmPaged(page);
+        Dpush(addr);  Dpush(CX->Header[CX->me].length);  DasmPaged(page);
     }
 }
 
 SV Cold(void) {                         // cold boot and run forever
-    pc = t = sp = rp = areg = lex = cy = 0;
-    while (1) {
-        Dpush(CPUsim(-1));
-        pc = Ctick("throw");
-    }
+    CX->m.pc = CX->m.t = CX->m.sp = CX->m.rp = 0;
+    CX->m.areg = CX->m.lex = CX->m.cy = 0;
+    RecordRun(0xFF);
+    ColdRun();
 }
 
 SV Locate(void) {
     if (tick()) {
-        uint8_t i = Header[me].srcFile;
-        char* filename = FilePaths[i].filepath;
-        int line = Header[me].srcLine;
+        uint8_t i = CX->Header[CX->me].srcFile;
+        char* filename = CX->FilePaths[i].filepath;
+        int line = CX->Header[CX->me].srcLine;
         printf("%s", filename);
         FILE* fp = fopenx(filename, "r");
         if (fp == NULL) {
@@ -1597,41 +3416,56 @@ SV Locate(void) {
 
 SV Later(void) {
     Colon();  toImmediate();  toCode(jump);
-    Header[hp].w2 = MAGIC_LATER;
+    CX->Header[CX->hp].w2 = MAGIC_LATER;
     EndDefinition();
 }
 
 SV Resolves(void) {                     // ( xt <name> -- )
     int addr = tick();
-    if (Header[me].w2 != MAGIC_LATER) error = BAD_IS;
+    if (CX->Header[CX->me].w2 != MAGIC_LATER) CX->error = BAD_IS;
     cell insn = jump | (Dpop() & 0x1fff);
     chadToCode(addr, insn);
 }
 
 SV SkipToPar(void) {
-    parseword(')');  LogColor(COLOR_COM, 0, tok);  Log(")");
+    parseword(')');  LogColor(COLOR_COM, 0, CX->tok);  Log(")");
+}
+SV irqStore  (void) { cell x = Dpop();  CX->m.irq &= x;  RaiseIRQ(x); }
+
+SV irqAt(void) {                        // ( x u -- )
+    uint64_t when = CX->m.cycles + Dpop();
+    CX->m.irqLater |= Dpop();
+    chadSchedule(EVENT_IRQ, when, IRQevent);
 }
-SV irqStore  (void) { irq = Dpop(); }
 SV Nothing   (void) { }
-SV CodeBegin (void) { toImmediate();  OrderPush(asm_wid);  Dpush(0);}
+SV CodeBegin (void) { toImmediate();  OrderPush(CX->asm_wid);  Dpush(0);}
 SV CodeEnd   (void) { OrderPop();  Dpop();  toCompile(); }
 SV BeginCode (void) { Colon();  CodeBegin();}
 SV EndCode   (void) { EndDefinition();  OrderPop();  Dpop();  sane();}
-SV Recurse   (void) { CompCall(Header[DefMarkID].target); }
-SV Bye       (void) { error = BYE; }
-SV EchoToPar (void) { SkipToPar();  printf("%s", tok); }
+SV Recurse   (void) { CompCall(CX->Header[CX->DefMarkID].target); }
+SV Bye       (void) { CX->error = BYE; }
+SV EchoToPar (void) { SkipToPar();  printf("%s", CX->tok); }
 SV Cr        (void) { printf("\n"); }
 SV Tick      (void) { Dpush(tick()); }
 SV BrackTick (void) { Literal(tick()); }
 SV There     (void) { Dpush(CP); }
 SV WrProtect (void) { killHostIO(); }
-SV SemiComp  (void) { CompExit();  EndDefinition();  toImmediate();  sane();}
+SV SemiComp  (void) {
+    if (CX->DefMarkID && CX->optimizing) Optimize(CX->DefMark);
+    CompExit();  EndDefinition();  toImmediate();  sane();
+}
+SV SetOptimize (void) { CX->optimizing = Dpop(); }
+SV SetInlining (void) {                 // ( size calls budget -- )
+    CX->inlineBudget = Dpop();  CX->inlineCalls = Dpop();
+    CX->inlineSize = Dpop();
+    CX->inlineGrowth = 0;
+}
 SV Semicolon (void) { EndDefinition();  sane(); }
-SV Verbosity (void) { verbose = Dpop(); }
+SV Verbosity (void) { CX->verbose = Dpop(); }
 SV Aligned   (void) { Dpush(aligned(Dpop())); }
 SV BrackUndefined(void) { BrackDefined();  Dpush(~Dpop()); }
 #ifdef HASFLOATS
-SV SetFPexpbits(void) { FPexpbits = Dpop(); }
+SV SetFPexpbits(void) { CX->FPexpbits = Dpop(); }
 #endif
 
 SV Postpone(void) {                     // postpone of applet words not supported
@@ -1642,38 +3476,36 @@ SV Postpone(void) {                     // postpone of applet words not supporte
         Literal(xte);
         CompCall(Ctick("compile,"));
     }
-    if (Header[me].applet)
-        error = BAD_POSTPONE;
+    if (CX->Header[CX->me].applet)
+        CX->error = BAD_POSTPONE;
 }
 
-SI localWID;                            // compilation wordlist for locals
-
 SV BeginLocals(void) {
-    localWID = AddWordlist("locals");
-    OrderPush(localWID);  Definitions();
+    CX->localWID = AddWordlist("locals");
+    OrderPush(CX->localWID);  Definitions();
 }
 
 SV Exportable(void) {
     CURRENT = ORDER(ORDERS - 2);
 }
 
-SV EndLocals(void) { OrderPop();  Definitions();  wordlists--; }
+SV EndLocals(void) { OrderPop();  Definitions();  CX->wordlists--; }
 SV LocalExec(void) { LitnExec("(local)", my()); }
 SV LocalComp(void) { LitnComp("(local)", my()); }
 
 SV Local(void) {
-    int temp = CURRENT;  CURRENT = localWID;
+    int temp = CURRENT;  CURRENT = CX->localWID;
     parseword(' ');
-    if (AddHead(tok, "1.1430 -- a")) {
+    if (AddHead(CX->tok, "1.1430 -- a")) {
         SetFns(Dpop() + BYTE_ADDR(2), LocalExec, LocalComp);
     }
     CURRENT = temp;
 }
 
 SV SkipToEOL(void) {                    // and look for x.xxxx format number
-    char* src = &buf[TOIN];
+    char* src = &CX->buf[TOIN];
     char* p = src;
-    char* dest = Header[DefMarkID].help;
+    char* dest = CX->Header[CX->DefMarkID].help;
     LogColor(COLOR_COM, 0, src);
     int digits = 0;
     int decimals = 0;
@@ -1689,7 +3521,7 @@ SV SkipToEOL(void) {                    // and look for x.xxxx format number
         if ((p = strchr(src, '\\')) != NULL) *p = '\0';
         strmove(dest, src, MaxAnchorSize);
     }
-    TOIN = (int)strlen(buf);
+    TOIN = (int)strlen(CX->buf);
 }
 
 
@@ -1715,30 +3547,30 @@ ask: TOIN = 0;
 #ifdef chadSpinFunction
         if (_kbhit() == 0) {
             if (chadSpinFunction()) {
-                buf[0] = '\0';
-                error = BYE;
+                CX->buf[0] = '\0';
+                CX->error = BYE;
                 return -1;
             }
         }
 #endif
     }
-    if (fgets(buf, maxlen, File.fp) == NULL) {
+    if (fgets(CX->buf, CX->maxlen, File.fp) == NULL) {
         result = 0;
-        if (filedepth) {
+        if (CX->filedepth) {
             fclose(File.fp);
             LogEnd();
             fclose(File.hfp);
-            filedepth--;
+            CX->filedepth--;
             goto ask;
         }
     }
     else
-        trimCR(buf);
-    strmove(File.Line, buf, LineBufferSize);
-    logcolor = 0;
+        trimCR(CX->buf);
+    strmove(File.Line, CX->buf, LineBufferSize);
+    CX->logcolor = 0;
     Log("\n");
-    if (verbose & VERBOSE_SOURCE)
-        printf("%d: %s\n", lineno, buf);
+    if (CX->verbose & VERBOSE_SOURCE)
+        printf("%d: %s\n", lineno, CX->buf);
     return result;
 }
 
@@ -1748,22 +3580,22 @@ static void BrackElse(void) {
     int level = 1;
     while (level) {
         parseword(' ');
-        int length = (int)strlen(tok);
+        int length = (int)strlen(CX->tok);
         if (length) {
-            if (!strcmp(tok, "[if]")) {
+            if (!strcmp(CX->tok, "[if]")) {
                 level++;
             }
-            if (!strcmp(tok, "[then]")) {
+            if (!strcmp(CX->tok, "[then]")) {
                 level--;
             }
-            if (!strcmp(tok, "[else]") && (level == 1)) {
+            if (!strcmp(CX->tok, "[else]") && (level == 1)) {
                 level--;
             }
-            LogColor(COLOR_NONE, 0, tok);
+            LogColor(COLOR_NONE, 0, CX->tok);
         }
         else {                          // EOL
             if (!refill()) {
-                error = BAD_EOF;
+                CX->error = BAD_EOF;
                 return;
             }
         }
@@ -1802,17 +3634,17 @@ SV htmlOut(char* s, FILE* fp) {         // text -> HTML
 
 SV GenerateDoc(void) {
     ParseFilename();
-    FILE* fpr = fopenx(tok, "r");
+    FILE* fpr = fopenx(CX->tok, "r");
     if (fpr == NULL) {
-        error = BAD_OPENFILE;  return;
+        CX->error = BAD_OPENFILE;  return;
     }
     ParseFilename();
-    FILE* fpw = fopenx(tok, "w");
+    FILE* fpw = fopenx(CX->tok, "w");
     if (fpw == NULL) {
-        error = BAD_CREATEFILE;
+        CX->error = BAD_CREATEFILE;
         fclose(fpr);   return;
     }
-    static char wikiline[LineBufferSize];
+    static THREAD_LOCAL char wikiline[LineBufferSize];
     long int org = 0;
     if (fpr) { // pull in the header
         while (1) {
@@ -1828,16 +3660,16 @@ SV GenerateDoc(void) {
         }
     } else
         fprintf(fpw, "<body>\n<h1>Chad Reference</h1>\n");
-    uint16_t i = wordlist[context()];
+    uint16_t i = CX->wordlist[context()];
     while (i) {
-        char* na = Header[i].name;
-        uint8_t fid = Header[i].srcFile;
-        if (Header[i].help[0]) {
+        char* na = CX->Header[i].name;
+        uint8_t fid = CX->Header[i].srcFile;
+        if (CX->Header[i].help[0]) {
             fprintf(fpw, "<a name=\"%s\"></a>\n", ReferenceString(i));
-            fprintf(fpw, "<h3><ref>%s:</ref> ", ref);
+            fprintf(fpw, "<h3><ref>%s:</ref> ", CX->ref);
             if (fid) {
                 fprintf(fpw, "<a href=\"../%s\">",
-                    FilePaths[fid].filepath);
+                    CX->FilePaths[fid].filepath);
                 htmlOut(na, fpw);
                 fprintf(fpw, "</a>");
             }
@@ -1846,8 +3678,9 @@ SV GenerateDoc(void) {
                 htmlOut(na, fpw);
                 fprintf(fpw, "</chad>");
             }
-            if (ReferenceStackPic) {
-                fprintf(fpw, " <com><i>( ");  htmlOut(ReferenceStackPic, fpw);
+            if (CX->ReferenceStackPic) {
+                fprintf(fpw, " <com><i>( ");
+                htmlOut(CX->ReferenceStackPic, fpw);
                 fprintf(fpw, " )</i></com>");
             }
             fprintf(fpw, "</h3>\n");
@@ -1889,7 +3722,7 @@ endparagraph:               if (found > 1)
                         if (command == '=') {
                             char* p = txt;
                             if ((p = strchr(txt, ':')) != NULL) *p++ = '\0';
-                            found = (strcmp(txt, ref) == 0);
+                            found = (strcmp(txt, CX->ref) == 0);
                         }
                     }
                 } while (processing);
@@ -1898,13 +3731,353 @@ endparagraph:               if (found > 1)
         else {
             fprintf(fpw, "<!-- No reference for %s -->\n", na);
         }
-        i = Header[i].link;             // traverse from oldest
+        i = CX->Header[i].link;         // traverse from oldest
     }
     fprintf(fpw, "</body>\n</html>\n");
     fclose(fpw);
     if (fpr) fclose(fpr);
 }
 
+//##############################################################################
+// Snapshots
+// A snapshot is the machine state: registers, memories, stacks, pending
+// events, the coprocessor and the flash, gecko and I/O peripherals. Taking
+// or restoring one is a few memcpys. The flash array is big, so restore
+// only copies it if the context's flash was written since the snapshot last
+// matched it. The compiler's headers aren't part of the snapshot.
+
+struct chadSnapshot {
+    struct chadContext* owner;          // context whose flash matches
+    uint32_t flashWrites;               // owner's flash.writes when it did
+    struct Machine m;
+    struct FlashContext flash;
+    struct GeckoContext gecko;
+    struct IOContext io;
+};
+
+// The field macros stand for members of CX->m. The same member of a saved
+// Machine is at the same offset.
+#define SNAPFIELD(s, field) \
+    ((void*)((char*)&(s)->m + ((char*)&(field) - (char*)&CX->m)))
+
+struct chadSnapshot* chadSnapshotNew(void) {
+    return calloc(1, sizeof(struct chadSnapshot));
+}
+
+void chadSnapshotFree(struct chadSnapshot* s) {
+    free(s);
+}
+
+void chadSnapshotTake(struct chadSnapshot* s) {
+    s->m = CX->m;
+    s->flash = CX->flash;
+    s->gecko = CX->gecko;
+    s->io = CX->io;
+    s->owner = CX;
+    s->flashWrites = CX->flash.writes;
+}
+
+void chadSnapshotRestore(struct chadSnapshot* s) {
+    uint16_t* code = SNAPFIELD(s, CX->m.Code);
+    for (int i = 0; i < CodeSize; i++)
+        if (CX->m.Code[i] != code[i])   // re-decode what changed
+            Undecode(i);
+    CX->m = s->m;
+    CX->gecko = s->gecko;
+    CX->io = s->io;
+    struct FlashContext* f = &CX->flash;
+    if ((s->owner != CX) || (s->flashWrites != f->writes)) {
+        memcpy(f->mem, s->flash.mem, FlashMemorySize);
+        f->writes++;
+    }
+    size_t skip = offsetof(struct FlashContext, boilerplate);
+    uint32_t writes = f->writes;
+    memcpy((char*)f + skip, (char*)&s->flash + skip,
+           sizeof(struct FlashContext) - skip);
+    f->writes = writes;
+    s->owner = CX;
+    s->flashWrites = writes;
+}
+
+// Snapshot files are only good for the build that wrote them. Event handlers
+// are saved as offsets from chadCycles.
+
+static const char SnapshotID[32] = "chad " __DATE__ " " __TIME__;
+
+static int64_t HandlerOffset(void (*handler)(void)) {
+    if (handler == NULL) return 0;
+    return (char*)handler - (char*)chadCycles;
+}
+
+int chadSnapshotSave(struct chadSnapshot* s, char* filename) {
+    FILE* fp = fopenx(filename, "wb");
+    if (fp == NULL) return BAD_CREATEFILE;
+    struct Event* ev = SNAPFIELD(s, CX->m.Events);
+    int64_t handlers[EVENTS];
+    for (int i = 0; i < EVENTS; i++)
+        handlers[i] = HandlerOffset(ev[i].handler);
+    uint32_t size = sizeof(struct chadSnapshot);
+    int ok = (fwrite(SnapshotID, sizeof(SnapshotID), 1, fp) == 1)
+          && (fwrite(&size, sizeof(size), 1, fp) == 1)
+          && (fwrite(&s->m, sizeof(s->m), 1, fp) == 1)
+          && (fwrite(&s->flash, sizeof(s->flash), 1, fp) == 1)
+          && (fwrite(&s->gecko, sizeof(s->gecko), 1, fp) == 1)
+          && (fwrite(&s->io, sizeof(s->io), 1, fp) == 1)
+          && (fwrite(handlers, sizeof(handlers), 1, fp) == 1);
+    fclose(fp);
+    return (ok) ? 0 : BAD_CREATEFILE;
+}
+
+int chadSnapshotLoad(struct chadSnapshot* s, char* filename) {
+    FILE* fp = fopenx(filename, "rb");
+    if (fp == NULL) return BAD_OPENFILE;
+    char id[sizeof(SnapshotID)];
+    uint32_t size = 0;
+    int64_t handlers[EVENTS];
+    int ok = (fread(id, sizeof(id), 1, fp) == 1)
+          && (fread(&size, sizeof(size), 1, fp) == 1)
+          && (memcmp(id, SnapshotID, sizeof(id)) == 0)
+          && (size == sizeof(struct chadSnapshot))
+          && (fread(&s->m, sizeof(s->m), 1, fp) == 1)
+          && (fread(&s->flash, sizeof(s->flash), 1, fp) == 1)
+          && (fread(&s->gecko, sizeof(s->gecko), 1, fp) == 1)
+          && (fread(&s->io, sizeof(s->io), 1, fp) == 1)
+          && (fread(handlers, sizeof(handlers), 1, fp) == 1);
+    fclose(fp);
+    if (!ok) return BAD_SNAPSHOT;
+    struct Event* ev = SNAPFIELD(s, CX->m.Events);
+    for (int i = 0; i < EVENTS; i++)
+        ev[i].handler = (handlers[i]) ? (void (*)(void))
+            ((char*)chadCycles + handlers[i]) : NULL;
+    s->owner = NULL;                    // flash must be copied
+    return 0;
+}
+
+// The Forth words use one snapshot per context. Restoring leaves the
+// interpreter's input line alone so the rest of the line is still parsed.
+
+SV Snapshot(void) {
+    if (CX->snap == NULL) CX->snap = chadSnapshotNew();
+    if (CX->snap == NULL) { CX->error = BAD_ALLOCATE;  return; }
+    chadSnapshotTake(CX->snap);
+}
+
+SV RestoreInput(struct chadSnapshot* s) {
+    static THREAD_LOCAL cell tib[CELL_ADDR(MaxLineLength)];
+    cell addr = DataSize - CELL_ADDR(MaxLineLength);
+    cell in = TOIN, len = TIBS, at = ATIB;
+    memcpy(tib, &CX->m.Data[addr], sizeof(tib));
+    chadSnapshotRestore(s);
+    memcpy(&CX->m.Data[addr], tib, sizeof(tib));
+    TOIN = in;  TIBS = len;  ATIB = at;
+}
+
+SV Restore(void) {
+    if (CX->snap == NULL) { CX->error = BAD_NOSNAPSHOT;  return; }
+    RestoreInput(CX->snap);
+}
+
+SV SaveSnapshot(void) {
+    ParseFilename();
+    if (CX->snap == NULL) { CX->error = BAD_NOSNAPSHOT;  return; }
+    int r = chadSnapshotSave(CX->snap, CX->tok);
+    if (r) CX->error = r;
+}
+
+SV LoadSnapshot(void) {
+    ParseFilename();
+    if (CX->snap == NULL) CX->snap = chadSnapshotNew();
+    if (CX->snap == NULL) { CX->error = BAD_ALLOCATE;  return; }
+    int r = chadSnapshotLoad(CX->snap, CX->tok);
+    if (r) CX->error = r;
+}
+
+//##############################################################################
+// Record and replay
+// `record` keeps the keyboard reads of each run from the interpreter and a
+// snapshot every so many cycles, the keyframes. Everything else the machine
+// does follows from those. Going back to an earlier cycle restores the
+// keyframe before it and replays the log up to there. Only the last
+// ReplayFrames keyframes are kept, which limits how far back you can go.
+// Where the replay stops becomes the end of the recording, so `resume`
+// goes forward from there with the live keyboard.
+
+static void RecorderFree(struct Recorder* r) {
+    if (r == NULL) return;
+    for (int i = 0; i < ReplayFrames; i++)
+        chadSnapshotFree(r->frames[i].shot);
+    free(r->log);
+    free(r);
+}
+
+SV TakeKeyframe(void) {
+    struct Recorder* r = CX->recorder;
+    if (r->kept == ReplayFrames) {      // forget the oldest, reuse its shot
+        struct Keyframe oldest = r->frames[0];
+        memmove(&r->frames[0], &r->frames[1],
+                (ReplayFrames - 1) * sizeof(struct Keyframe));
+        r->frames[--r->kept] = oldest;
+    }
+    struct Keyframe* f = &r->frames[r->kept];
+    if (f->shot == NULL) f->shot = chadSnapshotNew();
+    if (f->shot == NULL) { CX->error = BAD_ALLOCATE;  return; }
+    chadSnapshotTake(f->shot);
+    f->when = Now();
+    f->before = CX->cycleBase;
+    r->kept++;
+}
+
+SV KeyframeEvent(void) {                // rescheduled before the snapshot
+    struct Recorder* r = CX->recorder;  // so a restored one goes on
+    if (r == NULL) return;              // record is off, or a soc-run core
+    chadSchedule(EVENT_KEYFRAME, CX->m.cycles + r->interval, KeyframeEvent);
+    if (!r->replaying) TakeKeyframe();
+}
+
+SV RecordRun(uint8_t mark) {            // a run from the interpreter starts
+    struct Recorder* r = CX->recorder;
+    if (r == NULL) return;
+    r->count = r->next = 0;
+    r->kept = 0;
+    r->mark = mark;
+    r->replaying = 0;
+    chadSchedule(EVENT_KEYFRAME, CX->m.cycles + r->interval, KeyframeEvent);
+    TakeKeyframe();
+}
+
+SI FrameBefore(uint64_t when) {         // the last keyframe before `when`
+    int k = CX->recorder->kept;
+    while (k && (CX->recorder->frames[k - 1].when >= when)) k--;
+    return k - 1;                       // -1 if there isn't one
+}
+
+SV ReplayBegin(void) {                  // the keyboard comes from the log
+    CX->recorder->replaying = 1;
+    CX->recorder->watchWas = CX->dataWatch;
+    CX->dataWatch = 0;                  // already counted, already hit
+}
+
+SV ReplayEnd(void) {
+    CX->recorder->replaying = 0;
+    CX->dataWatch = CX->recorder->watchWas;
+}
+
+SI ReplayTo(uint64_t when) {            // be as the machine was at `when`
+    struct Recorder* r = CX->recorder;
+    int k = FrameBefore(when + 1);
+    if (k < 0) return BAD_NORECORDING;
+    struct Keyframe* f = &r->frames[k];
+    RestoreInput(f->shot);
+    CX->cycleBase = f->before;
+    r->next = 0;
+    while ((r->next < r->count) && (r->log[r->next].when < f->when))
+        r->next++;
+    ReplayBegin();
+    if (when > Now())                   // stops at the first instruction
+        chadRun(when - Now(), CHAD_STOP_ERROR);     // at or after `when`
+    ReplayEnd();
+    return CX->error;
+}
+
+SV Landed(void) {                       // the recording ends here
+    struct Recorder* r = CX->recorder;
+    uint64_t now = Now();
+    while (r->count && (r->log[r->count - 1].when >= now))
+        r->count--;
+    while ((r->kept > 1) && (r->frames[r->kept - 1].when > now))
+        r->kept--;
+    char what[32];
+    snprintf(what, sizeof(what), "Cycle %" PRIu64, now);
+    BreakStop(what, r->mark);
+}
+
+SV Record(void) {                       // ( interval -- )
+    uint64_t interval = (uint32_t)Dpop();
+    if (interval == 0) {
+        RecorderFree(CX->recorder);
+        CX->recorder = NULL;
+        chadCancel(EVENT_KEYFRAME);
+        return;
+    }
+    if (CX->recorder == NULL) CX->recorder = calloc(1, sizeof(struct Recorder));
+    if (CX->recorder == NULL) { CX->error = BAD_ALLOCATE;  return; }
+    CX->recorder->interval = interval;
+}
+
+// An instruction that waits skips cycles, so the cycle before this one may
+// be inside it. Then the instructions since the keyframe are stepped to
+// find where it started.
+
+SV ReverseStep(void) {                  // back one instruction
+    struct Recorder* r = CX->recorder;
+    uint64_t now = (r) ? Now() : 0;
+    if ((r == NULL) || (FrameBefore(now) < 0)) {
+        CX->error = BAD_NORECORDING;  return;
+    }
+    int e = ReplayTo(now - 1);
+    if ((e == 0) && (Now() >= now)) {
+        e = ReplayTo(r->frames[FrameBefore(now)].when);
+        uint64_t last = Now();
+        ReplayBegin();
+        while ((e == 0) && (Now() < now)) {
+            last = Now();
+            int s = CPUsim(1);
+            if (s < 0) e = s;
+            else e = CX->error;
+        }
+        ReplayEnd();
+        if (e == 0) e = ReplayTo(last);
+    }
+    if (e) { CX->error = e;  return; }
+    Landed();
+}
+
+// The keyframes are replayed from the latest back, with breakpoints and
+// watchpoints on, until one has a hit before the current cycle. The last
+// hit in it is where to go.
+
+SV ReverseContinue(void) {              // back to the last break or watch
+    struct Recorder* r = CX->recorder;
+    if (r == NULL) { CX->error = BAD_NORECORDING;  return; }
+    uint64_t now = Now(), hit = 0;
+    int found = 0, e = 0;
+    struct chadStatus s = { 0 }, last = { 0 };
+    uint8_t heat = CX->heating;
+    CX->heating = 0;
+    for (int k = FrameBefore(now); (k >= 0) && !found && !e; k--) {
+        uint64_t end = now;
+        if ((k + 1 < r->kept) && (r->frames[k + 1].when < now))
+            end = r->frames[k + 1].when;
+        e = ReplayTo(r->frames[k].when);
+        ReplayBegin();
+        CX->dataWatch = (CX->watchpoints != 0);
+        if ((e == 0) && CX->Breakpoints[CX->m.pc & (CodeSize - 1)]
+            && (Now() < now) && BreakTaken()) {          // chadRun would step off this one
+            hit = Now();  found = 1;  last.reason = CHAD_STOP_BREAK;
+        }
+        while ((e == 0) && (Now() < end)) {
+            s = chadRun(end - Now(),
+                CHAD_STOP_BREAK | CHAD_STOP_WATCH | CHAD_STOP_ERROR);
+            e = CX->error;
+            if (((s.reason != CHAD_STOP_BREAK)
+              && (s.reason != CHAD_STOP_WATCH)) || (Now() >= now))
+                break;
+            hit = Now();  found = 1;  last = s;
+        }
+        ReplayEnd();
+    }
+    CX->heating = heat;
+    if (e == 0) e = ReplayTo((found) ? hit : now);
+    if (e) { CX->error = e;  return; }
+    if (!found)
+        printf("No breakpoint or watchpoint hit since cycle %" PRIu64 "\n",
+            r->frames[0].when);
+    else if (last.reason == CHAD_STOP_WATCH)
+        printf("%s [%Xh] at PC=%Xh\n", (CX->watchKind == CHAD_WATCH_READ)
+            ? "Read" : "Write", BYTE_ADDR(CX->watchAddr), CX->watchPC);
+    Landed();
+}
+
 //##############################################################################
 // Compile to SPI flash memory image
 
@@ -1912,16 +4085,16 @@ endparagraph:               if (found > 1)
 // MakeBootList uses all the same key, to be the key's reset value on the target.
 // Output to flash is via flashC8.
 
-static uint32_t signature, flashPtr;
-
 SV flashC8(uint8_t c) {
-    signature = crcbyte(c, signature);
-    FlashMemStore(flashPtr++, c ^ GeckoByte());
+    CX->signature = crcbyte(c, CX->signature);
+    FlashMemStore(CX->flashPtr++, c ^ GeckoByte());
 }
 
-SV AddBootKey(void)     { ChadBootKey = (ChadBootKey << CELLBITS) + Dpop(); }
-SV forg(void)           { flashPtr = Dpop(); }
-SV fhere(void)          { Dpush(flashPtr); }
+SV AddBootKey(void)     {
+    CX->io.ChadBootKey = (CX->io.ChadBootKey << CELLBITS) + Dpop();
+}
+SV forg(void)           { CX->flashPtr = Dpop(); }
+SV fhere(void)          { Dpush(CX->flashPtr); }
 SV flashC16(uint16_t w) { flashC8(w >> 8);  flashC8((uint8_t)w); }
 
 SV flashAN(uint16_t addr, uint16_t len) { 
@@ -1989,11 +4162,9 @@ SV flashStr(char* s, int escaped) {     // compile string to flash
 // flash address to set the key. f$type needs to load this key
 // unless the string is plaintext, in which case no key is needed.
 
-uint64_t ChadTextKey = 0;
-
 SV NewTextKey(void) {
-    if (ChadTextKey) {
-        GeckoLoad((ChadTextKey << CELLBITS) | (flashPtr & CELLMASK));
+    if (CX->ChadTextKey) {
+        GeckoLoad((CX->ChadTextKey << CELLBITS) | (CX->flashPtr & CELLMASK));
         GeckoByte();
     }
     else
@@ -2002,38 +4173,56 @@ SV NewTextKey(void) {
 
 SV xfcQuote(int escaped) {
     NewTextKey();
-    if (flashPtr > CELLMASK)            // string must be 1-cell addressable
-        error = BAD_FSOVERFLOW;
+    if (CX->flashPtr > CELLMASK)        // string must be 1-cell addressable
+        CX->error = BAD_FSOVERFLOW;
     parseword('"');
-    flashC8((uint8_t)strlen(tok));      // string length
-    flashStr(tok, escaped);             // string
+    flashC8((uint8_t)strlen(CX->tok));  // string length
+    flashStr(CX->tok, escaped);         // string
 }
 SV fcQuote(void) { xfcQuote(0); }
 SV feQuote(void) { xfcQuote(1); }
-SV CfcQuote(void) { Literal(flashPtr);  fcQuote(); }
-SV CfeQuote(void) { Literal(flashPtr);  feQuote(); }
-SV dotQuote(void) { Literal(flashPtr);  fcQuote();  CompCall(Ctick("f$type")); }
-SV desQuote(void) { Literal(flashPtr);  feQuote();  CompCall(Ctick("f$type")); }
+SV CfcQuote(void) { Literal(CX->flashPtr);  fcQuote(); }
+SV CfeQuote(void) { Literal(CX->flashPtr);  feQuote(); }
+SV dotQuote(void) {
+    Literal(CX->flashPtr);  fcQuote();  CompCall(Ctick("f$type"));
+}
+SV desQuote(void) {
+    Literal(CX->flashPtr);  feQuote();  CompCall(Ctick("f$type"));
+}
 
 SV AddTextKey(void) {
-    ChadTextKey = (ChadTextKey << CELLBITS) + Dpop();
+    CX->ChadTextKey = (CX->ChadTextKey << CELLBITS) + Dpop();
 }
 SV ExecTextKey(void) {
-    Dpush(ChadTextKey & CELLMASK);  Dpush((cell)(ChadTextKey >> CELLBITS));
+    Dpush(CX->ChadTextKey & CELLMASK);
+    Dpush((cell)(CX->ChadTextKey >> CELLBITS));
 }
 SV CompTextKey(void) {
-    Literal(ChadTextKey & CELLMASK);  Literal((cell)(ChadTextKey >> CELLBITS));
+    Literal(CX->ChadTextKey & CELLMASK);
+    Literal((cell)(CX->ChadTextKey >> CELLBITS));
+}
+
+SV flashCode(uint16_t from, uint16_t to) {
+    flashAN(from, to - from);
+    flashC8(1);                         // 16-bit code write
+    for (uint16_t i = from; i < to; i++) {
+        flashC16(CX->m.Code[i]);
+    }
 }
 
 // Write boot data to flash memory image in `flash.c`
-SV MakeAPIlist(uint16_t cp0, uint16_t dp0) {
-    GeckoLoad(ChadBootKey);
-    signature = 0xFFFFFFFF;
+// If keep is not NULL, only runs of code it marks are written.
+SV MakeAPIlist(uint16_t cp0, uint16_t dp0, const uint8_t* keep) {
+    GeckoLoad(CX->io.ChadBootKey);
+    CX->signature = 0xFFFFFFFF;
     flashC8(0x80);                      // speed up SCLK
-    flashAN(cp0, CP - cp0);
-    flashC8(1);                         // 16-bit code write
-    for (uint16_t i = cp0; i < CP; i++) {
-        flashC16(Code[i]);
+    if (keep == NULL)
+        flashCode(cp0, CP);
+    else for (uint16_t i = cp0; i < CP; ) {
+        uint16_t end = i;
+        while ((end < CP) && keep[end]) end++;
+        if (end > i) flashCode(i, end);
+        i = end + 1;
     }
     uint16_t count = DP - dp0;
     if (count) {
@@ -2041,21 +4230,108 @@ SV MakeAPIlist(uint16_t cp0, uint16_t dp0) {
         flashAN(CELL_ADDR(dp0), count);
         flashC8(3 + bytes);             // 16-bit data write
         for (uint16_t i = 0; i < count; i++) {
-            cell x = Data[i];
+            cell x = CX->m.Data[i];
             uint8_t j = bytes;
             while (j)
                 flashC8((uint8_t)(x >> (8 * --j)));
         }
     }
-    uint16_t sig_hi = signature >> 16;
-    uint16_t sig_lo = signature & 0xFFFF;
+    uint16_t sig_hi = CX->signature >> 16;
+    uint16_t sig_lo = CX->signature & 0xFFFF;
     flashC8(0xE0);                      // end bootup
     flashC16(sig_hi);                   // 32-bit signature
     flashC16(sig_lo);
 }
 
 SV MakeBootList(void) { 
-    MakeAPIlist(0, 0);
+    MakeAPIlist(0, 0, NULL);
+}
+
+// A lean boot image leaves out the definitions that nothing can reach.
+// The roots are the vectors, `throw` and words marked by `keep` or written
+// to flash by `make-heads`. Code is kept a definition at a time, from one
+// header's target up to the next. A call or jump into a definition reaches
+// it, and so does a literal or data cell that equals its xt. A trap reaches
+// its vector, and the xt it passes to it like a literal.
+// Nothing is moved: xts are in data space, in flash headers and in the
+// host's headers that applets are compiled against. So the boot stream gets
+// shorter but code space doesn't. A target that has its headers can look up
+// any of those words, so make-heads leaves little or nothing to drop.
+
+static THREAD_LOCAL uint8_t Starts[CodeSize], Reach[CodeSize];
+static THREAD_LOCAL uint16_t ReachStack[CodeSize];
+static THREAD_LOCAL int reachSP;
+
+SV ReachCode(cell a, int exact) {       // keep the definition at a
+    if ((a >= CP) || (exact && !Starts[a])) return;
+    while (!Starts[a]) a--;
+    if (Reach[a]) return;
+    Reach[a] = 1;
+    ReachStack[reachSP++] = (uint16_t)a;
+}
+
+SV ReachFrom(cell a) {                  // follow the definition at a
+    cell hi = 0;                        // what LITX put in LEX
+    for (cell i = a; (i < CP) && ((i == a) || !Starts[i]); i++) {
+        uint16_t insn = CX->m.Code[i];
+        switch (INST(insn)) {
+        case INST(jump):
+        case INST(zjump):
+        case INST(call):
+            ReachCode((hi << 13) | (insn & 0x1FFF), 0);  break;
+        case INST(lit):
+            if (!(insn & litSign)) ReachCode((hi << 12) | (insn & 0xFFF), 1);
+            break;
+        case INST(trap):
+            ReachCode(TrapVector + ((insn & trapID1) ? 1 : 0), 0);
+            ReachCode((hi << 12) | (insn & 0xFFF), 1);  break;
+        default: break;
+        }
+        Reach[i] = 1;
+        hi = ((insn & 0xF000) == litx) ? (hi << 12) | (insn & 0xFFF) : 0;
+    }
+}
+
+SV MakeLeanBoot(void) {
+    memset(Starts, 0, sizeof(Starts));
+    memset(Reach, 0, sizeof(Reach));
+    Starts[0] = 1;
+    for (int i = 1; i <= CX->hp; i++)
+        if ((CX->Header[i].target) && (CX->Header[i].target < CP))
+            Starts[CX->Header[i].target] = 1;
+    reachSP = 0;
+    for (cell a = 0; a <= ExceptionVector; a++) ReachCode(a, 0);
+    if (FindWord("throw") >= 0) ReachCode(CX->Header[CX->me].target, 0);
+    int heads = 0;
+    for (int i = 1; i <= CX->hp; i++)
+        if (CX->Header[i].keep) {
+            ReachCode(CX->Header[i].target, 0);
+            if (CX->Header[i].keep & 2) heads++;
+        }
+    cell cells = (DP < DataSize) ? DP : DataSize;
+    for (cell i = 0; i < cells; i++) ReachCode(CX->m.Data[i], 1);
+    while (reachSP) ReachFrom(ReachStack[--reachSP]);
+    int kept = 0;
+    for (cell a = 0; a < CP; a++) kept += Reach[a];
+    MakeAPIlist(0, 0, Reach);
+    printf("%d of %d instructions booted\n", kept, (int)CP);
+    if (heads)
+        printf("%d words kept because make-heads wrote their headers\n", heads);
+}
+
+SV Booted(void) {                       // ( xt -- flag )
+    cell xt = Dpop();
+    Dpush(((xt < CodeSize) && Reach[xt]) ? CELLMASK : 0);
+}
+
+SV Keep(void) {                         // ( <name> -- )
+    parseword(' ');
+    if (FindWord(CX->tok) < 0) {
+        CX->error = UNRECOGNIZED;
+        return;
+    }
+    CX->Header[CX->me].keep |= 1;
+    LogColor(COLOR_WORD, CX->me, CX->tok);
 }
 
 SV BootNrun(void) {
@@ -2095,8 +4371,8 @@ static char* FnTargetName(void (*fn)()) { // target: ( w -- )
 // Common Forth primitives will be found sooner.
 
 SV MakeHeaders(void) {
-    for (uint8_t i = wordlists; i > 0; i--) {
-        char* wname = &wordlistname[i][0];
+    for (uint8_t i = CX->wordlists; i > 0; i--) {
+        char* wname = &CX->wordlistname[i][0];
         size_t len = strlen(wname);
         NewTextKey();
         flashC8((uint8_t)len);          // begin wordlist with its name
@@ -2105,32 +4381,35 @@ SV MakeHeaders(void) {
         NewTextKey();
         flashC8((uint8_t)len);
         uint32_t link = 0;
-        uint16_t p = wordlist[i];
+        uint16_t p = CX->wordlist[i];
         while (p) {
-            char* exec = FnTargetName(Header[p].ExecFn);
-            char* comp = FnTargetName(Header[p].CompFn);
+            char* exec = FnTargetName(CX->Header[p].ExecFn);
+            char* comp = FnTargetName(CX->Header[p].CompFn);
             if ((exec) && (comp)) {
                 NewTextKey();
-                uint32_t nextlink = flashPtr;
+                uint32_t nextlink = CX->flashPtr;
                 flashCC(link);
                 link = nextlink;
-                wname = Header[p].name;
+                wname = CX->Header[p].name;
                 len = strlen(wname);
                 flashC8((uint8_t)len);
                 for (size_t i = 0; i < len; i++)
                     flashC8(*wname++);
-                flashCC(Header[p].w);
+                flashCC(CX->Header[p].w);
+                CX->Header[p].keep |= 2; // the target can find it
                 flashCC(Ctick(exec));   // target versions of host fns
+                CX->Header[CX->me].keep |= 1;
                 flashCC(Ctick(comp));
-                flashCC(Header[p].applet);
+                CX->Header[CX->me].keep |= 1;
+                flashCC(CX->Header[p].applet);
                 uint8_t flags = 0xFF;
-                if (Header[p].smudge == 0) flags &= ~0x80;
-                if (Header[p].notail)      flags &= ~0x01;
+                if (CX->Header[p].smudge == 0) flags &= ~0x80;
+                if (CX->Header[p].notail)      flags &= ~0x01;
                 flashC8(flags);
             }
-            p = Header[p].link;
+            p = CX->Header[p].link;
         }
-        Data[wids + i - 1] = link;
+        CX->m.Data[wids + i - 1] = link;
     }
 }
 
@@ -2139,52 +4418,50 @@ To do:
 Add locals, applets, and cache size stuff to the wiki pages
 */
 
-SI appletCP, appletDP, appletPage;
-
 SV BeginApplet(void) {  // ( addr -- )
-    appletCP = CP; CP = CodeSize - CodeCache;
-    appletDP = DP; DP = BYTE_ADDR(DataSize - DataCache);
-    isAPI = (Dpop() + 0xFF) >> 8;
-    appletPage = isAPI << 8;
+    CX->appletCP = CP; CP = CodeSize - CodeCache;
+    CX->appletDP = DP; DP = BYTE_ADDR(DataSize - DataCache);
+    CX->isAPI = (Dpop() + 0xFF) >> 8;
+    CX->appletPage = CX->isAPI << 8;
 }
 
 SV EndApplet(void) {
-    uint32_t fp = flashPtr;
-    flashPtr = isAPI << 8;              // 256-byte pages
-    MakeAPIlist(CodeSize - CodeCache, BYTE_ADDR(DataSize - DataCache));
-    CP = appletCP;
-    DP = appletDP;
-    appletPage = flashPtr;
-    flashPtr = fp;                      // restore fp tp point to text region
-    isAPI = 0;
+    uint32_t fp = CX->flashPtr;
+    CX->flashPtr = CX->isAPI << 8;      // 256-byte pages
+    MakeAPIlist(CodeSize - CodeCache, BYTE_ADDR(DataSize - DataCache), NULL);
+    CP = CX->appletCP;
+    DP = CX->appletDP;
+    CX->appletPage = CX->flashPtr;
+    CX->flashPtr = fp;                  // restore fp tp point to text region
+    CX->isAPI = 0;
     // wipe cache so you can't execute it without loading from flash image
     for (int i = 0; i < CodeCache; i++) {
         chadToCode(i + CodeSize - CodeCache, 0);
     }
 }
 
-SV AppletPage(void)   { Dpush(appletPage);   }
-SV ToAppletPage(void) { appletPage = Dpop(); }
+SV AppletPage(void)   { Dpush(CX->appletPage);   }
+SV ToAppletPage(void) { CX->appletPage = Dpop(); }
 
 // Dump internal state in text format for file comparison tools like WinMerge.
 
 SV SaveChadState(void) {
     ParseFilename();
-    FILE* fp = fopenx(tok, "w");
+    FILE* fp = fopenx(CX->tok, "w");
     if (fp == NULL)
-        error = BAD_CREATEFILE;
+        CX->error = BAD_CREATEFILE;
     else {
         fprintf(fp, "Code Memory\n");
         for (int i = 0; i < CodeSize; i++) {
             if ((i & 15) == 0) fprintf(fp, "%03X: ", i);
-            fprintf(fp, "%04X", Code[i]);
+            fprintf(fp, "%04X", CX->m.Code[i]);
             if ((i & 15) == 15) fprintf(fp, "\n");
             else fprintf(fp, " ");
         }
         fprintf(fp, "Data Memory\n");
         for (int i = 0; i < DataSize; i++) {
             if ((i & 7) == 0) fprintf(fp, "%03X: ", i);
-            fprintf(fp, "%s", itos(Data[i], 16, (CELLBITS + 3) / 4, 1));
+            fprintf(fp, "%s", itos(CX->m.Data[i], 16, (CELLBITS + 3) / 4, 1));
             if ((i & 7) == 7) fprintf(fp, "\n");
             else fprintf(fp, " ");
         }
@@ -2201,7 +4478,7 @@ SV SaveChadState(void) {
 // 4	  U + 10000  U + 10FFFF  11110xxx	10xxxxxx	10xxxxxx	10xxxxxx
 
 CELL getUTF8(void) {
-    char* p = tok;  cell c = *p++;
+    char* p = CX->tok;  cell c = *p++;
     if ((c & 0x80) == 0x00) return c;                       // 1-char UTF-8
     uint32_t d = *p++ & 0x3F;
     if ((c & 0xE0) == 0xC0) return ((c & 0x1F) << 6) | d;   // 2-char UTF-8
@@ -2224,7 +4501,508 @@ SV Variable   (void) { Align();  buffer(CELLS); }
 SV Twovariable(void) { Variable();  allot(CELLS); }
 SV Char       (void) { parseword(' ');  Dpush(getUTF8()); }
 SV BrackChar  (void) { parseword(' ');  Literal(getUTF8()); }
-SV LogSteps   (void) { logging = Dpop(); }
+SV LogSteps(void) {                     // ( steps -- )
+    CX->logging = Dpop();
+    if (CX->logging == 0) TraceClose(); // stop early
+}
+
+SV TraceDump(void) {                    // ( <filename> -- )
+    ParseFilename();
+    int64_t steps = TraceDecode(SIM_FILENAME, CX->tok);
+    if (steps < 0) CX->error = (int)steps;
+    else printf("%" PRId64 " steps\n", steps);
+}
+
+SV SetEngine(void) {                    // ( n -- )
+    int n = Dpop();
+    if (((unsigned)n >= (sizeof(Engines) / sizeof(Engines[0])))
+        || (Engines[n][0] == NULL))
+        CX->error = BAD_UNSUPPORTED;
+    else
+        CX->engine = n;
+}
+
+SV SetFusion(void) {                    // ( mask -- )
+    CX->fusionMask = Dpop() & ((1 << FUSIONS) - 1);
+    for (int i = 0; i < (int)FUSIONS; i++)
+        CX->fusionHits[i] = 0;
+    for (int i = 0; i < CodeSize; i++)
+        CX->Decode[i].op = OP_UNDECODED;
+}
+
+SV ShowFusion(void) {
+    for (int i = 0; i < (int)FUSIONS; i++) {
+        struct Fusion* f = &Fusions[i];
+        printf("%c %d %-20s %" PRId64 "\n",
+            (CX->fusionMask & (1 << i)) ? '*' : ' ',
+            1 << i, f->name, CX->fusionHits[i]);
+    }
+}
+
+SV SetProfile(void) {                   // ( flag -- )
+    if (Dpop()) {
+        memset(CX->Profile, 0, sizeof(CX->Profile));
+        CX->profSP = CX->profPrev = 0;
+        CX->profHP = -1;                // build the owner map
+        CX->profiling = 1;
+    } else if (CX->profiling) {
+        ProfileFlush();
+        for (int i = 0; i < CX->profSP; i++)
+            CX->Profile[CX->ProfStack[i].word].active = 0;
+        CX->profSP = CX->profPrev = 0;
+        CX->profiling = 0;
+    }
+}
+
+// Names for the instruction mix
+
+static const char* OpNames[] = {
+    "?", "alu", "nop", "lit", "lit-", "trap", "trap-", "zjump", "litx",
+    "cop", "user", "jump", "call"
+};
+
+static const char* AluNames[MixALU] = {
+    "T", "T0<", "T2/", "T2*", "T+N", "T&N", "T^N", "?",
+    "><", "N", "R", "R-1", "io", "M", "T0=", "status",
+    "COP", "C", "cT2/", "T2*c", "?", "?", "~T", "?",
+    "><16", "A", "?", "?", "?", "?", "?", "?"
+};
+
+static const char* NthName(const char* list, int n) { // in a \0 list
+    while (n--) list += strlen(list) + 1;
+    return list;
+}
+
+static const char* StrobeName(int n) {
+    if (n == 0) return "none";
+    return (n & 8) ? NthName(STROBEnames1, n & 7) : NthName(STROBEnames0, n);
+}
+
+static char* StackName(int n) {         // insn[3:0]
+    static THREAD_LOCAL char name[16];
+    const char* s = NthName("\0S+\0--\0S-", n & 3);
+    const char* r = NthName("\0R+\0ret\0R-", n >> 2);
+    snprintf(name, sizeof(name), "%s%s%s", s, (*s && *r) ? " " : "", r);
+    if (name[0] == 0) strmove(name, "none", sizeof(name));
+    return name;
+}
+
+static const char* KindName(int kind) {
+    return (kind < MixALU) ? AluNames[kind] : OpNames[kind - MixALU];
+}
+
+SV SetMix(void) {                       // ( flag -- )
+    CX->mixing = (Dpop() != 0);
+    if (CX->mixing) {
+        memset(&CX->Mix, 0, sizeof(CX->Mix));
+        CX->Mix.prev = MixKinds;        // no pair yet
+    }
+}
+
+static int CompareCounts(const void* a, const void* b) {
+    uint64_t x = **(uint64_t* const*)a;
+    uint64_t y = **(uint64_t* const*)b;
+    return (x < y) - (x > y);           // descending
+}
+
+SV ShowMixGroup(char* title, uint64_t* counts, int n, int group) {
+    uint64_t sum = 0;
+    for (int i = 0; i < n; i++) sum += counts[i];
+    printf("%s:\n", title);
+    for (int i = 0; i < n; i++) {
+        if (counts[i] == 0) continue;
+        const char* name = (group == 0) ? OpNames[i]
+            : (group == 1) ? AluNames[i]
+            : (group == 2) ? StrobeName(i) : StackName(i);
+        printf("%12" PRId64 " %6.2f  %s\n", counts[i], 100.0 * counts[i] / sum,
+            name);
+    }
+}
+
+SV ShowMix(void) {
+    ShowMixGroup("Instructions", CX->Mix.op, OP_CALL + 1, 0);
+    ShowMixGroup("ALU selects", CX->Mix.alu, MixALU, 1);
+    ShowMixGroup("ALU strobes", CX->Mix.strobe, 16, 2);
+    ShowMixGroup("ALU stack fields", CX->Mix.stack, 16, 3);
+    static THREAD_LOCAL uint64_t* pairs[MixKinds * MixKinds];
+    for (int i = 0; i < MixKinds * MixKinds; i++)
+        pairs[i] = &CX->Mix.pairs[0][0] + i;
+    qsort(pairs, MixKinds * MixKinds, sizeof(uint64_t*), CompareCounts);
+    printf("Most frequent pairs:\n");
+    for (int i = 0; (i < 16) && *pairs[i]; i++) {
+        int n = (int)(pairs[i] - &CX->Mix.pairs[0][0]);
+        printf("%12" PRId64 "  %s %s\n", *pairs[i],
+            KindName(n / MixKinds), KindName(n % MixKinds));
+    }
+}
+
+SV SaveMix(void) {                      // ( <filename> -- )
+    ParseFilename();
+    FILE* fp = fopenx(CX->tok, "w");
+    if (fp == NULL) {
+        CX->error = BAD_CREATEFILE;  return;
+    }
+    fprintf(fp, "group,name,count\n");
+    for (int i = 1; i <= OP_CALL; i++)
+        fprintf(fp, "class,%s,%" PRId64 "\n", OpNames[i], CX->Mix.op[i]);
+    for (int i = 0; i < MixALU; i++)
+        if (AluNames[i][0] != '?')
+            fprintf(fp, "alu,%s,%" PRId64 "\n", AluNames[i], CX->Mix.alu[i]);
+    for (int i = 0; i < 16; i++)
+        fprintf(fp, "strobe,%s,%" PRId64 "\n",
+            StrobeName(i), CX->Mix.strobe[i]);
+    for (int i = 0; i < 16; i++)
+        fprintf(fp, "stack,%s,%" PRId64 "\n", StackName(i), CX->Mix.stack[i]);
+    for (int i = 0; i < MixKinds; i++)
+        for (int j = 0; j < MixKinds; j++)
+            if (CX->Mix.pairs[i][j])
+                fprintf(fp, "pair,%s %s,%" PRId64 "\n",
+                    KindName(i), KindName(j), CX->Mix.pairs[i][j]);
+    fclose(fp);
+}
+
+// Code coverage: While `coverage` is on, the instrumented simulator loop sets
+// a bit in Covered[] for each code address it fetches from. Definitions map
+// back to their source lines through srcFile and srcLine, so the HTML copies
+// of the source files can be marked up with what ran. Applet words share the
+// cache region, so they are left out.
+
+SV SetCoverage(void) {                  // ( flag -- )
+    CX->covering = (Dpop() != 0);
+    if (CX->covering) memset(CX->Covered, 0, sizeof(CX->Covered));
+}
+
+SI Coverable(int i) {                   // a definition in Code[]
+    struct Keyword* h = &CX->Header[i];
+    return (h->length != 0) && (h->applet == 0) && (h->srcFile != 0)
+        && ((h->target + h->length) <= CodeSize);
+}
+
+SI CoveredCount(int i) {                // executed addresses of a definition
+    int n = 0;
+    cell end = CX->Header[i].target + CX->Header[i].length;
+    for (cell a = CX->Header[i].target; a < end; a++)
+        if (CX->Covered[a >> 3] & (1 << (a & 7))) n++;
+    return n;
+}
+
+SV ShowCoverage(void) {
+    int words = 0, ran = 0, size = 0, hits = 0;
+    printf("Never executed:\n");
+    for (int i = 1; i <= CX->hp; i++) {
+        if (!Coverable(i)) continue;
+        int n = CoveredCount(i);
+        words++;  size += CX->Header[i].length;
+        hits += n;  ran += (n != 0);
+        if (n == 0) printf("%s ", CX->Header[i].name);
+    }
+    printf("\n%d of %d definitions executed, %d of %d instructions\n",
+        ran, words, hits, size);
+}
+
+SI SameSource(int fid, char* path) {    // fid is an include of path
+    return (fid > 0) && (fid <= CX->fileID)
+        && (strcmp(CX->FilePaths[fid].filepath, path) == 0);
+}
+
+// Mark up one line of an HTML source copy. The line gets a background color:
+// green if the definitions that start on it ran completely, yellow if partly,
+// red if not at all. The tooltip lists them with their executed instructions.
+
+SV CoverLine(FILE* fp, char* line, int lineno, char* path) {
+    static const uint32_t colors[3] = { 0xFFCCCC, 0xFFF0AA, 0xCCFFCC };
+    int size = 0, hits = 0;
+    for (int i = 1; i <= CX->hp; i++)
+        if (Coverable(i) && (CX->Header[i].srcLine == lineno)
+            && SameSource(CX->Header[i].srcFile, path)) {
+            size += CX->Header[i].length;
+            hits += CoveredCount(i);
+        }
+    if (size == 0) {
+        fprintf(fp, "%s\n", line);  return;
+    }
+    int color = (hits == 0) ? 0 : (hits < size) ? 1 : 2;
+    fprintf(fp, "<span class=\"cov\" style=\"background-color:#%06X\" "
+        "title=\"", colors[color]);
+    for (int i = 1; i <= CX->hp; i++)
+        if (Coverable(i) && (CX->Header[i].srcLine == lineno)
+            && SameSource(CX->Header[i].srcFile, path)) {
+            htmlOut(CX->Header[i].name, fp);
+            fprintf(fp, " %d/%d ", CoveredCount(i), (int)CX->Header[i].length);
+        }
+    fprintf(fp, "\">%s</span>\n", line);
+}
+
+// The HTML copy of a source file has the source lines after the <hr> line,
+// preceded by an empty line, so line numbers are counted from there. An
+// earlier markup is removed first.
+
+SI CoverFile(char* path) {              // 0 if the HTML file was marked up
+    char name[LineBufferSize];
+    strmove(name, path, LineBufferSize);
+    char* html = RefPath(name);
+    FILE* fp = fopenx(html, "r");
+    if (fp == NULL) return BAD_OPENFILE;
+    fseek(fp, 0, SEEK_END);
+    long len = ftell(fp);
+    rewind(fp);
+    char* text = malloc(len + 1);
+    if (text == NULL) {
+        fclose(fp);  return BAD_ALLOCATE;
+    }
+    len = (long)fread(text, 1, len, fp);
+    text[len] = '\0';
+    fclose(fp);
+    fp = fopenx(html, "w");
+    if (fp == NULL) {
+        free(text);  return BAD_CREATEFILE;
+    }
+    int lineno = -1;                    // not in the source yet
+    char* line = text;
+    while (*line) {
+        char* eol = strchr(line, '\n');
+        if (eol) *eol = '\0';
+        static const char mark[] = "<span class=\"cov\"";
+        if (strncmp(line, mark, sizeof(mark) - 1) == 0) {
+            line = strchr(line, '>') + 1;
+            char* end = &line[strlen(line) - 7];
+            if ((end >= line) && (strcmp(end, "</span>") == 0)) *end = '\0';
+        }
+        if (strcmp(line, "</pre>") == 0) lineno = -1;
+        if (lineno > 0)
+            CoverLine(fp, line, lineno, path);
+        else
+            fprintf(fp, "%s\n", line);
+        if (lineno >= 0) lineno++;
+        if (strcmp(line, "<hr>") == 0) lineno = 0;
+        if (eol == NULL) break;
+        line = eol + 1;
+    }
+    fclose(fp);
+    free(text);
+    return 0;
+}
+
+SV HtmlCoverage(void) {                 // mark up the ./html source copies
+    int files = 0;
+    for (int fid = 1; fid <= CX->fileID; fid++) {
+        char* path = CX->FilePaths[fid].filepath;
+        int seen = 0;
+        for (int i = 1; i < fid; i++)
+            seen |= SameSource(i, path);
+        if (seen) continue;             // included more than once
+        int r = CoverFile(path);
+        if (r == BAD_ALLOCATE) {
+            CX->error = r;  return;
+        }
+        files += (r == 0);
+    }
+    printf("%d HTML files marked up\n", files);
+}
+
+// Data watching: `heatmap` counts the reads and writes of each Data[] cell,
+// `watch` stops the simulator when a cell is accessed. Either one sets
+// dataWatch, which the simulator tests before calling WatchData.
+
+SV SetWatch(void) {                     // ( addr kinds -- )
+    int kinds = Dpop();
+    cell addr = CELL_ADDR(Dpop());
+    if (addr >= DataSize)
+        CX->error = BAD_DATA_READ;
+    else
+        chadWatchpoint(addr, kinds);
+}
+
+SV SetHeatmap(void) {                   // ( flag -- )
+    CX->heating = (Dpop() != 0);
+    if (CX->heating) {
+        memset(CX->HeatReads, 0, sizeof(CX->HeatReads));
+        memset(CX->HeatWrites, 0, sizeof(CX->HeatWrites));
+    }
+    CX->dataWatch = CX->heating || CX->watchpoints;
+}
+
+static int CompareHeat(const void* a, const void* b) {
+    cell x = *(const cell*)a;  cell y = *(const cell*)b;
+    uint64_t hx = (uint64_t)CX->HeatReads[x] + CX->HeatWrites[x];
+    uint64_t hy = (uint64_t)CX->HeatReads[y] + CX->HeatWrites[y];
+    return (hx < hy) - (hx > hy);       // descending
+}
+
+SV ShowHeatmap(void) {                  // ( n -- )
+    int n = Dpop();
+    static THREAD_LOCAL cell hottest[DataSize];
+    uint64_t reads[2] = { 0 }, writes[2] = { 0 };
+    for (cell i = 0; i < DataSize; i++) {
+        int cache = (i >= (DataSize - DataCache));
+        reads[cache] += CX->HeatReads[i];
+        writes[cache] += CX->HeatWrites[i];
+        hottest[i] = i;
+    }
+    qsort(hottest, DataSize, sizeof(cell), CompareHeat);
+    printf("    Addr       Reads      Writes\n");
+    for (int i = 0; (i < n) && (i < DataSize); i++) {
+        cell a = hottest[i];
+        if ((CX->HeatReads[a] | CX->HeatWrites[a]) == 0) break;
+        printf("%8X %11u %11u%s\n", BYTE_ADDR(a),
+            CX->HeatReads[a], CX->HeatWrites[a],
+            (a >= (DataSize - DataCache)) ? "  cache" : "");
+    }
+    printf("Main region:  %" PRId64 " reads, %" PRId64 " writes\n",
+        reads[0], writes[0]);
+    printf("Cache region: %" PRId64 " reads, %" PRId64 " writes\n",
+        reads[1], writes[1]);
+}
+
+SV SaveHeatmap(void) {                  // ( <filename> -- )
+    ParseFilename();
+    FILE* fp = fopenx(CX->tok, "w");
+    if (fp == NULL) {
+        CX->error = BAD_CREATEFILE;  return;
+    }
+    fprintf(fp, "addr,reads,writes\n");
+    for (cell i = 0; i < DataSize; i++)
+        if (CX->HeatReads[i] | CX->HeatWrites[i])
+            fprintf(fp, "%u,%u,%u\n", (uint32_t)BYTE_ADDR(i),
+                CX->HeatReads[i], CX->HeatWrites[i]);
+    fclose(fp);
+}
+
+// `break` and `break-at` set a breakpoint, `break-if` gives the last one set
+// a condition.
+
+SV SetBreak(cell addr) {
+    CX->lastBreak = addr & (CodeSize - 1);
+    CX->BreakIf[CX->lastBreak] = 0;
+    chadBreakpoint(CX->lastBreak, 1);
+}
+
+SV Break(void) {                        // ( <name> -- )
+    cell xt = tick();
+    if (xt) SetBreak(xt);
+}
+
+SV BreakAt  (void) { SetBreak(Dpop()); }                // ( addr -- )
+SV BreakIfXT(void) { CX->BreakIf[CX->lastBreak] = Dpop(); } // ( xt -- )
+
+SV Unbreak(void) {                      // ( addr -- )
+    cell addr = Dpop() & (CodeSize - 1);
+    CX->BreakIf[addr] = 0;
+    chadBreakpoint(addr, 0);
+}
+
+SV ShowBreaks(void) {
+    for (cell a = 0; a < CodeSize; a++) {
+        if (!CX->Breakpoints[a]) continue;
+        printf("%03Xh", a);
+        char* name = TargetName(a, 0);
+        if (name) printf(" %s", name);
+        if (CX->BreakIf[a]) {
+            name = TargetName(CX->BreakIf[a], 0);
+            printf(" if %s", (name) ? name : itos(CX->BreakIf[a], 16, 0, 1));
+        }
+        printf("\n");
+    }
+}
+
+SV SetPostMortem(void) {                // ( n -- )
+    int n = Dpop();
+    if ((n > 0) && !CX->postmortem)
+        CX->traceNext = 0;              // forget the gap
+    CX->postmortem = (n > 0) ? n : 0;
+}
+
+SV SetSampling(void) {                  // ( period -- )
+    CX->samplePeriod = Dpop();
+    if (CX->samplePeriod == 0) {        // stop, keep the samples
+        chadCancel(EVENT_SAMPLE);  return;
+    }
+    CX->sampleCount = 0;
+    if (CX->Samples == NULL)
+        CX->Samples = malloc(SampleSize * sizeof(struct Sample));
+    if (CX->Samples == NULL) {
+        CX->error = BAD_ALLOCATE;  return;
+    }
+    chadSchedule(EVENT_SAMPLE, CX->m.cycles + CX->samplePeriod, SampleEvent);
+}
+
+SV SaveSamples(void) {
+    ParseFilename();
+    uint32_t n = (CX->sampleCount < SampleSize) ? CX->sampleCount : SampleSize;
+    uint16_t* folded = calloc(n + 1, FoldWidth * sizeof(uint16_t));
+    static THREAD_LOCAL uint16_t map[CodeSize];
+    if (folded == NULL) {
+        CX->error = BAD_ALLOCATE;  return;
+    }
+    OwnerMap(map, 0);
+    for (uint32_t i = 0; i < n; i++) {  // samples -> rows of Header indices
+        struct Sample* s = &CX->Samples[i];
+        uint16_t* row = &folded[i * FoldWidth];
+        int k = 1;
+        for (int j = s->depth - 1; j >= 0; j--) {   // outermost first
+            cell x = s->r[j];
+            cell page = (x >> 13) ? (x >> 13) : s->page;
+            int w = CodeOwner(map, (x & 0x1FFF) - 1, page);
+            if (w) row[k++] = (uint16_t)w;          // skip non-addresses
+        }
+        row[k++] = (uint16_t)CodeOwner(map, s->addr, s->page);
+        row[0] = (uint16_t)k;
+    }
+    qsort(folded, n, FoldWidth * sizeof(uint16_t), CompareFolded);
+    FILE* fp = fopenx(CX->tok, "w");
+    if (fp == NULL) {
+        CX->error = BAD_CREATEFILE;
+    } else {
+        uint32_t count = 0;
+        for (uint32_t i = 0; i < n; i++) {
+            uint16_t* row = &folded[i * FoldWidth];
+            count++;
+            if ((i + 1 < n) && !CompareFolded(row, row + FoldWidth))
+                continue;               // same stack as the next one
+            for (int k = 1; k < row[0]; k++) {
+                if (k > 1) fputc(';', fp);
+                fprintf(fp, "%s", (row[k]) ? CX->Header[row[k]].name : "?");
+            }
+            fprintf(fp, " %u\n", count);
+            count = 0;
+        }
+        fclose(fp);
+        printf("%u samples", n);
+        if (CX->sampleCount > n)
+            printf(", the last of %" PRIu64, CX->sampleCount);
+        printf("\n");
+    }
+    free(folded);
+}
+
+static int CompareProfile(const void* a, const void* b) {
+    uint64_t x = CX->Profile[*(const int*)a].self;
+    uint64_t y = CX->Profile[*(const int*)b].self;
+    return (x < y) - (x > y);           // descending
+}
+
+SV ShowProfile(void) {                  // ( n -- )
+    int n = Dpop();
+    static THREAD_LOCAL int list[MaxKeywords];
+    int words = 0;
+    uint64_t sum = 0;
+    if (CX->profiling) ProfileFlush();
+    for (int i = 1; i <= CX->hp; i++) {
+        if (CX->Profile[i].calls || CX->Profile[i].self) {
+            list[words++] = i;
+            sum += CX->Profile[i].self;
+        }
+    }
+    qsort(list, words, sizeof(int), CompareProfile);
+    printf("%12s %6s %12s %10s  name\n", "self", "%", "total", "calls");
+    for (int i = 0; (i < words) && (i < n); i++) {
+        struct ProfileEntry* e = &CX->Profile[list[i]];
+        printf("%12" PRId64 " %6.2f %12" PRId64 " %10u  %s\n", e->self,
+            (sum) ? 100.0 * e->self / sum : 0.0, e->total, e->calls,
+            CX->Header[list[i]].name);
+    }
+    printf("%12" PRId64 " cycles in %d words\n", sum, words);
+}
 
 SV HWoptions(void) {
     int n = COP_OPTIONS;
@@ -2240,17 +5018,21 @@ SV HWoptions(void) {
 // Initialize the dictionary at startup
 
 SV LoadKeywords(void) {
-    hp = 0; // start empty
-    wordlists = 0;
+    CX->hp = 0; // start empty
+    CX->wordlists = 0;
     DP = BYTE_ADDR(here);
     // Forth definitions
-    root_wid = AddWordlist("root");
-    forth_wid = AddWordlist("forth");
+    CX->root_wid = AddWordlist("root");
+    CX->forth_wid = AddWordlist("forth");
     Only(); // order = root _forth
-    CURRENT = root_wid;
-    AddEquate("root",         "1.0000 -- wid",        root_wid);
-    AddEquate("forth-wordlist", "1.0010 -- wid",      forth_wid);
+    CURRENT = CX->root_wid;
+    AddEquate("root",         "1.0000 -- wid",        CX->root_wid);
+    AddEquate("forth-wordlist", "1.0010 -- wid",      CX->forth_wid);
     AddKeyword("save-dump",  "1.0020 <filename> -- ", SaveChadState, noCompile);
+    AddKeyword("snapshot",   "1.0022 -- ",            Snapshot, noCompile);
+    AddKeyword("restore",    "1.0023 -- ",            Restore, noCompile);
+    AddKeyword("save-snapshot", "1.0024 <filename> -- ", SaveSnapshot, noCompile);
+    AddKeyword("load-snapshot", "1.0025 <filename> -- ", LoadSnapshot, noCompile);
     AddEquate("cm-size",      "1.0030 -- n",          CodeSize - CodeCache);
     AddEquate("cm-cache",     "1.0030 -- n",          CodeCache);
     AddEquate("dm-size",      "1.0040 -- n",          BYTE_ADDR(DataSize - DataCache));
@@ -2289,6 +5071,9 @@ SV LoadKeywords(void) {
     AddKeyword("boot-test",   "1.0139 <filename> --", Boot,          noCompile);
     AddKeyword("make-heads",  "1.0140 --",            MakeHeaders,   noCompile);
     AddKeyword("make-boot",   "1.0141 --",            MakeBootList,  noCompile);
+    AddKeyword("keep",        "1.0142 <name> --",     Keep,          noCompile);
+    AddKeyword("make-lean-boot", "1.0143 --",         MakeLeanBoot,  noCompile);
+    AddKeyword("booted?",     "1.0144 xt -- flag",    Booted,        noCompile);
     AddKeyword("applet",      "1.0146 addr --",       BeginApplet,   noCompile);
     AddKeyword("end-applet",  "1.0147 --",            EndApplet,     noCompile);
     AddKeyword("paged",       "1.0148 -- addr",       AppletPage,    noCompile);
@@ -2299,9 +5084,38 @@ SV LoadKeywords(void) {
     AddKeyword(".s",          "1.0200 ? -- ?",        dotESS,        noCompile);
     AddKeyword("see",         "1.0210 <name> --",     See,           noCompile);
     AddKeyword("dasm",        "1.0220 xt len --",     Dasm,          noCompile);
+    AddKeyword("coverage",    "1.0221 flag --",       SetCoverage,   noCompile);
+    AddKeyword(".coverage",   "1.0222 --",            ShowCoverage,  noCompile);
+    AddKeyword("html-coverage", "1.0223 --",          HtmlCoverage,  noCompile);
+    AddKeyword("break",       "1.0211 <name> --",     Break,         noCompile);
+    AddKeyword("break-at",    "1.0212 addr --",       BreakAt,       noCompile);
+    AddKeyword("break-if",    "1.0213 xt --",         BreakIfXT,     noCompile);
+    AddKeyword("unbreak",     "1.0214 addr --",       Unbreak,       noCompile);
+    AddKeyword(".breaks",     "1.0215 --",            ShowBreaks,    noCompile);
+    AddKeyword("resume",      "1.0216 --",            Resume,        noCompile);
+    AddKeyword("record",      "1.0217 interval --",   Record,        noCompile);
+    AddKeyword("rstep",       "1.0218 --",            ReverseStep,   noCompile);
+    AddKeyword("rcontinue",   "1.0219 --",            ReverseContinue, noCompile);
+    AddKeyword("watch",       "1.0224 addr kinds --", SetWatch,      noCompile);
+    AddKeyword("postmortem",  "1.0225 n --",          SetPostMortem, noCompile);
     AddKeyword("sstep",       "1.0230 xt len --",     Steps,         noCompile);
+    AddKeyword("profile",     "1.0231 flag --",       SetProfile,    noCompile);
+    AddKeyword(".profile",    "1.0232 n --",          ShowProfile,   noCompile);
+    AddKeyword("sampling",    "1.0233 period --",     SetSampling,   noCompile);
+    AddKeyword("save-samples", "1.0239 <filename> --", SaveSamples,  noCompile);
     AddKeyword("logsteps",    "1.0234 --",            LogSteps,      noCompile);
+    AddKeyword("trace-dump",  "1.0226 <filename> --", TraceDump,     noCompile);
+    AddKeyword("imix",        "1.0227 flag --",       SetMix,        noCompile);
+    AddKeyword(".imix",       "1.0228 --",            ShowMix,       noCompile);
+    AddKeyword("save-imix",   "1.0229 <filename> --", SaveMix,       noCompile);
     AddKeyword("cold",        "1.0235 --",            Cold,          noCompile);
+    AddKeyword("engine",      "1.0236 n --",          SetEngine,     noCompile);
+    AddKeyword("fusion",      "1.0237 mask --",       SetFusion,     noCompile);
+    AddKeyword(".fusion",     "1.0238 --",            ShowFusion,    noCompile);
+    AddKeyword("heatmap",     "1.0242 flag --",       SetHeatmap,    noCompile);
+    AddKeyword(".heatmap",    "1.0243 n --",          ShowHeatmap,   noCompile);
+    AddKeyword("save-heatmap", "1.0244 <filename> --", SaveHeatmap,  noCompile);
+    AddKeyword("run-until",   "1.0245 xt u mask -- where code reason", RunUntil, noCompile);
     AddKeyword("words",       "1.0240 --",            Words,         noCompile);
     AddKeyword("Words",       "1.0241 --",            Words,         noCompile);
     AddKeyword("bye",         "1.0250 --",            Bye,           noCompile);
@@ -2378,7 +5192,12 @@ SV LoadKeywords(void) {
     AddKeyword("macro",       "1.1330 --",            Macro,         noCompile);
     AddKeyword("write-protect", "1.1340 --",          WrProtect,     noCompile);
     AddKeyword("no-tail-recursion", "1.1350 --",    NoTailRecursion, noCompile);
+    AddKeyword("optimize",    "1.1355 flags --",      SetOptimize,   noCompile);
+    AddKeyword("inlining",    "1.1356 size calls budget --", SetInlining, noCompile);
     AddKeyword("irq!",        "1.1380 x --",          irqStore,      noCompile);
+    AddKeyword("irq-at",      "1.1382 x u --",        irqAt,         noCompile);
+    AddKeyword("soc-window",  "1.1384 a-addr u --",   SocWindow,     noCompile);
+    AddKeyword("soc-run",     "1.1386 xt n u --",     SocRun,        noCompile);
     AddKeyword("gendoc",      "1.1390 --",            GenerateDoc,   noCompile);
     AddKeyword("cotrig",      "1.1400 sel --",        CoprocInst,    noCompile);
     AddKeyword("module",      "1.1410 --",            BeginLocals,   noCompile);
@@ -2453,9 +5272,9 @@ SV LoadKeywords(void) {
     AddKeyword("for",     "1.2980 --",  noExecute, doFor);
     AddKeyword("next",    "1.2990 --",  noExecute, doNext);
     // assembler
-    asm_wid = AddWordlist("asm");
-    AddEquate("asm",        "1.5000 -- wid", asm_wid);
-    CURRENT = asm_wid;
+    CX->asm_wid = AddWordlist("asm");
+    AddEquate("asm",        "1.5000 -- wid", CX->asm_wid);
+    CURRENT = CX->asm_wid;
     AddKeyword("}",         "1.5002 --",  CodeEnd,   noCompile);
     AddKeyword("begin",     "1.5100 --",  doBegin,   noCompile);
     AddKeyword("again",     "1.5110 --",  doAgain,   noCompile);
@@ -2510,16 +5329,16 @@ SV LoadKeywords(void) {
     AddLitOp("litx",        "1.9050 n -- 0",  litx );
     AddLitOp("cop",         "1.9060 n -- 0",  copop );
     AddLitOp("imm",         "1.9070 n -- 0",  lit  );
-    CURRENT = forth_wid;
+    CURRENT = CX->forth_wid;
 }
 
 SV CopyBuffer(void) {                   // copy buf to tib region in Data
-    char* src = buf;
+    char* src = CX->buf;
     cell bytes = TIBS;
     cell words = (bytes + CELLS - 1) / CELLS;
     cell addr = DataSize - CELL_ADDR(MaxLineLength);
     ATIB = BYTE_ADDR(addr);
-    cell* dest = &Data[addr];
+    cell* dest = &CX->m.Data[addr];
     for (cell i = 0; i < words; i++) {  // pack string into data memory
         uint32_t w = 0;                 // little-endian packing
         for (int j = 0; j < CELLS; j++) {
@@ -2534,39 +5353,46 @@ SV CopyBuffer(void) {                   // copy buf to tib region in Data
 // Processes a line at a time from either stdin or a file.
 
 int chad(char * line, int maxlength) {
-    buf = line;  maxlen = maxlength;    // assign a working buffer
+    if (CX == NULL) {                   // no context selected, make one
+        struct chadContext* c = chad_new();
+        if (c == NULL) return -1;
+        chad_select(c);
+    }
+    CX->buf = line;  CX->maxlen = maxlength; // assign a working buffer
     LoadKeywords();
-    filedepth = 0;
-    fileID = 0;
+    CX->filedepth = 0;
+    CX->fileID = 0;
     Decimal();
     while (1) {
         File.fp = stdin;                // keyboard input
-        error = 0;                      // interpreter state
+        CX->error = 0;                  // interpreter state
         toImmediate();
-        cycles = spMax = rpMax = 0;     // CPU stats
-        sp = rp = 0;                    // stacks
-        while (!error) {
+        CX->spMax = CX->rpMax = 0;      // CPU stats
+        ResetCycles();
+        CX->m.sp = CX->m.rp = 0;        // stacks
+        while (!CX->error) {
             TOIN = 0;
-            TIBS = strlen(buf);
+            TIBS = strlen(CX->buf);
             if (TIBS > MaxLineLength)
-                error = BAD_INPUT_LINE;
+                CX->error = BAD_INPUT_LINE;
             else
                 CopyBuffer();
             uint64_t time0 = GetMicroseconds();
-            uint64_t cycles0 = cycles;
+            uint64_t cycles0 = CX->m.cycles;
+            CX->lineEngine = -1;
             while (parseword(' ')) {
-                if (verbose & 2) {
-                    printf("  %s", tok);
+                if (CX->verbose & 2) {
+                    printf("  %s", CX->tok);
                 }
-                if (EvalToken(tok)) {   // try to convert to number
-                    LogColor(COLOR_NUM, 0, tok);
+                if (EvalToken(CX->tok)) { // try to convert to number
+                    LogColor(COLOR_NUM, 0, CX->tok);
                     int i = 0;   int radix = BASE;   char c = 0;
                     if (radix == 0)
-                        error = DIV_BY_ZERO;
+                        CX->error = DIV_BY_ZERO;
 #ifdef HASFLOATS
-                    if (isfloat(tok)) {
+                    if (isfloat(CX->tok)) {
                         char* eptr;
-                        double y = strtod(tok, &eptr);
+                        double y = strtod(CX->tok, &eptr);
                         if ((errno == ERANGE) || (errno == EINVAL))
                             goto bogus;
                         if (STATE)
@@ -2577,7 +5403,7 @@ int chad(char * line, int maxlength) {
 #endif
                     {
                         int64_t x = 0;  int neg = 0;  int decimal = -1;
-                        switch (tok[0]) {   // leading digit
+                        switch (CX->tok[0]) { // leading digit
                         case '-': i++;  neg = -1;    break;
                         case '+': i++;               break;
                         case '$': i++;  radix = 16;  break;
@@ -2587,7 +5413,7 @@ int chad(char * line, int maxlength) {
                         case '\0': { goto bogus; }
                         default: break;
                         }
-                        while ((c = tok[i++])) {
+                        while ((c = CX->tok[i++])) {
                             switch (c) {
                             case '.':  decimal = i;  break;
                             default:
@@ -2599,12 +5425,12 @@ int chad(char * line, int maxlength) {
                                 }
                                 if (c > 41) c -= 32; // lower to upper
                                 if (c >= radix)
-                                    bogus:          error = UNRECOGNIZED;
+                                    bogus:          CX->error = UNRECOGNIZED;
                                 x = x * radix + c;
                             }
                         }
                         if (neg) x = -x;
-                        if (!error) {
+                        if (!CX->error) {
                             if (decimal < 0) {
                                 x &= CELLMASK;
                                 if (STATE) {
@@ -2627,36 +5453,37 @@ int chad(char * line, int maxlength) {
                         }
                     }
                 }
-                if (verbose & VERBOSE_TOKEN) {
+                if (CX->verbose & VERBOSE_TOKEN) {
                     printf(" ( ");
                     PrintDataStack();
                     printf(")\n");
                 }
-                if (verbose & VERBOSE_SRC) {
-                    printf(") (%s", &buf[TOIN]);
+                if (CX->verbose & VERBOSE_SRC) {
+                    printf(") (%s", &CX->buf[TOIN]);
                 }
-                if (sp == (StackSize - 1)) error = BAD_STACKUNDER;
-                if (rp == (StackSize - 1)) error = BAD_RSTACKUNDER;
-                if (error) {
-                    switch (error) {
-                    case BYE: return 0;
-                    default: ErrorMessage (error, tok);
+                if (CX->m.sp == (StackSize - 1)) CX->error = BAD_STACKUNDER;
+                if (CX->m.rp == (StackSize - 1)) CX->error = BAD_RSTACKUNDER;
+                if (CX->error) {
+                    switch (CX->error) {
+                    case BYE: TraceClose();  return 0;
+                    default: ErrorMessage (CX->error, CX->tok);
                     }
-                    while (filedepth) {
+                    while (CX->filedepth) {
                         printf("%s, Line %d: ",
-                            FilePaths[File.FID].filepath, File.LineNumber);
+                            CX->FilePaths[File.FID].filepath, File.LineNumber);
                         printf("%s\n", File.Line);
                         fclose(File.fp);
                         LogEnd();
                         fclose(File.hfp);
-                        filedepth--;
+                        CX->filedepth--;
                     }
-                    rp = sp = 0;
+                    CX->m.rp = CX->m.sp = 0;
                     goto done;
                 }
             }
-done:       elapsed_us = GetMicroseconds() - time0;
-            elapsed_cycles = cycles - cycles0;
+done:       CX->elapsed_us = GetMicroseconds() - time0;
+            CX->elapsed_cycles = CX->m.cycles - cycles0;
+            CX->elapsed_engine = CX->lineEngine;
             if (File.fp == stdin) {
                 if (SDEPTH) {
                     printf("\\ ");
@@ -2673,15 +5500,77 @@ done:       elapsed_us = GetMicroseconds() - time0;
 
 void chadError (int32_t n) {
     if (n & MSB) n |= ~CELLMASK;        // sign extend errorcode
-    error = n;
+    CX->error = n;
 }
 
 uint64_t chadCycles(void) {
-    return cycles;
+    return CX->m.cycles;
+}
+
+struct chadStatus chadRun(uint64_t maxCycles, uint32_t mask) {
+    struct chadStatus status = { 0 };
+    uint64_t cycles0 = CX->m.cycles;
+    CX->stopMask = mask;
+    CX->breakOff = !(mask & CHAD_STOP_BREAK);
+    CX->pausing = 0;
+    if (maxCycles)
+        chadSchedule(EVENT_PAUSE, CX->m.cycles + maxCycles, PauseEvent);
+    int r = 0;
+    if ((mask & CHAD_STOP_BREAK) && CX->Breakpoints[CX->m.pc & (CodeSize - 1)])
+        r = CPUsim(1);                  // step off the breakpoint
+    while (1) {
+        if (CX->pausing & CHAD_STOP_WATCH) {
+            status.reason = CHAD_STOP_WATCH;
+            status.code = CX->watchAddr;
+            break;
+        }
+        if (CX->pausing) {
+            status.reason = (CX->pausing & CHAD_STOP_IOWAIT)
+                ? CHAD_STOP_IOWAIT : CHAD_STOP_CYCLES;
+            break;
+        }
+        if (r == SIM_BREAK) {
+            status.reason = CHAD_STOP_BREAK;
+            break;
+        }
+        if (r < 0) {
+            if (mask & CHAD_STOP_ERROR) {
+                status.reason = CHAD_STOP_ERROR;
+                status.code = r;
+                break;
+            }
+            Dpush(r);                   // the target handles it
+            CX->m.pc = Ctick("throw");
+        }
+        r = CPUsim(-1);                 // returns an error or stop code
+    }
+    chadCancel(EVENT_PAUSE);
+    CX->stopMask = 0;
+    CX->breakOff = 0;
+    CX->pausing = 0;
+    status.where = CX->m.pc;
+    status.elapsed = CX->m.cycles - cycles0;
+    return status;
+}
+
+void chadBreakpoint(uint32_t addr, int on) {
+    addr &= CodeSize - 1;
+    if (CX->Breakpoints[addr] != (on != 0))
+        CX->breakpoints += (on) ? 1 : -1;
+    CX->Breakpoints[addr] = (on != 0);
+}
+
+void chadWatchpoint(uint32_t addr, int kinds) {
+    addr &= DataSize - 1;
+    kinds &= CHAD_WATCH_READ | CHAD_WATCH_WRITE;
+    if ((CX->Watch[addr] != 0) != (kinds != 0))
+        CX->watchpoints += (kinds) ? 1 : -1;
+    CX->Watch[addr] = (uint8_t)kinds;
+    CX->dataWatch = CX->heating || CX->watchpoints;
 }
 
 uint16_t chadReadCode(uint32_t addr) {
-    uint16_t r = Code[addr & (CodeSize - 1)];
+    uint16_t r = CX->m.Code[addr & (CodeSize - 1)];
     return r;
 }
 
@@ -6,6 +6,14 @@
 #include <stdint.h>
 #include "config.h"
 
+// Each Chad instance has its own context: the simulated machine plus the
+// compiler state. A context is selected per thread; chad_new doesn't select
+// it. If no context is selected, chad() creates one.
+struct chadContext;
+struct chadContext* chad_new(void);
+void chad_free(struct chadContext* c);
+void chad_select(struct chadContext* c);
+
 // The Forth QUIT loop and simulator
 // Returns a return code: 0 = BYE
 // line: a line of text to evaluate upon entry to chad.
@@ -20,4 +28,77 @@ void chadError(int32_t error); // Report an error
 
 uint64_t chadCycles(void); // total number of processor cycles
 
+// Time-based events. A peripheral schedules its event to happen when the
+// cycle count reaches `when`. The handler is called after the instruction
+// that gets there. Scheduling a pending event moves it.
+enum chadEvents {
+    EVENT_TIMER, EVENT_FLASH, EVENT_UART, EVENT_IRQ, EVENT_PAUSE, EVENT_SAMPLE,
+    EVENT_KEYFRAME,
+    EVENTS
+};
+
+void chadSchedule(int id, uint64_t when, void (*handler)(void));
+void chadCancel(int id);
+
+// A peripheral that's polled while it waits for an event calls chadIdle to
+// skip the cycle count ahead to the next event.
+void chadIdle(void);
+
+void chadInterrupt(int n); // request interrupt n
+
+// Run the simulated CPU from where it is until something in stopMask
+// happens or maxCycles have been run (0 = no limit). Errors that aren't
+// in stopMask are thrown to the target's `throw` like `cold` does.
+// A run that starts on a breakpoint runs the instruction there.
+enum chadStop {
+    CHAD_STOP_CYCLES = 1,       // the cycle budget ran out
+    CHAD_STOP_BREAK = 2,        // about to execute a breakpoint
+    CHAD_STOP_IOWAIT = 4,       // the target polled for input that's not there
+    CHAD_STOP_ERROR = 8,        // the simulator or an I/O device failed
+    CHAD_STOP_WATCH = 16        // a watched data cell was accessed
+};
+
+struct chadStatus {
+    uint32_t reason;            // the chadStop that ended the run
+    int32_t code;               // error code for CHAD_STOP_ERROR,
+                                // cell address for CHAD_STOP_WATCH
+    uint32_t where;             // PC where the run stopped
+    uint64_t elapsed;           // cycles run
+};
+
+struct chadStatus chadRun(uint64_t maxCycles, uint32_t stopMask);
+void chadBreakpoint(uint32_t addr, int on);
+
+// A watchpoint ends the run after the instruction that reads or writes a
+// data cell. Addr is a cell address, kinds is 0 to remove it. Without
+// CHAD_STOP_WATCH in stopMask, a watchpoint hit is an error.
+#define CHAD_WATCH_READ  1
+#define CHAD_WATCH_WRITE 2
+void chadWatchpoint(uint32_t addr, int kinds);
+
+// A peripheral that has no input for a polling target calls chadWaitIO.
+void chadWaitIO(void);
+
+// Snapshots of the machine state (memories, stacks, registers, events and
+// peripherals) for fast rewind. Restore re-decodes only the code that
+// changed and skips the flash if it wasn't written since. Files are only
+// good for the build that saved them. Save and Load return an error code.
+struct chadSnapshot;
+struct chadSnapshot* chadSnapshotNew(void);
+void chadSnapshotFree(struct chadSnapshot* s);
+void chadSnapshotTake(struct chadSnapshot* s);
+void chadSnapshotRestore(struct chadSnapshot* s);
+int chadSnapshotSave(struct chadSnapshot* s, char* filename);
+int chadSnapshotLoad(struct chadSnapshot* s, char* filename);
+
+// Multicore (soc-run): core number and count, and the mailboxes. Mail sent
+// to a core is delivered at the end of the quantum. A single core is core 0
+// of 1 with no mail.
+int chadCoreID(void);
+int chadCores(void);
+void chadMailTo(int core);       // select the destination core
+void chadMailSend(uint32_t x);
+int chadMailWaiting(void);       // words in this core's inbox
+uint32_t chadMailReceive(void);  // next word from the inbox, 0 if empty
+
 #endif // __CHAD_H__
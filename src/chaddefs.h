@@ -38,18 +38,18 @@ void ErrorMessage (int error, char *s); // defined in errors.c
 #endif
 
 #define CELLS    (BYTE_ADDR(1))
-#define File FileStack[filedepth]
+#define File CX->FileStack[CX->filedepth]
 #define RPMASK   (StackSize-1)
-#define RDEPTH   (rp & RPMASK)
+#define RDEPTH   (CX->m.rp & RPMASK)
 #define SPMASK   (StackSize-1)
-#define SDEPTH   (sp & SPMASK)
+#define SDEPTH   (CX->m.sp & SPMASK)
 #define CELL_AMASK ((1 << CELLSIZE) - 1) /* 15 or 31 */
 #define SV static void
 #define SI static int
 #define CELL static cell
 
-#define SP sp
-#define RP rp
+#define SP CX->m.sp
+#define RP CX->m.rp
 
 struct FileRec {
     char Line[LineBufferSize];          // the current input line
@@ -84,6 +84,8 @@ struct Keyword {
     uint16_t srcLine;                   // source line number
     uint32_t color;                     // HTML color
     uint16_t applet;                    // applet ID
+    uint8_t keep;                       // make-lean-boot root: 1 = `keep`,
+                                        // 2 = make-heads
 };
 
 int chadSpinFunction(void);             // external function waiting for keyboard input
@@ -241,6 +243,16 @@ int chadSpinFunction(void);             // external function waiting for keyboar
 #define BAD_FSOVERFLOW  -82 // Flash string overflow
 #define BAD_COPROCESSOR -84 // Invalid coprocessor field
 #define BAD_POSTPONE    -85 // Unsupported postpone
+#define BAD_NOSNAPSHOT  -86 // No snapshot has been taken
+#define BAD_SNAPSHOT    -87 // Snapshot file is from a different build
+#define BAD_TRACEFILE   -88 // Not a trace file for this cell size
+#define BAD_WATCHPOINT  -89 // A watched data cell was accessed
+#define BAD_BREAKPOINT  -90 // Stopped at a breakpoint
+#define BAD_NORESUME    -91 // No breakpoint to resume from
+#define BAD_REPLAY      -92 // Replay diverged from the recording
+#define BAD_NORECORDING -93 // Not recorded that far back
+#define BAD_THREAD      -94 // Can't start a host thread
+#define BAD_ALLOCATE   -100 // ALLOCATE failed
 #define BAD_CREATEFILE -198
 #define BAD_OPENFILE   -199 // Can't open file
 #define BYE            -299
@@ -252,3 +264,9 @@ int chadSpinFunction(void);             // external function waiting for keyboar
 #define VERBOSE_STKMAX  8   // track and show the maximum stack depth
 #define VERBOSE_SRC     16  // display the remaining source in the TIB
 #define VERBOSE_DASM    32  // disassemble in long format
+
+// optimize flags
+#define OPT_PEEPHOLE    1   // merge adjacent ALU instructions
+#define OPT_FOLD        2   // evaluate ALU instructions on literals
+#define OPT_INLINE      4   // copy short definitions instead of calling
+#define OPT_THREAD      8   // shorten jump chains and jumps to returns
@@ -6,7 +6,7 @@
 #define __CONFIG_H__
 #include <stdint.h>
 
-#define SIM_FILENAME "output.txt"
+#define SIM_FILENAME "output.trc"     /* logsteps trace, see trace-dump */
 
 #define CELLBITS        24      /* Width of a cell in bits, 16 to 32        */
 // Sizes of memories in cells, should be an exact power of 2
@@ -21,8 +21,15 @@
 #define CodeAlignment    1      /* Alignment for new definitions            */
 #define TrapVector      16      /* Jump address for the two traps           */
 #define ExceptionVector 18      /* Jump address for exceptions              */
+#define UARTtxTime    8680      /* UART busy cycles per char, 0 = no wait   */
+                                /* (10 bits at 115200 baud, 100 MHz clock)  */
+#define MaxCores        16      /* Max cores for soc-run                    */
+#define MailboxSize     16      /* Words in each core's inbox               */
+#define SampleSize   16384      /* Sampling profiler ring buffer records    */
+#define TraceRingSize  256      /* Post-mortem trace records                */
+#define ReplayFrames    16      /* Snapshots kept by record for rstep       */
+#define TRACE_THREAD            /* Write logsteps traces on a helper thread */
 
-#define MoreInstrumentation     /* Simulator has more instrumentation       */
 //#define HASFLOATS             /* Dotted numbers are floating point        */
 
 #define LineBufferSize 128      /* Size of line buffer                      */
@@ -36,6 +43,11 @@
 
 #ifdef _MSC_VER                 /* Visual Studio wants "safe" functions.    */
 #define MORESAFE                /* Compiler supports them (C11, C17, etc).  */
+#define THREAD_LOCAL __declspec(thread)
+#elif defined __GNUC__
+#define THREAD_LOCAL __thread   /* Each thread selects its own context      */
+#else
+#define THREAD_LOCAL _Thread_local
 #endif
 
 #define StackSize  (1 << StackAwidth)
@@ -49,6 +61,9 @@
 #if ((StackSize-1) & StackSize)
 #error StackSize must be an exact power of 2
 #endif
+#if ((TraceRingSize-1) & TraceRingSize)
+#error TraceRingSize must be an exact power of 2
+#endif
 
 #define COP_OPTIONS 15	/* Coprocessor options */
 
@@ -1,11 +1,12 @@
 #include <stdio.h>
 #include <string.h>
+#include "config.h"
 
 // ANS Forth Standard Throw Codes
 
 // This list includes everything but the kitchen sink and adds a couple more.
 
-static char ErrorString[260];   // String to include in error message
+static THREAD_LOCAL char ErrorString[260]; // String to include in error message
 
 void ErrorMessage (int error, char *s) {
    char *msg;
@@ -98,6 +99,15 @@ void ErrorMessage (int error, char *s) {
        case  -83: msg = "Invalid SPI flash address";                    break;
        case  -84: msg = "Invalid coprocessor field";                    break;
        case  -85: msg = "Can't postpone an applet word";                break;
+       case  -86: msg = "No snapshot has been taken";                   break;
+       case  -87: msg = "Snapshot file is from a different build";      break;
+       case  -88: msg = "Not a trace file for this cell size";          break;
+       case  -89: msg = "A watched data cell was accessed";             break;
+       case  -90: msg = "Stopped at a breakpoint, resume to continue";  break;
+       case  -91: msg = "No breakpoint to resume from";                 break;
+       case  -92: msg = "Replay diverged from the recording";           break;
+       case  -93: msg = "Not recorded that far back";                   break;
+       case  -94: msg = "Can't start a host thread";                    break;
        case -100: msg = "ALLOCATE failed";                              break;
        case -101: msg = "RESIZE failed";                                break;
        case -102: msg = "FREE failed";                                  break;
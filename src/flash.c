@@ -11,7 +11,7 @@
 Flash Memory Simulator
 The interface to flash memory is through a SPI interface.
 
-Flash memory is a static array of bytes that C initializes to 0.
+Flash memory is an array of bytes in the FlashContext, initialized to 0.
 Read and write invert the data so that blank means 0xFF.
 Chad can call LoadFlashMem to initialize it from a file.
 
@@ -21,14 +21,19 @@ beginning of physical memory is reserved for a FPGA bitstream.
 
 // #define VERBOSE
 
-static uint8_t mem[FlashMemorySize];
-static uint8_t boilerplate[16];
+static THREAD_LOCAL struct FlashContext* fc;
 
-#define BASEBLOCK boilerplate[4]		// 64K block of physical memory
+void FlashSelect(struct FlashContext* c) {
+	fc = c;
+}
+
+#define BASEBLOCK fc->boilerplate[4]	// 64K block of physical memory
 
 void FlashMemStore(uint32_t addr, uint8_t c) {
-	if (addr < FlashMemorySize)
-		mem[addr] = ~c;
+	if (addr < FlashMemorySize) {
+		fc->mem[addr] = ~c;
+		fc->writes++;
+	}
 }
 
 static void invertMem(uint8_t* m, uint32_t n) {
@@ -64,8 +69,9 @@ int FlashBaseBlock(void) {
 // otherwise, you can load raw data at an offset without clearing memory.
 
 int LoadFlashMem(char* filename, uint32_t origin) { 
+	fc->writes++;
 	if (origin == 0)
-		memset(mem, 0, FlashMemorySize); // erase entire flash
+		memset(fc->mem, 0, FlashMemorySize); // erase entire flash
 	FILE* fp;
 #ifdef MORESAFE
 	errno_t err = fopen_s(&fp, filename, "rb");
@@ -74,9 +80,9 @@ int LoadFlashMem(char* filename, uint32_t origin) {
 #endif
 	if (fp == NULL) return BAD_OPENFILE;
 	if (origin == 0)
-		(void)(fread(boilerplate, 1, 16, fp) == 16); // get boilerplate
-	uint32_t length = fread(&mem[origin], 1, FlashMemorySize - origin, fp);
-	invertMem(&mem[origin], length);
+		(void)(fread(fc->boilerplate, 1, 16, fp) == 16); // get boilerplate
+	uint32_t length = fread(&fc->mem[origin], 1, FlashMemorySize - origin, fp);
+	invertMem(&fc->mem[origin], length);
 	fclose(fp);
 	return 0;
 }
@@ -88,7 +94,7 @@ int LoadFlashMem(char* filename, uint32_t origin) {
 int SaveFlashMem(char* filename, uint32_t pid, int format) {
 	BASEBLOCK = (uint8_t)pid;
 	uint32_t length = FlashMemorySize;
-	while ((length) && (mem[--length] == 0)) {}   // trim
+	while ((length) && (fc->mem[--length] == 0)) {}   // trim
 	length += 0x140;  
 	if (length > FlashMemorySize) length = FlashMemorySize;
 	length &= 0xFFFFFF00L;				// round to 256-byte page
@@ -104,20 +110,20 @@ int SaveFlashMem(char* filename, uint32_t pid, int format) {
 		fwrite(&pid, 1, 4, fp);			// product ID
 		fwrite(&length, 1, 4, fp);		// length
 	}
-	invertMem(mem, length);
-	uint32_t crc = crc32b(mem, length);
+	invertMem(fc->mem, length);
+	uint32_t crc = crc32b(fc->mem, length);
 	if (format & 1) {
 		fwrite(&crc, 1, 4, fp);			// crc
 	}
 	if (format & 2) {					// hex
 		fprintf(fp, "@%02X0000\n", (uint8_t)pid);
 		for (uint32_t n = 0; n < length; n++)
-			fprintf(fp, "%02X\n", mem[n]);
+			fprintf(fp, "%02X\n", fc->mem[n]);
 	}
 	else {								// binary
-		fwrite(mem, 1, length, fp);
+		fwrite(fc->mem, 1, length, fp);
 	}
-	invertMem(mem, length);
+	invertMem(fc->mem, length);
 	fclose(fp);
 	return 0;
 };
@@ -140,24 +146,35 @@ enum states {
 	addr2, addr1, addr0, cmd, fastread, read, write
 };
 
-enum states state = idle;               // FSM state
-static uint8_t format;                  // SPI format, 0 = 1-bit
-static uint64_t mark;                   // Flash time-out
+void FlashInit(struct FlashContext* c) {
+	c->state = idle;
+	c->qe = 2;
+}
 
 void FlashMemSPIformat(int n) {
-	format = 7 & (n >> 1);				// basically ignored
+	fc->format = 7 & (n >> 1);			// basically ignored
 	if (n == 0)
-		state = idle;                   // CS line = inactive
+		fc->state = idle;               // CS line = inactive
 #ifdef VERBOSE
 	if (n)
-		printf("[%d:", format);
+		printf("[%d:", fc->format);
 	else
 		printf("]\n");
 #endif
 }
 
+static void FlashReady(void) {
+	fc->busy = 0;
+}
+
+static void FlashWait(void) {			// busy until the cycle count is mark
+	fc->busy = 1;
+	chadSchedule(EVENT_FLASH, fc->mark, FlashReady);
+}
+
 static int FlashBusy(void) {
-	return (chadCycles() < mark) ? 1 : 0;
+	if (fc->busy) chadIdle();			// skip the polling loop
+	return fc->busy;
 }
 
 // Simulate a byte connection to SPI flash: 8-bit in, 8-bit out.
@@ -165,101 +182,102 @@ static int FlashBusy(void) {
 // RDJDID (9F command) is custom: 0xAA, 0xHH, 0xFF number of 4K blocks
 
 int FlashMemSPI8(uint8_t cin) {
-	static uint8_t command = 0;         // current command
-	static uint8_t wen = 0;             // write enable
-	static uint8_t qe = 2;              // quad rate enable
-	static uint32_t addr;
-	static uint32_t dummy;
 	uint16_t cout = 0x00FF;
 #ifdef VERBOSE
-	if (state != idle)
+	if (fc->state != idle)
 	printf("{%X}", cin);
 #endif
-	switch (state) {
+	switch (fc->state) {
 	case idle:
-		command = cin;
+		fc->command = cin;
 #ifdef VERBOSE
 		printf("#%02X ", cin);
 #endif
-		switch (command) {
-		case 0x01: if (wen) { state = wrsra; }  break;
-		case 0x06: state = wait_;  wen = 2;     break;
-		case 0x04: state = wait_;  wen = 0;     break;
-		case 0x35: state = rdsrh;               break;
-		case 0x05: state = rdsr;                break;
+		switch (fc->command) {
+		case 0x01: if (fc->wen) { fc->state = wrsra; }  break;
+		case 0x06: fc->state = wait_;  fc->wen = 2;     break;
+		case 0x04: fc->state = wait_;  fc->wen = 0;     break;
+		case 0x35: fc->state = rdsrh;               break;
+		case 0x05: fc->state = rdsr;                break;
 		case 0xEB: // quad rate commands must have QE set
-		case 0x32: if (qe == 0) { break; }      // fall through
+		case 0x32: if (fc->qe == 0) { break; }      // fall through
 		case 0x0B: /* FR  opcd A2 A1 A0 xx -- data... */
 		case 0x02: /* PP  opcd A2 A1 A0 d0 d1 d2 ... */
-		case 0x20: /* SER4K */  state = addr2;  break;
-		case 0x9F: /* RDJDID */ state = jid1;   break;
+		case 0x20: /* SER4K */  fc->state = addr2;  break;
+		case 0x9F: /* RDJDID */ fc->state = jid1;   break;
 		} break;
 	case wait_: break;				// wait for trailing CS
-	case rdsr: cout = wen + FlashBusy();        break;
-	case rdsrh: cout = qe;                      break;
-	case jid1: cout = 0xAA;  state = jid2;      break;
+	case rdsr: cout = fc->wen + FlashBusy();        break;
+	case rdsrh: cout = fc->qe;                      break;
+	case jid1: cout = 0xAA;  fc->state = jid2;      break;
 	case jid2: cout = 0xFF & (FlashMemorySize >> 24);
-		state = jid3;  break;
+		fc->state = jid3;  break;
 	case jid3: cout = 0xFF & (FlashMemorySize >> 16);
-		state = wait_;  break;
-	case addr2: addr = (cin - BASEBLOCK) << 16;
-		state = addr1;  break;
-	case addr1: addr += cin << 8;
-		state = addr0;  break;
-	case addr0: addr += cin;
+		fc->state = wait_;  break;
+	case addr2: fc->addr = (cin - BASEBLOCK) << 16;
+		fc->state = addr1;  break;
+	case addr1: fc->addr += cin << 8;
+		fc->state = addr0;  break;
+	case addr0: fc->addr += cin;
 #ifdef VERBOSE
-		printf("%02X[%06X] ", command, addr);
+		printf("%02X[%06X] ", fc->command, fc->addr);
 #endif
-		state = wait_;
-		if (addr < FlashMemorySize) {
-			switch (command) {
+		fc->state = wait_;
+		if (fc->addr < FlashMemorySize) {
+			switch (fc->command) {
 			case 0x20: // 4K erase
-				if (wen) {
-					wen = 0;
-					memset(&mem[addr & (~0xFFF)], 0, 4096);
-					mark = chadCycles() + (uint64_t)ERASE_DELAY;
+				if (fc->wen) {
+					fc->wen = 0;
+					memset(&fc->mem[fc->addr & (~0xFFF)], 0, 4096);
+					fc->writes++;
+					fc->mark = chadCycles() + (uint64_t)ERASE_DELAY;
+					FlashWait();
 				} break;
 			case 0x03: // slow read
-				state = read;  break;
-			case 0xEB:  dummy = 2; // fall through
+				fc->state = read;  break;
+			case 0xEB:  fc->dummy = 2; // fall through
 			case 0x0B: // fast read
-				state = fastread;  break;
+				fc->state = fastread;  break;
 			case 0x32: // QDR page write
-				if (qe == 0) { goto notenabled; } // fall through
+				if (fc->qe == 0) { goto notenabled; } // fall through
 			case 0x02: // page write
-				if (wen) {
-					mark = chadCycles() + (uint64_t)BYTE0_DELAY;
-					state = write;  break;
+				if (fc->wen) {
+					fc->mark = chadCycles() + (uint64_t)BYTE0_DELAY;
+					FlashWait();
+					fc->state = write;  break;
 				}
-			notenabled:  wen = 0;
+			notenabled:  fc->wen = 0;
 				return BAD_NOTENABLED;
 			} break;
 		} return BAD_FLASHADDR;
 	case fastread: 
-		if (dummy) dummy--; else { state = read; }
+		if (fc->dummy) fc->dummy--; else { fc->state = read; }
 		break;
 	case read:						// read as long as you want
-		cout = 0xFF & ~mem[addr++];
+		cout = 0xFF & ~fc->mem[fc->addr++];
 		break;
 	case write:						// write byte to flash
-		if (mem[addr]) {			// 0 = blank
-			wen = 0;  state = wait_;
+		if (fc->mem[fc->addr]) {	// 0 = blank
+			fc->wen = 0;  fc->state = wait_;
 			return BAD_NOTBLANK;
 		}
-		mem[addr++] = ~cin;
-		mark += (uint64_t)BYTE_DELAY;
-		if ((addr & 0xFF) == 0) {	// reached end of write page
-			wen = 0;  state = wait_;
+		fc->mem[fc->addr++] = ~cin;
+		fc->writes++;
+		fc->mark += (uint64_t)BYTE_DELAY;
+		FlashWait();
+		if ((fc->addr & 0xFF) == 0) {	// reached end of write page
+			fc->wen = 0;  fc->state = wait_;
 		}
 		break;
 	case wrsra:
-		state++;  break;
+		fc->state++;  break;
 	case wrsrb:
-		qe = cin & 2;				// bit 9 of status write
-		mark = chadCycles() + (uint64_t)WRSR_DELAY;
-		state = idle;  break;
+		fc->qe = cin & 2;			// bit 9 of status write
+		fc->mark = chadCycles() + (uint64_t)WRSR_DELAY;
+		FlashWait();
+		fc->state = idle;  break;
 	default:
-		state = idle;
+		fc->state = idle;
 	}
 	return cout;
 }
@@ -34,6 +34,26 @@ uint32_t crcbyte(uint8_t byte, uint32_t CRCin);
 #define BYTE_DELAY  (3 * SYSMHZ)
 #define BYTE0_DELAY (28 * SYSMHZ)
 
+// Flash simulator state, one per chad context (see chad_new).
+
+struct FlashContext {
+	uint8_t mem[FlashMemorySize];		// inverted, so 0 is blank
+	uint8_t boilerplate[16];
+	uint8_t state;						// FSM state
+	uint8_t format;						// SPI format, 0 = 1-bit
+	uint8_t busy;						// waiting for the time-out event
+	uint8_t command;					// current command
+	uint8_t wen;						// write enable
+	uint8_t qe;							// quad rate enable
+	uint32_t addr;
+	uint32_t dummy;
+	uint64_t mark;						// Flash time-out
+	uint32_t writes;					// bumped when mem changes
+};
+
+void FlashInit(struct FlashContext* c);
+void FlashSelect(struct FlashContext* c);	// for the calling thread
+
 #define BAD_CREATEFILE -198
 #define BAD_OPENFILE   -199
 #define BAD_NOTBLANK   -60
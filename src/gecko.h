@@ -4,6 +4,17 @@
 #ifndef __GECKO_H__
 #define __GECKO_H__
 #include <stdint.h>
+#include "config.h"
+
+// Gecko state, one per chad context (see chad_new).
+
+struct GeckoContext {
+    uint8_t s[31];                      // NFSR1
+    uint8_t b[90];                      // NFSR2
+    uint8_t x, y, a;
+};
+
+void GeckoSelect(struct GeckoContext* c);   // for the calling thread
 
 void GeckoState(void);
 void GeckoLoad(uint64_t key);
@@ -54,14 +54,16 @@ int KbHit(void) {
 // 110xxx11 = Load length with 16-bit value(big endian)
 // 111rxxxx = End bootup and start processor
 
-uint64_t ChadBootKey = 0;               // global needed by chad.c
+static THREAD_LOCAL struct IOContext* io;
 
-static uint8_t SPIresult;
+void IOselect(struct IOContext* c) {
+    io = c;
+}
 
 static void FlashSPI(uint8_t c) {
     int r = FlashMemSPI8(c);
     if (r < 0) chadError(r);
-    SPIresult = r;
+    io->SPIresult = r;
 }
 
 static void FlashInterpret(void) {      // see spif.v, line 288
@@ -71,10 +73,10 @@ static void FlashInterpret(void) {      // see spif.v, line 288
     uint32_t boot_data = 0;
     uint16_t b_dest = 0;
     uint16_t b_count = 0;
-    GeckoLoad(ChadBootKey);
+    GeckoLoad(io->ChadBootKey);
     while (1) {
         FlashSPI(0);
-        uint8_t plain = SPIresult ^ GeckoByte();
+        uint8_t plain = io->SPIresult ^ GeckoByte();
         switch (b_mode >> 1) {
         case 0:                         // command mode
             switch (plain & 0xC0) {
@@ -156,11 +158,8 @@ void FlashMemBoot(int startaddr) {
     FlashInterpret();
 }
 
-static uint64_t gkey = 0;
-static uint8_t xorkey;
-
 static int IOspiResult(void) {
-    return SPIresult ^ xorkey;
+    return io->SPIresult ^ io->xorkey;
 }
 
 // ISP interpreter. In a real system, the UART can control the ISP.
@@ -174,53 +173,51 @@ static int IOspiResult(void) {
 // `11xxxxff` Read N+1 bytes from flash using format f
 
 static void JamISP(uint8_t c) {
-    static int state = 0;
-    static int n = 0; // 12-bit parameter
     int sel = c >> 6;
 #ifdef VERBOSE
-    printf("j[%d,%02X] ", state, c);
+    printf("j[%d,%02X] ", io->ispState, c);
 #endif
-    switch (state) {
+    switch (io->ispState) {
     case 0: // command
         switch (sel) {
         case 0: // 00nnnnnn
-            n = ((n << 6) + (c & 0x3F)) & 0xFFF;
+            io->ispN = ((io->ispN << 6) + (c & 0x3F)) & 0xFFF;
             break;
         case 1: // 01
             // (c & 1) ignore reset
             if (c & 2) { printf("ISP: no ping\n"); }
-            if (c & 4) { FlashMemBoot(n << 8); }
+            if (c & 4) { FlashMemBoot(io->ispN << 8); }
             if (c & 8) {
 #ifdef VERBOSE
-                printf("Loading Key %X%08X\n", (uint32_t)(gkey >> 32), (uint32_t)gkey);
+                printf("Loading Key %X%08X\n", (uint32_t)(io->gkey >> 32), (uint32_t)io->gkey);
 #endif
-                GeckoLoad(gkey);
-                gkey = 0;
-                xorkey = GeckoByte();
+                GeckoLoad(io->gkey);
+                io->gkey = 0;
+                io->xorkey = GeckoByte();
             }
             if (c & 32) {
                 FlashSPI(0);
-                xorkey = GeckoByte();
+                io->xorkey = GeckoByte();
 #ifdef VERBOSE
-                printf("SPI xfer, keystream=%02Xh, raw=%02X\n", xorkey, SPIresult);
+                printf("SPI xfer, keystream=%02Xh, raw=%02X\n", io->xorkey, io->SPIresult);
 #endif
             }
             break;
         case 2:
             FlashMemSPIformat(c & 7);
-            if (c & 7) state = sel;
+            if (c & 7) io->ispState = sel;
             break;
         case 3:
             FlashMemSPIformat(c & 7);
-            state = sel;
+            io->ispState = sel;
             break;
         } break;
     case 2: // write makes sense
         FlashSPI(c);
-        if (n) n--; else { state = 0; }
+        if (io->ispN) io->ispN--; else { io->ispState = 0; }
         break;
     case 3: printf("ISP: read-to-UART not supported\n"); // fall through
-    default: state = 0; // weird state
+    default: io->ispState = 0; // weird state
     }
 }
 
@@ -232,28 +229,26 @@ It buffers a line locally, allowing you to edit it, before sending it.
 termKey will wait until a CR is received.
 */
 
-static uint8_t buf[LineBufferSize];
-static int toin = 0;
-static int len = 0;
-
 static int IOtermQkey(void) {
-    if (toin < len) {
+    if (io->toin < io->len) {
         return 1;                       // there are chars in the buffer
     }
-    return KbHit();
+    int r = KbHit();
+    if (r == 0) chadWaitIO();           // the target is waiting for input
+    return r;
 }
 
 static int IOtermKey(void) {              // Get the next byte in the input stream
-    if (toin < len) {
-        return buf[toin++];
+    if (io->toin < io->len) {
+        return io->buf[io->toin++];
     }
-    toin = 0;
-    len = 0;
-    if (fgets((char*)buf, LineBufferSize, stdin) != NULL) {
-        len = strlen((char*)buf);
+    io->toin = 0;
+    io->len = 0;
+    if (fgets((char*)io->buf, LineBufferSize, stdin) != NULL) {
+        io->len = strlen((char*)io->buf);
     }
-    if (len) {                          // the string ends in newline
-        return buf[toin++];
+    if (io->len) {                      // the string ends in newline
+        return io->buf[io->toin++];
     }
     return -1;                          // so this shouldn't happen ever
 }
@@ -264,26 +259,32 @@ static int IOtermKey(void) {              // Get the next byte in the input stre
 // The `_IORD_` field in an ALU instruction strobes io_rd.
 // In the J1, input devices sit on (mem_addr,io_din)
 
-static uint8_t nohostAPI;               // prohibit access to host API
-static uint32_t WishboneUpperRx;
-static uint32_t WishboneUpperTx;
-static uint32_t FlashReadResult;
-
+#if (UARTtxTime)
+static void UARTready(void) {
+    io->txbusy = 0;
+    chadInterrupt(2);                   // ready for another byte
+}
+#endif
 uint32_t readIOmap (uint32_t addr) {
-    if ((addr & 0x8000) && (nohostAPI))
+    if ((addr & 0x8000) && (io->nohostAPI))
         chadError(BAD_HOSTAPI);
     switch (addr) {
     case 0: return IOtermKey();         // Get the next incoming stream char
     case 1: return IOtermQkey();
-    case 2: return 0;                   // UART tx is never busy
+    case 2: if (io->txbusy) chadIdle();  // UART tx busy
+        return io->txbusy;
     case 3: return IOspiResult();       // SPI result
     case 4: return 0;                   // Jam status, not busy
     case 5: return 0;                   // DMA status, not busy
     case 6: return (uint32_t)chadCycles();
-    case 7: return WishboneUpperRx;
-    case 11: return FlashReadResult;
+    case 7: return io->WishboneUpperRx;
+    case 11: return io->FlashReadResult;
     case 12: return 2;                  // bootokay=1
     case 0x14: return 0;                // GP input
+    case 0x30: return chadCoreID();     // multicore, see soc-run
+    case 0x31: return chadCores();
+    case 0x32: return chadMailWaiting();
+    case 0x33: return chadMailReceive();
     default: chadError(BAD_IOADDR);
     }
     return 0;
@@ -296,34 +297,32 @@ uint32_t readIOmap (uint32_t addr) {
 // 0 to 15 are reserved for SPIF registers, all else is Wishbone bus.
 // See spif.v for mapping and Wishbone implementation.
 
-int read_bytes;     // Set up flash read parameters
-int read_addr;      // address to use in the 4K sector
-int boot_format;    // format to use for SPI bus
-
 int writeIOmap (uint32_t addr, uint32_t x) {
-    static uint32_t codeAddr = 0;
-    if ((addr & 0xFFFFC000) && (nohostAPI))
+    if ((addr & 0xFFFFC000) && (io->nohostAPI))
         chadError(BAD_HOSTAPI);
     switch (addr) {
     case 0x00:                          // emit
         putchar(x);
 #ifdef __linux__
     fflush(stdout);
-    nanosleep(&(struct timespec){ 0, 1000000 }, NULL);
+#endif
+#if (UARTtxTime)
+        io->txbusy = 1;
+        chadSchedule(EVENT_UART, chadCycles() + UARTtxTime, UARTready);
 #endif
         break;
-    case 0x01: codeAddr = x;  break;
-    case 0x02: chadToCode(codeAddr++, x);  break;
+    case 0x01: io->codeAddr = x;  break;
+    case 0x02: chadToCode(io->codeAddr++, x);  break;
     case 0x03: FlashInterpret();  break;
     case 0x04: JamISP(x);  break;       // Jam ISP byte
-    case 0x05: gkey = (gkey << CELLBITS) + x; // fall through
+    case 0x05: io->gkey = (io->gkey << CELLBITS) + x; // fall through
     case 0x06: 
-        read_bytes = (x & 3) + 1;
-        boot_format = (x >> 2) & 7;
+        io->read_bytes = (x & 3) + 1;
+        io->boot_format = (x >> 2) & 7;
         break;
-    case 0x07: WishboneUpperTx = x;  break;
+    case 0x07: io->WishboneUpperTx = x;  break;
     case 0x0B: 
-        FlashMemSPIformat(boot_format);
+        FlashMemSPIformat(io->boot_format);
         FlashSPI(0x0B);
         FlashSPI(FlashBaseBlock() + (x >> 16)); // 3-byte address
         FlashSPI(x >> 8);
@@ -331,11 +330,11 @@ int writeIOmap (uint32_t addr, uint32_t x) {
         FlashSPI(0);
         // fall through
     case 0x0A:
-        FlashReadResult = 0;
-        for (int i = 0; i < read_bytes; i++) {
+        io->FlashReadResult = 0;
+        for (int i = 0; i < io->read_bytes; i++) {
             FlashSPI(0);
-            xorkey = GeckoByte();
-            FlashReadResult = (FlashReadResult << 8) + IOspiResult();;
+            io->xorkey = GeckoByte();
+            io->FlashReadResult = (io->FlashReadResult << 8) + IOspiResult();;
          } // note: flash is left open
         break;
 #ifdef HAS_LCDMODULE
@@ -352,7 +351,9 @@ int writeIOmap (uint32_t addr, uint32_t x) {
 #ifdef HAS_LEDSTRIP
     case 0x20: LEDstripWrite(x);  break;
 #endif
-    case 0x100: nohostAPI = x;  break;
+    case 0x32: chadMailTo(x);  break;   // mail destination core
+    case 0x33: chadMailSend(x);  break;
+    case 0x100: io->nohostAPI = x;  break;
     case 0x4000:                        // trigger an error
         chadError(x);  break;
     default: return BAD_IOADDR;
@@ -361,6 +362,6 @@ int writeIOmap (uint32_t addr, uint32_t x) {
 }
 
 void killHostIO(void) {
-    nohostAPI = 1;
+    io->nohostAPI = 1;
 }
 
@@ -3,6 +3,33 @@
 //==============================================================================
 #ifndef __IOMAP_H__
 #define __IOMAP_H__
+#include <stdint.h>
+#include "config.h"
+
+// I/O state, one per chad context (see chad_new).
+
+struct IOContext {
+    uint64_t ChadBootKey;               // boot stream key
+    uint64_t gkey;                      // gecko key being shifted in
+    uint8_t SPIresult;
+    uint8_t xorkey;
+    uint8_t nohostAPI;                  // prohibit access to host API
+    uint8_t txbusy;                     // UART is sending a char
+    uint8_t buf[LineBufferSize];        // keyboard input line
+    int toin;
+    int len;
+    uint32_t WishboneUpperRx;
+    uint32_t WishboneUpperTx;
+    uint32_t FlashReadResult;
+    int read_bytes;                     // Set up flash read parameters
+    int read_addr;                      // address to use in the 4K sector
+    int boot_format;                    // format to use for SPI bus
+    int ispState;                       // JamISP state
+    int ispN;                           // JamISP 12-bit parameter
+    uint32_t codeAddr;                  // code write address
+};
+
+void IOselect(struct IOContext* c);     // for the calling thread
 
 uint32_t readIOmap (uint32_t addr);
 int writeIOmap (uint32_t addr, uint32_t x);
@@ -14,8 +41,6 @@ void FlashMemBoot(int startaddr);
 #define BAD_IOADDR  -70
 #define BAD_HOSTAPI -76
 
-extern uint64_t ChadBootKey;
-
 // Function prototypes for specialzed peripherals
 
 #ifdef HAS_LCDMODULE
@@ -0,0 +1,38 @@
+\ Regression test for the chadRun API through `run-until`. Each run stops
+\ for a different reason, and a watchpoint is tested with and without the
+\ watch bit in the mask. Every engine should print "chadrun passed". See
+\ `make test`.
+
+variable v
+variable ok  -1 ok !
+: pass   ( flag -- )  ok @ and ok ! ;
+: reason ( where code reason r -- where code )  = pass ;
+: code   ( where code c -- where )  = pass ;
+: where  ( where w -- )  = pass ;
+
+: spin   ( -- )  begin again ;
+: hit    ( -- )  nop ;
+: hits   ( -- )  begin hit again ;
+: poke   ( -- )  begin 1 v ! again ;
+: peek   ( -- )  begin v @ drop again ;
+: waits  ( -- )  begin io'rxbusy io@ until ;    \ no keyboard input here
+: badpc  ( -- )  [ $FFFF ] literal >r ;
+
+' spin 1000 1 run-until      1 reason  0 code  ' spin where
+break hit
+' hits 0 2 run-until         2 reason  0 code  ' hit where
+' hits 100 1 run-until       1 reason  drop drop        \ not in the mask
+' hit unbreak
+' waits 0 4 run-until        4 reason  drop drop
+' badpc 0 8 run-until        8 reason  -66 $FFFFFF and code  drop
+v 2 watch
+' poke 0 16 run-until       16 reason  v code  drop
+' poke 0 8 run-until         8 reason  -89 $FFFFFF and code  drop
+' peek 1000 17 run-until     1 reason  drop drop        \ reads aren't watched
+v 1 watch
+' peek 0 16 run-until       16 reason  v code  drop
+v 0 watch
+' poke 1000 17 run-until     1 reason  drop drop        \ removed
+
+ok @ [if] .( chadrun passed) [then] cr
+bye
@@ -0,0 +1,91 @@
+\ Regression test for superinstructions. Each loop starts with `lit call`
+\ a few instructions either side of 64 instructions into its word, where
+\ the old block engine ended a block. Every engine should print
+\ "fusion passed". See `make test`.
+
+: f  dup drop 1+ ;
+
+: t58  ( n -- 2n )  0
+   invert invert invert invert invert invert invert invert invert invert
+   invert invert invert invert invert invert invert invert invert invert
+   invert invert invert invert invert invert invert invert invert invert
+   invert invert invert invert invert invert invert invert invert invert
+   invert invert invert invert invert invert invert invert invert invert
+   invert invert invert invert invert invert invert invert
+   swap  begin  1 f drop  swap 2 + swap  1- dup 0= until  drop ;
+
+: t59  ( n -- 2n )  -1
+   invert invert invert invert invert invert invert invert invert invert
+   invert invert invert invert invert invert invert invert invert invert
+   invert invert invert invert invert invert invert invert invert invert
+   invert invert invert invert invert invert invert invert invert invert
+   invert invert invert invert invert invert invert invert invert invert
+   invert invert invert invert invert invert invert invert invert
+   swap  begin  1 f drop  swap 2 + swap  1- dup 0= until  drop ;
+
+: t60  ( n -- 2n )  0
+   invert invert invert invert invert invert invert invert invert invert
+   invert invert invert invert invert invert invert invert invert invert
+   invert invert invert invert invert invert invert invert invert invert
+   invert invert invert invert invert invert invert invert invert invert
+   invert invert invert invert invert invert invert invert invert invert
+   invert invert invert invert invert invert invert invert invert invert
+   swap  begin  1 f drop  swap 2 + swap  1- dup 0= until  drop ;
+
+: t61  ( n -- 2n )  -1
+   invert invert invert invert invert invert invert invert invert invert
+   invert invert invert invert invert invert invert invert invert invert
+   invert invert invert invert invert invert invert invert invert invert
+   invert invert invert invert invert invert invert invert invert invert
+   invert invert invert invert invert invert invert invert invert invert
+   invert invert invert invert invert invert invert invert invert invert
+   invert
+   swap  begin  1 f drop  swap 2 + swap  1- dup 0= until  drop ;
+
+: t62  ( n -- 2n )  0
+   invert invert invert invert invert invert invert invert invert invert
+   invert invert invert invert invert invert invert invert invert invert
+   invert invert invert invert invert invert invert invert invert invert
+   invert invert invert invert invert invert invert invert invert invert
+   invert invert invert invert invert invert invert invert invert invert
+   invert invert invert invert invert invert invert invert invert invert
+   invert invert
+   swap  begin  1 f drop  swap 2 + swap  1- dup 0= until  drop ;
+
+: t63  ( n -- 2n )  -1
+   invert invert invert invert invert invert invert invert invert invert
+   invert invert invert invert invert invert invert invert invert invert
+   invert invert invert invert invert invert invert invert invert invert
+   invert invert invert invert invert invert invert invert invert invert
+   invert invert invert invert invert invert invert invert invert invert
+   invert invert invert invert invert invert invert invert invert invert
+   invert invert invert
+   swap  begin  1 f drop  swap 2 + swap  1- dup 0= until  drop ;
+
+: t64  ( n -- 2n )  0
+   invert invert invert invert invert invert invert invert invert invert
+   invert invert invert invert invert invert invert invert invert invert
+   invert invert invert invert invert invert invert invert invert invert
+   invert invert invert invert invert invert invert invert invert invert
+   invert invert invert invert invert invert invert invert invert invert
+   invert invert invert invert invert invert invert invert invert invert
+   invert invert invert invert
+   swap  begin  1 f drop  swap 2 + swap  1- dup 0= until  drop ;
+
+: t65  ( n -- 2n )  -1
+   invert invert invert invert invert invert invert invert invert invert
+   invert invert invert invert invert invert invert invert invert invert
+   invert invert invert invert invert invert invert invert invert invert
+   invert invert invert invert invert invert invert invert invert invert
+   invert invert invert invert invert invert invert invert invert invert
+   invert invert invert invert invert invert invert invert invert invert
+   invert invert invert invert invert
+   swap  begin  1 f drop  swap 2 + swap  1- dup 0= until  drop ;
+
+\ The second pass runs the code decoded by the first one.
+0 3 t58 + 3 t59 + 3 t60 + 3 t61 +
+  3 t62 + 3 t63 + 3 t64 + 3 t65 +
+  3 t58 + 3 t59 + 3 t60 + 3 t61 +
+  3 t62 + 3 t63 + 3 t64 + 3 t65 +
+96 = [if] .( fusion passed) [then] cr
+bye
@@ -0,0 +1,23 @@
+\ Regression test for `make-lean-boot`. A word that only a trap passes is
+\ kept and a word nothing reaches is left out. The words defined here have
+\ no flash headers, so only `keep` roots them. Every engine should print
+\ "leanboot passed". See `make test`.
+
+\ myapp prints `there` as it ends, which leaves this address in a data cell.
+\ Data cells that equal an xt keep it, so the first word here is kept.
+: first      ( -- )  ;
+: trapped    ( -- )  1 drop ;
+: unreached  ( -- )  2 drop ;
+CODE trapper                            \ a trap that passes `trapped`
+    ' trapped or $2000 or imm   T ret alu   \ trap is imm with bit 13 set
+;CODE
+keep trapper
+make-lean-boot
+
+-1
+' trapper booted? and
+' trapped booted? and
+' unreached booted? 0= and
+depth 1 = and
+[if] .( leanboot passed) [then] cr
+bye
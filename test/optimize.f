@@ -0,0 +1,58 @@
+\ Regression test for `optimize`. Each word is compiled twice, plain as
+\ x0 and with every pass as x1, and both must leave the same stack. Every
+\ engine should print "optimize passed". See `make test`.
+
+3 0 64 inlining
+
+\ Words that can't be inlined: a forward reference, a word that uses the
+\ return stack, one that exits in the middle and one with its own address.
+
+later fw
+: rs   ( n -- n+1 )  >r 1 r> + ;
+: ex   ( -- 1 )  1 exit 2 ;
+: inc  ( n -- n+1 )  1+ ;
+' inc resolves fw
+15 optimize
+: ad   ( -- addr )  dup drop [ there ] literal ;     \ addr runs the literal
+: ad'  ( -- 0 )  0 ;                                \ runs if it was moved
+
+\ Peephole pairs, constant folding, jump threading and calls.
+
+0 optimize
+: pp0  ( a b -- a+b 0 )
+   over +  swap drop  dup drop  dup  swap swap  over xor ;
+: fo0  ( -- -9 1 )  3 5 + invert  $800000 $800000 +c drop carry ;
+: fs0  ( -- n c )  5 2* 2/ carry ;
+: jt0  ( a b -- n )
+   if  if 1 else 2 then  else  if 3 else 4 then  then ;
+: nl0  ( n -- n+4 n' )
+   fw rs ex +  [ ' inc ] literal execute
+   4 begin  inc  dup 9 = until  ad - ;
+
+15 optimize
+: pp1  ( a b -- a+b 0 )
+   over +  swap drop  dup drop  dup  swap swap  over xor ;
+: fo1  ( -- -9 1 )  3 5 + invert  $800000 $800000 +c drop carry ;
+: fs1  ( -- n c )  5 2* 2/ carry ;
+: jt1  ( a b -- n )
+   if  if 1 else 2 then  else  if 3 else 4 then  then ;
+: nl1  ( n -- n+4 n' )
+   fw rs ex +  [ ' inc ] literal execute
+   4 begin  inc  dup 9 = until  ad - ;
+0 optimize
+
+\ Compare the results. A wrong stack depth shows up at the end.
+
+: same2  ( a b c d -- f )  rot = >r = r> and ;
+-1
+5 7 pp0  5 7 pp1  same2 and
+fo0 fo1  same2 and
+fo1  1 =  swap -9 $FFFFFF and = and and
+fs0 fs1  same2 and
+1 1 jt0  1 1 jt1  = and         0 1 jt0  0 1 jt1  = and
+1 0 jt0  1 0 jt1  = and         0 0 jt0  0 0 jt1  = and
+10 nl0  10 nl1  same2 and
+ad dup execute = and
+depth 1 = and
+[if] .( optimize passed) [then] cr
+bye
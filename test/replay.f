@@ -0,0 +1,21 @@
+\ Regression test for `record`. A run that polls the keyboard is stepped
+\ back one instruction with `rstep` and then finished with `resume`. The
+\ interval is longer than the run, so the replay starts at the keyframe
+\ taken when the run began and reads every poll from the log. The results,
+\ the data and the cycle count read at the end must be the same as the
+\ first time. Every engine should print "replay passed". See `make test`.
+
+variable v
+: work  ( -- sum cycles )
+   0 v !  1000 begin  io'rxbusy io@ drop  dup v +!  1- dup 0= until  drop
+   v @  io'cycles io@ ;
+
+1000000 record
+work  constant c1  constant x1
+rstep
+resume
+c1 =  swap x1 =  and  v @ x1 = and
+0 record
+depth 1 = and
+[if] .( replay passed) [then] cr
+bye
@@ -0,0 +1,18 @@
+\ Regression test for `snapshot` and `restore`. A snapshot is taken, the
+\ machine runs a few thousand cycles and is restored. The data, the stack
+\ pointers and the cycle count must be as they were. Constants are kept by
+\ chad, not the machine, so they survive the restore. Every engine should
+\ print "snapshot passed". See `make test`.
+
+variable v
+: bump  ( -- )  begin  1 v +!  again ;
+
+5 v !  1 2 3
+snapshot  io'cycles io@ constant c0  spstat constant s0
+' bump 5000 1 run-until  drop drop drop  v @ 5 = constant unmoved
+restore  io'cycles io@ c0 =  spstat 1- s0 = and     \ the flag is 1 more
+v @ 5 = and  unmoved 0= and
+>r  3 = swap 2 = and swap 1 = and  r> and
+depth 1 = and
+[if] .( snapshot passed) [then] cr
+bye
@@ -0,0 +1,26 @@
+\ Regression test for `soc-run`. Three cores each write the shared window,
+\ cores 1 and 2 mail core 0, and core 0 stores the mail it got. With a
+\ fixed quantum the result doesn't depend on host thread timing. Every
+\ engine should print "soc passed". See `make test`.
+
+4 cells buffer: win
+: mail  ( -- n )  $33 cells io@ ;               \ next word in this inbox
+
+: work  ( core -- )
+   dup 1+  over cells win + !                   \ win[core] = core + 1
+   dup if  0 $32 cells io!  100 + $33 cells io!  exit  then
+   drop  begin  $32 cells io@  2 = until        \ wait for two words
+   mail 1000 *  mail +  win 3 cells + ! ;
+
+0 win !  0 win cell+ !  0 win 2 cells + !  0 win 3 cells + !
+win 4 cells soc-window
+' work 3 50 soc-run
+
+: win@  ( i -- x )  cells win + @ ;
+-1
+0 win@ 1 = and   1 win@ 2 = and   2 win@ 3 = and
+3 win@ 101102 = and
+$30 cells io@ 0= and                            \ not a core outside soc-run
+depth 1 = and
+[if] .( soc passed) [then] cr
+bye